@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+
+#include "load_generator.h"
+
+static void usage(const char *prog)
+{
+    printf("按照如下格式运行：%s [-a host] [-p port] [-c connections] [-d seconds] [-k] [-P pipeline]\n"
+           "                 [-r rate] [-m page:image:login] [-g page_path] [-i image_path]\n"
+           "                 [-u name:password] [-t timeout_ms] [-s seed]\n"
+           "  -k 保持连接；-P 每个连接上同时在途的请求数(需要-k)；-r 开环模式每秒的请求数，默认闭环\n"
+           "  -m 三类请求的权重，如 70:20:10 表示70%%页面、20%%图片、10%%登录\n",
+           prog);
+}
+
+int main(int argc, char *argv[])
+{
+    load_generator::config conf;
+    conf.host = "127.0.0.1";
+    conf.port = 9006;
+    conf.connections = 10;
+    conf.duration_s = 10;
+    conf.keep_alive = false;
+    conf.pipeline = 1;
+    conf.rate = 0;
+    conf.weights[load_generator::KIND_PAGE] = 1;
+    conf.weights[load_generator::KIND_IMAGE] = 0;
+    conf.weights[load_generator::KIND_LOGIN] = 0;
+    conf.page_path = "/";
+    conf.image_path = "/images/image1.jpg";
+    conf.user = "name";
+    conf.password = "passwd";
+    conf.timeout_ms = 5000;
+    conf.seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:c:d:kP:r:m:g:i:u:t:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            conf.host = optarg;
+            break;
+        case 'p':
+            conf.port = atoi(optarg);
+            break;
+        case 'c':
+            conf.connections = atoi(optarg);
+            break;
+        case 'd':
+            conf.duration_s = atoi(optarg);
+            break;
+        case 'k':
+            conf.keep_alive = true;
+            break;
+        case 'P':
+            conf.pipeline = atoi(optarg);
+            break;
+        case 'r':
+            conf.rate = atoi(optarg);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%d:%d:%d", &conf.weights[load_generator::KIND_PAGE],
+                       &conf.weights[load_generator::KIND_IMAGE],
+                       &conf.weights[load_generator::KIND_LOGIN]) != 3)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'g':
+            conf.page_path = optarg;
+            break;
+        case 'i':
+            conf.image_path = optarg;
+            break;
+        case 'u':
+        {
+            const char *sep = strchr(optarg, ':');
+            if (sep == NULL)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            conf.user.assign(optarg, sep - optarg);
+            conf.password = sep + 1;
+            break;
+        }
+        case 't':
+            conf.timeout_ms = atoi(optarg);
+            break;
+        case 's':
+            conf.seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    load_generator generator(conf);
+    if (!generator.run())
+    {
+        return -1;
+    }
+    generator.report();
+    return 0;
+}
@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "micro_bench.h"
+#include "../http_connect/http_conn.h"
+#include "../timer/listTimer.h"
+#include "../thread_pool/threadPool.hpp"
+#include "../log/block_queue.hpp"
+#include "../log/log.h"
+
+static void usage(const char *prog)
+{
+    printf("按照如下格式运行：%s [-r repetitions] [-t min_time_ms] [-b filter] [-o output] [-L log_dir]\n"
+           "  每个用例输出一行JSON；组件自身也会向标准输出打印信息，需要干净的结果时用-o写到文件\n",
+           prog);
+}
+
+/* ---------------- http_conn::parse ---------------- */
+
+// 录制的请求报文：curl的最简GET、浏览器带完整头部的GET、登录表单POST
+static const char *REQUEST_GET_CURL =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+static const char *REQUEST_GET_BROWSER =
+    "GET /images/image1.jpg HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/118.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://127.0.0.1:9006/welcome.html\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: sid=0123456789abcdef0123456789abcdef\r\n"
+    "\r\n";
+static const char *REQUEST_POST_LOGIN =
+    "POST /2 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 25\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Origin: http://127.0.0.1:9006\r\n"
+    "Referer: http://127.0.0.1:9006/log.html\r\n"
+    "\r\n"
+    "user=name&password=passwd";
+
+static long long bench_parse(long long iterations, void *arg)
+{
+    // http_conn带有读写缓冲，对象较大，放在静态区
+    static http_conn conn;
+    const char *request = (const char *)arg;
+    int len = strlen(request);
+    long long begin = micro_bench::now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        if (conn.parse(request, len) != http_conn::GET_REQUEST)
+        {
+            fprintf(stderr, "--bench_micro: recorded request failed to parse\n");
+            exit(1);
+        }
+    }
+    return micro_bench::now_ns() - begin;
+}
+
+/* ---------------- sort_timer_lst ---------------- */
+
+// 与main.cpp一致：连接有活动时把超时时间延后3个TIMESLOT
+static const int TIMER_SLOT = 5;
+
+static void timer_cb(http_conn *)
+{
+}
+
+static util_timer *new_timer(time_t expire)
+{
+    util_timer *timer = new util_timer;
+    timer->expire = expire;
+    timer->cb_func = timer_cb;
+    timer->data = NULL;
+    return timer;
+}
+
+/*
+    建立含n个定时器的链表，超时时间在[now, now+3*TIMESLOT)内均匀分布，与服务器稳定运行时相同。
+    按超时时间从大到小插入，每个都成为新的表头，建表是O(n)的，不会拖慢用例
+*/
+static void fill_timers(sort_timer_lst &lst, std::vector<util_timer *> &timers, int n, time_t now,
+                        unsigned int *seed)
+{
+    std::vector<time_t> expires(n);
+    for (int i = 0; i < n; i++)
+    {
+        expires[i] = now + rand_r(seed) % (3 * TIMER_SLOT);
+    }
+    std::sort(expires.begin(), expires.end());
+    for (int i = n - 1; i >= 0; i--)
+    {
+        util_timer *timer = new_timer(expires[i]);
+        lst.add_timer(timer);
+        timers.push_back(timer);
+    }
+}
+
+// 在n个定时器的链表上插入一个新连接的定时器再删除它
+static long long bench_timer_add(long long iterations, void *arg)
+{
+    int n = *(int *)arg;
+    unsigned int seed = 1;
+    time_t now = time(NULL);
+    sort_timer_lst lst;
+    std::vector<util_timer *> timers;
+    fill_timers(lst, timers, n, now, &seed);
+    long long begin = micro_bench::now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        util_timer *timer = new_timer(now + 3 * TIMER_SLOT);
+        lst.add_timer(timer);
+        lst.del_timer(timer);
+    }
+    return micro_bench::now_ns() - begin;
+}
+
+// 在n个定时器的链表上随机挑一个连接"有活动"，延后它的超时时间并调整位置
+static long long bench_timer_adjust(long long iterations, void *arg)
+{
+    int n = *(int *)arg;
+    unsigned int seed = 1;
+    time_t now = time(NULL);
+    sort_timer_lst lst;
+    std::vector<util_timer *> timers;
+    fill_timers(lst, timers, n, now, &seed);
+    // 随机下标预先生成，不计入被测时间
+    std::vector<int> picks(iterations < 65536 ? iterations : 65536);
+    for (size_t i = 0; i < picks.size(); i++)
+    {
+        picks[i] = rand_r(&seed) % n;
+    }
+    long long begin = micro_bench::now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        util_timer *timer = timers[picks[i % picks.size()]];
+        timer->expire = now + 3 * TIMER_SLOT + i / n;
+        lst.adjust_timer(timer);
+    }
+    return micro_bench::now_ns() - begin;
+}
+
+// 每次tick处理n个到期的定时器，按每个定时器计算耗时
+static long long bench_timer_tick(long long iterations, void *arg)
+{
+    int n = *(int *)arg;
+    unsigned int seed = 1;
+    time_t past = time(NULL) - 3 * TIMER_SLOT;
+    long long elapsed = 0;
+    for (long long done = 0; done < iterations; done += n)
+    {
+        sort_timer_lst lst;
+        std::vector<util_timer *> timers;
+        fill_timers(lst, timers, n, past, &seed);
+        long long begin = micro_bench::now_ns();
+        lst.tick();
+        elapsed += micro_bench::now_ns() - begin;
+    }
+    // 不足一批的部分也按整批运行，按实际处理的定时器数折算
+    long long batches = (iterations + n - 1) / n;
+    return elapsed * iterations / (batches * n);
+}
+
+/* ---------------- threadPool ---------------- */
+
+struct counting_task
+{
+    std::atomic<long long> done;
+    void process()
+    {
+        done.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 基准测试不设置排队时间上限，不会被调用
+    void expire()
+    {
+        done.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+struct pool_case
+{
+    threadPool<counting_task> *pool;
+    counting_task task;
+};
+
+// 主线程不断append，直到工作线程处理完全部任务，测的是入队+唤醒+出队的吞吐
+static long long bench_pool(long long iterations, void *arg)
+{
+    pool_case *c = (pool_case *)arg;
+    long long target = c->task.done.load() + iterations;
+    long long begin = micro_bench::now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        // 队列满时让出CPU，等工作线程取走任务
+        while (!c->pool->append(&c->task))
+        {
+            sched_yield();
+        }
+    }
+    while (c->task.done.load(std::memory_order_relaxed) < target)
+    {
+        sched_yield();
+    }
+    return micro_bench::now_ns() - begin;
+}
+
+/* ---------------- block_queue ---------------- */
+
+static long long bench_queue_push_pop(long long iterations, void *)
+{
+    block_queue<int> queue(1024, QUEUE_BLOCK);
+    int value = 0;
+    long long begin = micro_bench::now_ns();
+    for (long long i = 0; i < iterations; i++)
+    {
+        queue.push((int)i);
+        queue.pop(value);
+    }
+    return micro_bench::now_ns() - begin;
+}
+
+struct queue_producer_arg
+{
+    block_queue<int> *queue;
+    long long count;
+};
+
+static void *queue_producer(void *arg)
+{
+    queue_producer_arg *p = (queue_producer_arg *)arg;
+    for (long long i = 0; i < p->count; i++)
+    {
+        p->queue->push((int)i);
+    }
+    return NULL;
+}
+
+// 多个生产者push，一个消费者pop_all批量取出，与异步日志的用法相同
+static long long bench_queue_mpsc(long long iterations, void *arg)
+{
+    int producers = *(int *)arg;
+    block_queue<int> queue(1024, QUEUE_BLOCK);
+    std::vector<pthread_t> threads(producers);
+    std::vector<queue_producer_arg> args(producers);
+    long long begin = micro_bench::now_ns();
+    for (int i = 0; i < producers; i++)
+    {
+        args[i].queue = &queue;
+        args[i].count = iterations / producers + (i < iterations % producers ? 1 : 0);
+        pthread_create(&threads[i], NULL, queue_producer, &args[i]);
+    }
+    std::vector<int> items;
+    long long received = 0;
+    while (received < iterations)
+    {
+        items.clear();
+        queue.pop_all(items);
+        received += items.size();
+    }
+    for (int i = 0; i < producers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    return micro_bench::now_ns() - begin;
+}
+
+/* ---------------- log ---------------- */
+
+struct log_thread_arg
+{
+    long long count;
+};
+
+static void *log_writer(void *arg)
+{
+    log_thread_arg *p = (log_thread_arg *)arg;
+    for (long long i = 0; i < p->count; i++)
+    {
+        LOG_INFO("--bench line %lld, client %s, status %d", i, "127.0.0.1", 200);
+    }
+    return NULL;
+}
+
+// threads个线程同时写日志，测的是调用线程一侧每行的平均耗时
+static long long bench_log(long long iterations, void *arg)
+{
+    int threads = *(int *)arg;
+    std::vector<pthread_t> tids(threads);
+    std::vector<log_thread_arg> args(threads);
+    long long begin = micro_bench::now_ns();
+    for (int i = 0; i < threads; i++)
+    {
+        args[i].count = iterations / threads + (i < iterations % threads ? 1 : 0);
+        pthread_create(&tids[i], NULL, log_writer, &args[i]);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    return micro_bench::now_ns() - begin;
+}
+
+/*
+    日志类是单例，init只能调用一次，每种写入模式在单独的子进程中运行。
+    异步模式的队列用阻塞策略，测出的是不丢日志时调用线程能达到的速率
+*/
+static void run_log_mode(micro_bench &bench, FILE *out, const std::string &log_dir, int mode, const char *mode_name)
+{
+    static int thread_counts[] = {1, 4};
+    char names[2][64];
+    bool any = false;
+    for (int i = 0; i < 2; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "log/write/%s/threads=%d", mode_name, thread_counts[i]);
+        any = any || bench.selected(names[i]);
+    }
+    if (!any)
+    {
+        return;
+    }
+    fflush(out);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        std::string file = log_dir + "/BenchLog.log";
+        log::get_instance()->set_queue_policy(QUEUE_BLOCK);
+        log::get_instance()->init(log::LEVEL_INFO, file.c_str(), 2048, 16LL * 1024 * 1024,
+                                  mode == log::ASYNC ? 1024 : 0, mode);
+        for (int i = 0; i < 2; i++)
+        {
+            bench.run(names[i], bench_log, &thread_counts[i]);
+        }
+        exit(0);
+    }
+    if (pid > 0)
+    {
+        waitpid(pid, NULL, 0);
+    }
+    // 每种模式结束后删除它写出的日志文件
+    DIR *dir = opendir(log_dir.c_str());
+    if (dir != NULL)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (entry->d_name[0] != '.')
+            {
+                unlink((log_dir + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    micro_bench::options opt;
+    opt.repetitions = 5;
+    opt.min_time_ms = 200;
+    const char *output = NULL;
+    std::string log_parent = "/tmp";
+
+    int c;
+    while ((c = getopt(argc, argv, "r:t:b:o:L:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'r':
+            opt.repetitions = atoi(optarg);
+            break;
+        case 't':
+            opt.min_time_ms = atoi(optarg);
+            break;
+        case 'b':
+            opt.filter = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'L':
+            log_parent = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : -1;
+        }
+    }
+    FILE *out = stdout;
+    if (output != NULL && (out = fopen(output, "w")) == NULL)
+    {
+        perror(output);
+        return -1;
+    }
+    micro_bench bench(opt, out);
+
+    // 除日志用例外不初始化日志，被测组件里的日志语句按等级直接跳过
+    log::set_log_level(log::LEVEL_ERROR);
+
+    bench.run("parse/get_curl", bench_parse, (void *)REQUEST_GET_CURL);
+    bench.run("parse/get_browser", bench_parse, (void *)REQUEST_GET_BROWSER);
+    bench.run("parse/post_login", bench_parse, (void *)REQUEST_POST_LOGIN);
+
+    static int timer_sizes[] = {100, 1000, 10000};
+    for (int i = 0; i < 3; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "timer/add/n=%d", timer_sizes[i]);
+        bench.run(name, bench_timer_add, &timer_sizes[i]);
+        snprintf(name, sizeof(name), "timer/adjust/n=%d", timer_sizes[i]);
+        bench.run(name, bench_timer_adjust, &timer_sizes[i]);
+        snprintf(name, sizeof(name), "timer/tick/n=%d", timer_sizes[i]);
+        bench.run(name, bench_timer_tick, &timer_sizes[i]);
+    }
+
+    static int pool_threads[] = {1, 4};
+    for (int i = 0; i < 2; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "threadpool/append_dispatch/threads=%d", pool_threads[i]);
+        if (!bench.selected(name))
+        {
+            continue;
+        }
+        pool_case *pc = new pool_case;
+        pc->task.done.store(0);
+        pc->pool = new threadPool<counting_task>(pool_threads[i], 10000);
+        bench.run(name, bench_pool, pc);
+        // 析构时等待工作线程退出
+        delete pc->pool;
+        delete pc;
+    }
+
+    bench.run("block_queue/push_pop", bench_queue_push_pop, NULL);
+    static int producers[] = {1, 4};
+    for (int i = 0; i < 2; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "block_queue/mpsc/producers=%d", producers[i]);
+        bench.run(name, bench_queue_mpsc, &producers[i]);
+    }
+
+    {
+        std::string log_dir = log_parent + "/bench_micro.XXXXXX";
+        std::vector<char> dir_buf(log_dir.begin(), log_dir.end());
+        dir_buf.push_back('\0');
+        if (mkdtemp(&dir_buf[0]) == NULL)
+        {
+            perror("mkdtemp");
+            return -1;
+        }
+        log_dir = &dir_buf[0];
+        run_log_mode(bench, out, log_dir, log::SYNC, "SYNC");
+        run_log_mode(bench, out, log_dir, log::ASYNC, "ASYNC");
+        run_log_mode(bench, out, log_dir, log::BUFFERED, "BUFFERED");
+        run_log_mode(bench, out, log_dir, log::DEFERRED, "DEFERRED");
+        rmdir(log_dir.c_str());
+    }
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
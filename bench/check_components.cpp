@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+
+#include "../metrics/hdr_histogram.h"
+#include "../http_connect/overload_controller.h"
+#include "../http_connect/static_cache.h"
+#include "../thread_pool/threadPool.hpp"
+#include "../log/log.h"
+
+/*
+    组件的正确性检查
+
+    不依赖服务器和数据库，直接驱动各个组件并核对结果，任何一项不符都以非0退出，
+    由ctest运行(也可以直接运行)。只打印不符的项和最后的汇总
+*/
+
+static int g_checks = 0;
+static int g_failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static void check(bool ok, const char *expr, const char *file, int line)
+{
+    g_checks++;
+    if (!ok)
+    {
+        g_failures++;
+        printf("--check failed: %s (%s:%d)\n", expr, file, line);
+    }
+}
+
+/* ---------------- hdr_histogram ---------------- */
+
+// 与metrics、bench_load一致：1us~1小时，3位有效数字
+static const int64_t HDR_HIGHEST = 3600LL * 1000 * 1000;
+
+static void check_hdr_exact_range()
+{
+    // 一段的子桶数为2048，这以下的值都落在宽度为1的桶里，分位数是精确的
+    hdr_histogram h(HDR_HIGHEST, 3);
+    CHECK(h.total_count() == 0);
+    CHECK(h.value_at_percentile(50) == 0);
+    CHECK(h.min() == 0);
+    for (int v = 1; v <= 1000; v++)
+    {
+        h.record(v);
+    }
+    CHECK(h.total_count() == 1000);
+    CHECK(h.min() == 1);
+    CHECK(h.max() == 1000);
+    CHECK(h.mean() == 500.5);
+    CHECK(h.value_at_percentile(0) == 1);
+    CHECK(h.value_at_percentile(50) == 500);
+    CHECK(h.value_at_percentile(99) == 990);
+    CHECK(h.value_at_percentile(99.9) == 999);
+    CHECK(h.value_at_percentile(100) == 1000);
+    CHECK(h.value_at_percentile(150) == 1000);
+
+    h.reset();
+    CHECK(h.total_count() == 0);
+    h.record(7, 10);
+    CHECK(h.total_count() == 10);
+    CHECK(h.value_at_percentile(100) == 7);
+}
+
+static void check_hdr_precision()
+{
+    /*
+        各个量级上记录一个值，它所在桶的上界(分位数的返回值)不小于它本身，
+        且相对误差不超过千分之一；再记录一个最大值，免得返回值被max截断
+    */
+    hdr_histogram h(HDR_HIGHEST, 3);
+    for (int64_t v = 1; v < HDR_HIGHEST; v = v * 13 / 10 + 1)
+    {
+        h.reset();
+        h.record(v);
+        h.record(HDR_HIGHEST);
+        int64_t p = h.value_at_percentile(50);
+        CHECK(p >= v);
+        CHECK((p - v) * 1000 <= v);
+        if (v < 2048)
+        {
+            CHECK(p == v);
+        }
+    }
+}
+
+static void check_hdr_clamp_merge()
+{
+    hdr_histogram h(HDR_HIGHEST, 3);
+    // 负数按0记录，超出上限的值按上限记录
+    h.record(-5);
+    h.record(HDR_HIGHEST * 2);
+    CHECK(h.min() == 0);
+    CHECK(h.max() == HDR_HIGHEST);
+    CHECK(h.value_at_percentile(100) == HDR_HIGHEST);
+
+    hdr_histogram a(HDR_HIGHEST, 3);
+    hdr_histogram b(HDR_HIGHEST, 3);
+    for (int v = 1; v <= 500; v++)
+    {
+        a.record(v);
+        b.record(v + 500);
+    }
+    CHECK(a.merge(b));
+    CHECK(a.total_count() == 1000);
+    CHECK(a.min() == 1);
+    CHECK(a.max() == 1000);
+    CHECK(a.value_at_percentile(50) == 500);
+
+    // 参数不同的直方图桶的划分不同，不能合并
+    hdr_histogram other(HDR_HIGHEST, 2);
+    CHECK(!a.merge(other));
+    CHECK(a.total_count() == 1000);
+}
+
+static void check_hdr_subtract()
+{
+    // 由两次累计快照相减得到这段时间内的分布，与指标模块每个周期输出分位数的用法一致
+    hdr_histogram total(HDR_HIGHEST, 3);
+    for (int v = 1; v <= 1000; v++)
+    {
+        total.record(v);
+    }
+    hdr_histogram earlier = total;
+    total.record(5000, 1000);
+    hdr_histogram period = total;
+    CHECK(period.subtract(earlier));
+    CHECK(period.total_count() == 1000);
+    CHECK(period.mean() == 5000);
+    // 最小/最大值按剩下的计数重新求出，精确到桶：5000所在的桶宽为4
+    CHECK(period.min() <= 5000 && period.min() > 5000 - 4);
+    CHECK(period.max() >= 5000 && period.max() < 5000 + 4);
+    CHECK(period.value_at_percentile(0) >= 5000 && period.value_at_percentile(0) < 5000 + 4);
+    CHECK(period.value_at_percentile(100) == period.max());
+    // 累计的直方图本身不受影响
+    CHECK(total.total_count() == 2000);
+    CHECK(total.value_at_percentile(50) == 1000);
+
+    // 两次快照之间没有新记录
+    hdr_histogram empty = earlier;
+    CHECK(empty.subtract(earlier));
+    CHECK(empty.total_count() == 0);
+    CHECK(empty.value_at_percentile(99) == 0);
+
+    hdr_histogram other(HDR_HIGHEST, 2);
+    CHECK(!period.subtract(other));
+}
+
+/* ---------------- overload_controller ---------------- */
+
+static void check_overload_depth()
+{
+    overload_controller oc(10, 0, 1);
+    CHECK(oc.admit(0));
+    CHECK(oc.admit(9));
+    CHECK(!oc.admit(10));
+    CHECK(!oc.admit(1000));
+    // 没有设置排队时间上限，排队再久也只按排队数拒绝
+    for (int i = 0; i < 64; i++)
+    {
+        oc.observe_queue_delay(1000000);
+    }
+    CHECK(oc.admit(9));
+}
+
+static void check_overload_delay()
+{
+    overload_controller oc(0, 5, 1);
+    CHECK(oc.get_queue_delay() == 0);
+    CHECK(oc.admit(1000));
+    // 平均值按1/8的权重逼近，持续8ms的排队时间很快超过5ms的上限
+    for (int i = 0; i < 64; i++)
+    {
+        oc.observe_queue_delay(8000);
+    }
+    CHECK(oc.get_queue_delay() > 5000 && oc.get_queue_delay() <= 8000);
+    CHECK(!oc.admit(1));
+    // 队列已经排空时不按排队时间拒绝，新请求才能进来刷新平均值
+    CHECK(oc.admit(0));
+    for (int i = 0; i < 64; i++)
+    {
+        oc.observe_queue_delay(0);
+    }
+    CHECK(oc.get_queue_delay() < 5000);
+    CHECK(oc.admit(1));
+}
+
+static void check_overload_response()
+{
+    overload_controller oc(0, 0, 3);
+    CHECK(oc.admit(1000000));
+    const char *resp = oc.get_response();
+    CHECK(oc.get_response_len() == (int)strlen(resp));
+    CHECK(strncmp(resp, "HTTP/1.1 503 ", 13) == 0);
+    CHECK(strstr(resp, "Retry-After: 3\r\n") != NULL);
+    CHECK(strstr(resp, "Connection: close\r\n") != NULL);
+    // Content-Length与正文一致
+    const char *body = strstr(resp, "\r\n\r\n");
+    const char *length = strstr(resp, "Content-Length: ");
+    CHECK(body != NULL && length != NULL);
+    if (body != NULL && length != NULL)
+    {
+        CHECK(atoi(length + 16) == (int)strlen(body + 4));
+    }
+}
+
+/* ---------------- threadPool的排队时间检查 ---------------- */
+
+// 记录被执行和被expire()的次数，busy_ms不为0时每次执行占用工作线程这么久
+struct check_task
+{
+    std::atomic<int> processed;
+    std::atomic<int> expired;
+    int busy_ms;
+    explicit check_task(int ms) : processed(0), expired(0), busy_ms(ms) {}
+    void process()
+    {
+        if (busy_ms > 0)
+        {
+            usleep(busy_ms * 1000);
+        }
+        processed.fetch_add(1);
+    }
+    void expire()
+    {
+        expired.fetch_add(1);
+    }
+    int done()
+    {
+        return processed.load() + expired.load();
+    }
+};
+
+// 等到任务都处理完(执行或expire)，最多等5秒
+static bool wait_done(check_task &t, int n)
+{
+    for (int i = 0; i < 5000 && t.done() < n; i++)
+    {
+        usleep(1000);
+    }
+    return t.done() >= n;
+}
+
+static void check_pool_deadline()
+{
+    threadPool<check_task> pool(1, 100);
+    pool.set_queue_deadline(20);
+    check_task blocker(60);
+    check_task quick(0);
+    // 先确认工作线程已经在等任务，后面的排队时间才只由blocker决定
+    pool.append(&quick);
+    CHECK(wait_done(quick, 1));
+    pool.append(&blocker);
+    for (int i = 0; i < 5; i++)
+    {
+        pool.append(&quick);
+    }
+    CHECK(wait_done(blocker, 1));
+    CHECK(wait_done(quick, 6));
+    // 排在blocker后面的任务都等了60ms以上，超过20ms的上限，不再执行
+    CHECK(blocker.processed.load() == 1);
+    CHECK(quick.processed.load() == 1);
+    CHECK(quick.expired.load() == 5);
+    CHECK(pool.get_expired_deadline() == 5);
+    CHECK(pool.get_expired_codel() == 0);
+}
+
+static void check_pool_codel()
+{
+    // 目标5ms、间隔20ms：排队时间高于目标并持续一个间隔后才开始丢弃
+    threadPool<check_task> pool(1, 100);
+    pool.set_queue_deadline(0, 5, 20);
+    check_task blocker(100);
+    check_task quick(0);
+    pool.append(&quick);
+    CHECK(wait_done(quick, 1));
+
+    // 短暂的突发：blocker之后的任务虽然排队很久，但在一个间隔内就全部取完，不丢弃
+    pool.append(&blocker);
+    for (int i = 0; i < 20; i++)
+    {
+        pool.append(&quick);
+    }
+    CHECK(wait_done(quick, 21));
+    CHECK(quick.expired.load() == 0);
+    CHECK(pool.get_expired_codel() == 0);
+
+    // 持续的积压：每个任务执行5ms，排队时间一直高于目标，超过一个间隔后开始丢弃
+    check_task slow(5);
+    pool.append(&blocker);
+    for (int i = 0; i < 20; i++)
+    {
+        pool.append(&slow);
+    }
+    CHECK(wait_done(slow, 20));
+    CHECK(slow.expired.load() >= 1);
+    CHECK(slow.processed.load() >= 1);
+    CHECK(pool.get_expired_codel() == slow.expired.load());
+    CHECK(pool.get_expired_deadline() == 0);
+}
+
+/* ---------------- static_cache ---------------- */
+
+// 写入文件并stat，成功返回true
+static bool write_file(const std::string &path, const char *content, struct stat *st)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    fputs(content, fp);
+    fclose(fp);
+    return stat(path.c_str(), st) == 0;
+}
+
+static void check_static_cache()
+{
+    char dir[] = "/tmp/check_components.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        CHECK(!"mkdtemp");
+        return;
+    }
+    std::string small = std::string(dir) + "/small.html";
+    std::string other = std::string(dir) + "/other.html";
+    std::string large = std::string(dir) + "/large.html";
+    struct stat st_small, st_other, st_large;
+    CHECK(write_file(small, "hello", &st_small));
+    CHECK(write_file(other, "world", &st_other));
+    CHECK(write_file(large, "0123456789abcdefghij", &st_large));
+
+    // 总共最多8字节，单个文件最多16字节
+    static_cache cache(8, 16, 1000);
+    CHECK(!cache.lookup(small.c_str()));
+    static_cache::entry_ptr e = cache.get(small.c_str(), st_small);
+    CHECK(e && e->size == 5 && memcmp(e->data, "hello", 5) == 0);
+    CHECK(cache.get_bytes() == 5);
+    // 刚校验过的条目，主线程快路径直接命中同一个条目
+    CHECK(cache.lookup(small.c_str()) == e);
+    CHECK(cache.get(small.c_str(), st_small) == e);
+    // 超过单个文件上限、缓存已满时都不缓存
+    CHECK(!cache.get(large.c_str(), st_large));
+    CHECK(!cache.get(other.c_str(), st_other));
+    CHECK(!cache.lookup(other.c_str()));
+    CHECK(cache.get_bytes() == 5);
+
+    // 文件变化后重新读入，旧条目在持有者释放前仍然有效
+    usleep(10000);
+    struct stat st_changed;
+    CHECK(write_file(small, "hi!", &st_changed));
+    static_cache::entry_ptr changed = cache.get(small.c_str(), st_changed);
+    CHECK(changed && changed != e && changed->size == 3 && memcmp(changed->data, "hi!", 3) == 0);
+    CHECK(e->size == 5 && memcmp(e->data, "hello", 5) == 0);
+    CHECK(cache.get_bytes() == 3);
+
+    // 超过revalidate_ms没有核对的条目，快路径不再命中，交给get()重新校验
+    static_cache strict(1024, 1024, 20);
+    CHECK(strict.get(other.c_str(), st_other) != NULL);
+    usleep(50000);
+    CHECK(!strict.lookup(other.c_str()));
+    CHECK(strict.get(other.c_str(), st_other) != NULL);
+    CHECK(strict.lookup(other.c_str()) != NULL);
+
+    unlink(small.c_str());
+    unlink(other.c_str());
+    unlink(large.c_str());
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    // 不初始化日志，被测组件里的日志语句按等级直接跳过
+    log::set_log_level(log::LEVEL_ERROR);
+
+    check_hdr_exact_range();
+    check_hdr_precision();
+    check_hdr_clamp_merge();
+    check_hdr_subtract();
+    check_overload_depth();
+    check_overload_delay();
+    check_overload_response();
+    check_pool_deadline();
+    check_pool_codel();
+    check_static_cache();
+
+    printf("--%d checks, %d failed\n", g_checks, g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
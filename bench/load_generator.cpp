@@ -0,0 +1,565 @@
+#include "load_generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+// 延迟最大记录到1小时，3位有效数字
+static const int64_t MAX_LATENCY_US = 3600LL * 1000000;
+// 连接失败后重试的间隔
+static const int64_t RECONNECT_DELAY_US = 100 * 1000;
+// 响应头的最大长度，超过即视为格式错误
+static const size_t MAX_HEADER_SIZE = 64 * 1024;
+static const int MAX_EVENTS = 1024;
+
+load_generator::load_generator(const config &conf)
+    : m_conf(conf), m_epollfd(-1), m_next_conn(0), m_weight_total(0), m_rand_state(conf.seed), m_stopping(false),
+      m_next_due_us(0), m_interval_ns(0), m_due_count(0), m_latency(MAX_LATENCY_US, 3),
+      m_begin_us(0), m_end_us(0), m_bytes_received(0), m_connect_errors(0), m_io_errors(0),
+      m_timeouts(0), m_bad_responses(0), m_unsent(0)
+{
+    if (m_conf.connections < 1)
+    {
+        m_conf.connections = 1;
+    }
+    if (m_conf.pipeline < 1 || !m_conf.keep_alive)
+    {
+        m_conf.pipeline = 1;
+    }
+    for (int i = 0; i < KIND_COUNT; i++)
+    {
+        if (m_conf.weights[i] < 0)
+        {
+            m_conf.weights[i] = 0;
+        }
+        m_weight_total += m_conf.weights[i];
+        m_sent[i] = 0;
+        m_completed[i] = 0;
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        m_status_class[i] = 0;
+    }
+
+    // 三类请求的报文是固定的，预先拼好，发送时只做一次追加
+    char host[300];
+    snprintf(host, sizeof(host), "%s:%d", m_conf.host.c_str(), m_conf.port);
+    std::string common = std::string("Host: ") + host + "\r\nUser-Agent: bench_load\r\nConnection: " +
+                         (m_conf.keep_alive ? "keep-alive" : "close") + "\r\n";
+    m_requests[KIND_PAGE] = "GET " + m_conf.page_path + " HTTP/1.1\r\n" + common + "\r\n";
+    m_requests[KIND_IMAGE] = "GET " + m_conf.image_path + " HTTP/1.1\r\n" + common + "\r\n";
+    std::string body = "user=" + m_conf.user + "&password=" + m_conf.password;
+    char length[64];
+    snprintf(length, sizeof(length), "Content-Length: %zu\r\n", body.size());
+    m_requests[KIND_LOGIN] = "POST /2 HTTP/1.1\r\n" + common +
+                             "Content-Type: application/x-www-form-urlencoded\r\n" + length + "\r\n" + body;
+}
+
+load_generator::~load_generator()
+{
+    for (size_t i = 0; i < m_conns.size(); i++)
+    {
+        if (m_conns[i].fd >= 0)
+        {
+            close(m_conns[i].fd);
+        }
+    }
+    if (m_epollfd >= 0)
+    {
+        close(m_epollfd);
+    }
+}
+
+int64_t load_generator::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int load_generator::pick_kind()
+{
+    if (m_weight_total <= 0)
+    {
+        return KIND_PAGE;
+    }
+    int r = rand_r(&m_rand_state) % m_weight_total;
+    for (int i = 0; i < KIND_COUNT; i++)
+    {
+        if (r < m_conf.weights[i])
+        {
+            return i;
+        }
+        r -= m_conf.weights[i];
+    }
+    return KIND_PAGE;
+}
+
+bool load_generator::open_connection(connection *c)
+{
+    c->connected = false;
+    c->used = false;
+    c->out.clear();
+    c->out_sent = 0;
+    c->in.clear();
+    c->inflight.clear();
+    c->body_left = -1;
+    c->status = 0;
+    c->want_write = false;
+    c->connect_start_us = now_us();
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0)
+    {
+        m_connect_errors++;
+        c->retry_at_us = c->connect_start_us + RECONNECT_DELAY_US;
+        return false;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (sockaddr *)&m_server_addr, sizeof(m_server_addr)) < 0 && errno != EINPROGRESS)
+    {
+        m_connect_errors++;
+        close(c->fd);
+        c->fd = -1;
+        c->retry_at_us = c->connect_start_us + RECONNECT_DELAY_US;
+        return false;
+    }
+    // 连接建立完成时套接字变为可写
+    epoll_event event;
+    event.events = EPOLLOUT;
+    event.data.u32 = c - &m_conns[0];
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, c->fd, &event);
+    return true;
+}
+
+void load_generator::close_connection(connection *c, bool count_lost)
+{
+    if (count_lost)
+    {
+        m_io_errors += c->inflight.size();
+    }
+    if (c->fd >= 0)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->connected = false;
+    c->inflight.clear();
+    c->retry_at_us = 0;
+}
+
+void load_generator::send_request(connection *c, int64_t start_us)
+{
+    request req;
+    req.kind = pick_kind();
+    req.start_us = start_us;
+    req.sent_us = now_us();
+    c->out += m_requests[req.kind];
+    c->inflight.push_back(req);
+    c->used = true;
+    m_sent[req.kind]++;
+}
+
+bool load_generator::flush_output(connection *c)
+{
+    while (c->out_sent < c->out.size())
+    {
+        ssize_t n = send(c->fd, c->out.data() + c->out_sent, c->out.size() - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // 发送缓冲满了，等可写时再继续
+                if (!c->want_write)
+                {
+                    epoll_event event;
+                    event.events = EPOLLIN | EPOLLOUT;
+                    event.data.u32 = c - &m_conns[0];
+                    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, c->fd, &event);
+                    c->want_write = true;
+                }
+                return true;
+            }
+            return false;
+        }
+        c->out_sent += n;
+    }
+    c->out.clear();
+    c->out_sent = 0;
+    if (c->want_write)
+    {
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = c - &m_conns[0];
+        epoll_ctl(m_epollfd, EPOLL_CTL_MOD, c->fd, &event);
+        c->want_write = false;
+    }
+    return true;
+}
+
+bool load_generator::read_input(connection *c, int64_t now)
+{
+    char buf[64 * 1024];
+    while (true)
+    {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            return false;
+        }
+        if (n == 0)
+        {
+            // 对端关闭连接，之前收到的完整响应仍然有效
+            return false;
+        }
+        m_bytes_received += n;
+        // 响应体只需要数出字节数，不必放进接收缓冲
+        if (c->body_left > 0 && c->in.empty())
+        {
+            int64_t take = n < c->body_left ? n : c->body_left;
+            c->body_left -= take;
+            if (c->body_left == 0 || take < n)
+            {
+                c->in.assign(buf + take, n - take);
+                if (!parse_responses(c, now))
+                {
+                    m_bad_responses++;
+                    return false;
+                }
+            }
+            continue;
+        }
+        c->in.append(buf, n);
+        if (!parse_responses(c, now))
+        {
+            m_bad_responses++;
+            return false;
+        }
+    }
+}
+
+bool load_generator::parse_responses(connection *c, int64_t now)
+{
+    while (true)
+    {
+        if (c->body_left < 0)
+        {
+            size_t header_end = c->in.find("\r\n\r\n");
+            if (header_end == std::string::npos)
+            {
+                return c->in.size() <= MAX_HEADER_SIZE;
+            }
+            if (c->in.compare(0, 7, "HTTP/1.") != 0 || c->in.size() < 12)
+            {
+                return false;
+            }
+            c->status = atoi(c->in.c_str() + 9);
+            // 服务器的每个响应都带有Content-Length
+            int64_t content_length = 0;
+            size_t line = c->in.find("\r\n") + 2;
+            while (line < header_end)
+            {
+                size_t line_end = c->in.find("\r\n", line);
+                if (strncasecmp(c->in.c_str() + line, "Content-Length:", 15) == 0)
+                {
+                    content_length = atoll(c->in.c_str() + line + 15);
+                }
+                line = line_end + 2;
+            }
+            c->in.erase(0, header_end + 4);
+            c->body_left = content_length;
+        }
+        size_t take = c->in.size() < (size_t)c->body_left ? c->in.size() : (size_t)c->body_left;
+        c->in.erase(0, take);
+        c->body_left -= take;
+        if (c->body_left > 0)
+        {
+            return true;
+        }
+
+        // 一个完整的响应，对应最早发出的请求
+        if (c->inflight.empty())
+        {
+            return false;
+        }
+        request req = c->inflight.front();
+        c->inflight.pop_front();
+        if (!m_stopping)
+        {
+            m_latency.record(now - req.start_us);
+            m_completed[req.kind]++;
+            int status_class = c->status / 100;
+            m_status_class[status_class >= 1 && status_class <= 5 ? status_class : 0]++;
+        }
+        c->body_left = -1;
+        c->status = 0;
+        if (c->in.empty())
+        {
+            return true;
+        }
+    }
+}
+
+void load_generator::dispatch(int64_t now)
+{
+    int count = m_conns.size();
+    for (int i = 0; i < count; i++)
+    {
+        // 开环模式下从上次的位置开始轮转，使请求均匀地分到各个连接上
+        connection *c = &m_conns[(m_next_conn + i) % count];
+        if (c->fd < 0)
+        {
+            if (now >= c->retry_at_us)
+            {
+                open_connection(c);
+            }
+            continue;
+        }
+        if (!c->connected || (!m_conf.keep_alive && c->used))
+        {
+            continue;
+        }
+        bool added = false;
+        while ((int)c->inflight.size() < m_conf.pipeline)
+        {
+            int64_t start;
+            if (m_conf.rate > 0)
+            {
+                if (m_backlog.empty())
+                {
+                    break;
+                }
+                start = m_backlog.front();
+                m_backlog.pop_front();
+            }
+            else
+            {
+                // 不保持连接时，建立连接的时间也算在请求的延迟里
+                start = m_conf.keep_alive ? now : c->connect_start_us;
+            }
+            send_request(c, start);
+            added = true;
+        }
+        if (added && !flush_output(c))
+        {
+            close_connection(c, true);
+        }
+        if (m_conf.rate > 0 && m_backlog.empty())
+        {
+            m_next_conn = (m_next_conn + i + 1) % count;
+            break;
+        }
+    }
+}
+
+void load_generator::check_timeouts(int64_t now)
+{
+    int64_t timeout = (int64_t)m_conf.timeout_ms * 1000;
+    for (size_t i = 0; i < m_conns.size(); i++)
+    {
+        connection *c = &m_conns[i];
+        if (c->fd < 0)
+        {
+            continue;
+        }
+        if (!c->connected)
+        {
+            if (now - c->connect_start_us > timeout)
+            {
+                m_connect_errors++;
+                close_connection(c, false);
+            }
+            continue;
+        }
+        if (!c->inflight.empty() && now - c->inflight.front().sent_us > timeout)
+        {
+            // 等不到的响应计为超时，之后的响应也无法再对应，整个连接重建
+            m_timeouts += c->inflight.size();
+            close_connection(c, false);
+        }
+    }
+}
+
+bool load_generator::run()
+{
+    memset(&m_server_addr, 0, sizeof(m_server_addr));
+    m_server_addr.sin_family = AF_INET;
+    m_server_addr.sin_port = htons(m_conf.port);
+    if (inet_pton(AF_INET, m_conf.host.c_str(), &m_server_addr.sin_addr) != 1)
+    {
+        struct addrinfo hints, *result = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(m_conf.host.c_str(), NULL, &hints, &result) != 0 || result == NULL)
+        {
+            printf("--bench_load: cannot resolve %s\n", m_conf.host.c_str());
+            return false;
+        }
+        m_server_addr.sin_addr = ((sockaddr_in *)result->ai_addr)->sin_addr;
+        freeaddrinfo(result);
+    }
+    m_epollfd = epoll_create(5);
+    if (m_epollfd < 0)
+    {
+        return false;
+    }
+
+    m_conns.resize(m_conf.connections);
+    for (size_t i = 0; i < m_conns.size(); i++)
+    {
+        m_conns[i].fd = -1;
+        m_conns[i].retry_at_us = 0;
+    }
+    m_next_conn = 0;
+    if (m_conf.rate > 0)
+    {
+        m_interval_ns = 1000000000LL / m_conf.rate;
+    }
+
+    epoll_event events[MAX_EVENTS];
+    m_begin_us = now_us();
+    int64_t deadline = m_begin_us + (int64_t)m_conf.duration_s * 1000000;
+    int64_t next_timeout_check = m_begin_us;
+    int64_t now = m_begin_us;
+    while (now < deadline)
+    {
+        if (m_conf.rate > 0)
+        {
+            // 用序号乘间隔得到预定时刻，不会累积误差
+            while ((m_next_due_us = m_begin_us + m_due_count * m_interval_ns / 1000) <= now)
+            {
+                m_backlog.push_back(m_next_due_us);
+                m_due_count++;
+            }
+        }
+        dispatch(now);
+
+        int wait_ms = 10;
+        if (m_conf.rate > 0 && m_backlog.empty())
+        {
+            int64_t until_due = (m_next_due_us - now + 999) / 1000;
+            wait_ms = until_due < wait_ms ? (int)until_due : wait_ms;
+        }
+        int number = epoll_wait(m_epollfd, events, MAX_EVENTS, wait_ms);
+        if (number < 0 && errno != EINTR)
+        {
+            break;
+        }
+        now = now_us();
+        for (int i = 0; i < number; i++)
+        {
+            connection *c = &m_conns[events[i].data.u32];
+            if (c->fd < 0)
+            {
+                continue;
+            }
+            if (!c->connected)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0 || (events[i].events & (EPOLLERR | EPOLLHUP)))
+                {
+                    m_connect_errors++;
+                    close_connection(c, false);
+                    c->retry_at_us = now + RECONNECT_DELAY_US;
+                    continue;
+                }
+                c->connected = true;
+                epoll_event event;
+                event.events = EPOLLIN;
+                event.data.u32 = events[i].data.u32;
+                epoll_ctl(m_epollfd, EPOLL_CTL_MOD, c->fd, &event);
+                continue;
+            }
+            bool ok = true;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            {
+                ok = read_input(c, now);
+            }
+            if (ok && (events[i].events & EPOLLOUT))
+            {
+                ok = flush_output(c);
+            }
+            if (!ok)
+            {
+                close_connection(c, true);
+            }
+            else if (!m_conf.keep_alive && c->used && c->inflight.empty())
+            {
+                // 不保持连接：响应收完就关闭，下一轮重新建立连接
+                close_connection(c, false);
+            }
+        }
+        if (now >= next_timeout_check)
+        {
+            check_timeouts(now);
+            next_timeout_check = now + 10 * 1000;
+        }
+    }
+    m_end_us = now_us();
+    m_stopping = true;
+    // 到时间还没来得及发出的请求说明服务器(或本客户端)跟不上预定的速率
+    m_unsent = m_backlog.size();
+    return true;
+}
+
+void load_generator::report()
+{
+    double seconds = (m_end_us - m_begin_us) / 1000000.0;
+    if (seconds <= 0)
+    {
+        seconds = 1;
+    }
+    int64_t completed = m_latency.total_count();
+    if (m_conf.rate > 0)
+    {
+        printf("--bench_load %s:%d open-loop %d req/s, %d connections, %s, pipeline %d, %.1fs\n",
+               m_conf.host.c_str(), m_conf.port, m_conf.rate, m_conf.connections,
+               m_conf.keep_alive ? "keep-alive" : "close", m_conf.pipeline, seconds);
+    }
+    else
+    {
+        printf("--bench_load %s:%d closed-loop, %d connections, %s, pipeline %d, %.1fs\n",
+               m_conf.host.c_str(), m_conf.port, m_conf.connections,
+               m_conf.keep_alive ? "keep-alive" : "close", m_conf.pipeline, seconds);
+    }
+    printf("--requests: %lld completed (page %lld, image %lld, login %lld), %.1f req/s, %.2f MB/s received\n",
+           (long long)completed, (long long)m_completed[KIND_PAGE], (long long)m_completed[KIND_IMAGE],
+           (long long)m_completed[KIND_LOGIN], completed / seconds, m_bytes_received / seconds / (1024 * 1024));
+    printf("--status: 2xx %lld, 3xx %lld, 4xx %lld, 5xx %lld, other %lld\n",
+           (long long)m_status_class[2], (long long)m_status_class[3], (long long)m_status_class[4],
+           (long long)m_status_class[5], (long long)(m_status_class[0] + m_status_class[1]));
+    printf("--errors: connect %lld, io %lld, timeout %lld, bad response %lld, unsent %lld\n",
+           (long long)m_connect_errors, (long long)m_io_errors, (long long)m_timeouts,
+           (long long)m_bad_responses, (long long)m_unsent);
+    printf("--latency(us): min %lld, mean %.1f, p50 %lld, p90 %lld, p99 %lld, p99.9 %lld, max %lld\n",
+           (long long)m_latency.min(), m_latency.mean(), (long long)m_latency.value_at_percentile(50),
+           (long long)m_latency.value_at_percentile(90), (long long)m_latency.value_at_percentile(99),
+           (long long)m_latency.value_at_percentile(99.9), (long long)m_latency.max());
+}
@@ -0,0 +1,136 @@
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <netinet/in.h>
+
+#include "../metrics/hdr_histogram.h"
+
+/*
+    HTTP压测客户端
+
+    单线程epoll驱动所有连接，支持两种负载模型：
+        闭环(rate为0)：每个连接上始终保持pipeline个请求在途，收到一个响应立即补发一个，
+            测的是服务器能承受的最大吞吐，延迟从请求写入套接字算起；
+        开环(rate>0)：按固定速率在预定时刻发出请求，与服务器的快慢无关，
+            延迟从预定时刻算起，服务器变慢导致请求排队的时间也计入延迟(避免协调遗漏)。
+    不保持连接时每个连接只发一个请求，收到响应后重新建立连接。
+
+    请求按权重在三类中随机选择：GET页面、GET图片、POST /2 登录，
+    所有响应的延迟记录在同一个HDR直方图中，结束后输出吞吐和分位数
+*/
+class load_generator
+{
+public:
+    enum REQUEST_KIND
+    {
+        KIND_PAGE = 0,
+        KIND_IMAGE,
+        KIND_LOGIN,
+        KIND_COUNT
+    };
+    struct config
+    {
+        std::string host;
+        int port;
+        int connections;            // 并发连接数
+        int duration_s;             // 压测时长
+        bool keep_alive;            // 是否保持连接
+        int pipeline;               // 每个连接上在途的请求数，不保持连接时固定为1
+        int rate;                   // 开环模式下每秒发出的请求数，0为闭环
+        int weights[KIND_COUNT];    // 各类请求的权重
+        std::string page_path;      // GET页面请求的路径
+        std::string image_path;     // GET图片请求的路径
+        std::string user;           // 登录使用的用户名和密码
+        std::string password;
+        int timeout_ms;             // 请求超过该时间没有响应即视为超时并重建连接
+        unsigned int seed;          // 请求类型的随机种子
+    };
+
+    load_generator(const config &conf);
+    ~load_generator();
+    // 运行一次压测，地址无效或epoll创建失败返回false
+    bool run();
+    // 输出吞吐、状态码和延迟分位数
+    void report();
+
+private:
+    struct request
+    {
+        int kind;
+        int64_t start_us;   // 延迟的起点
+        int64_t sent_us;    // 实际发出的时刻，用于判断超时
+    };
+    struct connection
+    {
+        int fd;
+        bool connected;
+        int64_t connect_start_us;
+        // 连接失败后，到该时刻再重试
+        int64_t retry_at_us;
+        // 待发送的数据及已发送的字节数
+        std::string out;
+        size_t out_sent;
+        // 是否在等待可写事件
+        bool want_write;
+        // 已收到但还不是完整响应的数据
+        std::string in;
+        // 当前响应还未收到的响应体字节数，-1表示还在等待响应头；当前响应的状态码
+        int64_t body_left;
+        int status;
+        // 已发出(或已进入待发送数据)但未收到响应的请求，按发送顺序排列
+        std::deque<request> inflight;
+        // 不保持连接时，本连接已经发过请求
+        bool used;
+    };
+
+    static int64_t now_us();
+    bool open_connection(connection *c);
+    void close_connection(connection *c, bool count_lost);
+    // 在连接上发出一个请求，start_us为延迟的起点
+    void send_request(connection *c, int64_t start_us);
+    bool flush_output(connection *c);
+    bool read_input(connection *c, int64_t now);
+    // 从接收缓冲中依次取出完整的响应，返回false表示响应格式错误
+    bool parse_responses(connection *c, int64_t now);
+    // 为可以发送的连接补发请求
+    void dispatch(int64_t now);
+    void check_timeouts(int64_t now);
+    int pick_kind();
+
+private:
+    config m_conf;
+    sockaddr_in m_server_addr;
+    int m_epollfd;
+    std::vector<connection> m_conns;
+    // 开环模式下下一轮从哪个连接开始分发
+    int m_next_conn;
+    std::string m_requests[KIND_COUNT];
+    int m_weight_total;
+    unsigned int m_rand_state;
+    bool m_stopping;
+
+    // 开环模式下下一个请求的预定时刻，以及已到预定时刻但还没有连接可发的请求
+    int64_t m_next_due_us;
+    int64_t m_interval_ns;
+    int64_t m_due_count;
+    std::deque<int64_t> m_backlog;
+
+    // 统计量
+    hdr_histogram m_latency;
+    int64_t m_begin_us;
+    int64_t m_end_us;
+    int64_t m_sent[KIND_COUNT];
+    int64_t m_completed[KIND_COUNT];
+    int64_t m_status_class[6];
+    int64_t m_bytes_received;
+    int64_t m_connect_errors;
+    int64_t m_io_errors;
+    int64_t m_timeouts;
+    int64_t m_bad_responses;
+    int64_t m_unsent;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "micro_bench.h"
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+// 一次运行的次数上限，防止被测操作被编译器优化得过快时次数无限增长
+static const long long MAX_ITERATIONS = 1LL << 30;
+
+micro_bench::micro_bench(const options &opt, FILE *out) : m_opt(opt), m_out(out)
+{
+    if (m_opt.repetitions < 1)
+    {
+        m_opt.repetitions = 1;
+    }
+    if (m_opt.min_time_ms < 1)
+    {
+        m_opt.min_time_ms = 1;
+    }
+}
+
+long long micro_bench::now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+bool micro_bench::selected(const char *name) const
+{
+    return m_opt.filter.empty() || std::string(name).find(m_opt.filter) != std::string::npos;
+}
+
+void micro_bench::run(const char *name, bench_fn fn, void *arg)
+{
+    if (!selected(name))
+    {
+        return;
+    }
+    // 按上一次的耗时估算达到最短时间所需的次数，每轮最多放大10倍
+    long long min_ns = m_opt.min_time_ms * 1000000LL;
+    long long iterations = 1;
+    while (true)
+    {
+        long long elapsed = fn(iterations, arg);
+        if (elapsed >= min_ns || iterations >= MAX_ITERATIONS)
+        {
+            break;
+        }
+        long long next = elapsed > 0 ? (long long)(iterations * 1.2 * min_ns / elapsed) : iterations * 10;
+        if (next > iterations * 10)
+        {
+            next = iterations * 10;
+        }
+        iterations = next > iterations ? next : iterations + 1;
+        if (iterations > MAX_ITERATIONS)
+        {
+            iterations = MAX_ITERATIONS;
+        }
+    }
+
+    std::vector<double> ns_per_op;
+    for (int i = 0; i < m_opt.repetitions; i++)
+    {
+        ns_per_op.push_back((double)fn(iterations, arg) / iterations);
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    double median = ns_per_op[ns_per_op.size() / 2];
+    fprintf(m_out,
+            "{\"benchmark\":\"%s\",\"iterations\":%lld,\"repetitions\":%d,"
+            "\"ns_per_op_min\":%.2f,\"ns_per_op_median\":%.2f,\"ns_per_op_max\":%.2f,\"ops_per_sec\":%.0f}\n",
+            name, iterations, m_opt.repetitions, ns_per_op.front(), median, ns_per_op.back(),
+            median > 0 ? 1e9 / median : 0);
+    fflush(m_out);
+}
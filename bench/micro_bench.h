@@ -0,0 +1,41 @@
+#ifndef MICRO_BENCH_H
+#define MICRO_BENCH_H
+#include <stdio.h>
+#include <string>
+
+/*
+    微基准测试的计时框架
+
+    每个用例是一个函数：执行iterations次被测操作，自行计时并返回被测部分耗费的纳秒数，
+    这样用例可以把准备数据(如预先建好定时器链表)的时间排除在外。
+    框架先逐步加大次数，直到一次运行不短于min_time_ms，再以该次数重复运行repetitions次，
+    每个用例输出一行JSON，可以直接保存下来与其他提交的结果逐行对比：
+        {"benchmark":"timer/adjust/n=10000","iterations":...,"repetitions":5,
+         "ns_per_op_min":...,"ns_per_op_median":...,"ns_per_op_max":...,"ops_per_sec":...}
+*/
+class micro_bench
+{
+public:
+    typedef long long (*bench_fn)(long long iterations, void *arg);
+
+    struct options
+    {
+        int repetitions;      // 每个用例重复运行的次数，取中位数
+        int min_time_ms;      // 每次运行的最短时间
+        std::string filter;   // 只运行名字中包含该字符串的用例，为空则全部运行
+    };
+
+    micro_bench(const options &opt, FILE *out);
+    // 用例是否被过滤条件选中
+    bool selected(const char *name) const;
+    // 运行一个用例并输出结果
+    void run(const char *name, bench_fn fn, void *arg);
+    // 单调时钟，纳秒
+    static long long now_ns();
+
+private:
+    options m_opt;
+    FILE *m_out;
+};
+
+#endif
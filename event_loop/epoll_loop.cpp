@@ -0,0 +1,51 @@
+#include "epoll_loop.h"
+#include <sys/epoll.h>
+#include <fcntl.h>
+
+epoll_loop::epoll_loop(int epollfd) : m_epollfd(epollfd)
+{
+}
+
+bool epoll_loop::add_conn(int fd)
+{
+    epoll_event event;
+    event.data.fd = fd;
+    // 连接关闭、对端异常断开、出错总是会通知，读事件每次就绪只触发一次
+    event.events = EPOLLIN | EPOLLONESHOT | EPOLLET | EPOLLHUP | EPOLLRDHUP | EPOLLERR;
+    // ET模式下每次都要读到EAGAIN，描述符必须是非阻塞的
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void epoll_loop::remove_conn(int fd)
+{
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+}
+
+void epoll_loop::want_read(int fd)
+{
+    rearm(fd, EPOLLIN);
+}
+
+void epoll_loop::want_write(int fd)
+{
+    rearm(fd, EPOLLOUT);
+}
+
+bool epoll_loop::async_io()
+{
+    return false;
+}
+
+const char *epoll_loop::name()
+{
+    return "epoll";
+}
+
+void epoll_loop::rearm(int fd, unsigned int ev)
+{
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = ev | EPOLLONESHOT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event);
+}
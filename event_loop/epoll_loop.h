@@ -0,0 +1,30 @@
+#ifndef EPOLL_LOOP_H
+#define EPOLL_LOOP_H
+#include "event_loop.h"
+
+/*
+    基于epoll的事件循环
+
+    连接以EPOLLONESHOT|EPOLLET登记，每次就绪只触发一次，处理完后再通过want_read/want_write
+    重新注册，保证同一时刻只有一个线程在处理一个连接。
+    主循环自己调用epoll_wait并分发事件，这里只负责连接的登记和重新注册。
+*/
+class epoll_loop : public event_loop
+{
+public:
+    explicit epoll_loop(int epollfd);
+    bool add_conn(int fd);
+    void remove_conn(int fd);
+    void want_read(int fd);
+    void want_write(int fd);
+    bool async_io();
+    const char *name();
+
+private:
+    void rearm(int fd, unsigned int ev);
+
+private:
+    int m_epollfd;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+/*
+    事件循环的抽象
+
+    连接对象通过它登记、注销连接，以及在处理完一个阶段后声明下一步等待什么：
+    继续读请求(want_read)，或者响应已经生成好、等待发送(want_write)。
+    - epoll_loop：就绪通知模型，want_read/want_write就是修改EPOLLONESHOT的监听事件，
+      由主线程(或反应堆模式下的工作线程)收到就绪事件后自己recv/writev；
+    - uring_loop：完成通知模型，读写都作为io_uring请求提交给内核，主线程收到的是已经
+      读到的数据和已经发送的字节数。
+    want_read/want_write可以在工作线程中调用，add_conn/remove_conn只在主线程中调用。
+*/
+class event_loop
+{
+public:
+    virtual ~event_loop() {}
+    // 新连接加入事件循环，开始等待请求，fd需为非阻塞
+    virtual bool add_conn(int fd) = 0;
+    // 连接关闭前调用，之后不再产生该连接的事件
+    virtual void remove_conn(int fd) = 0;
+    // 继续等待读请求
+    virtual void want_read(int fd) = 0;
+    // 响应已经生成，等待发送
+    virtual void want_write(int fd) = 0;
+    // 读写是否由内核异步完成：为true时主线程不应自己读写套接字，而是调用want_write交给事件循环发送
+    virtual bool async_io() = 0;
+    virtual const char *name() = 0;
+};
+
+#endif
@@ -0,0 +1,637 @@
+#include "uring_loop.h"
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <exception>
+
+// 接收缓冲区环的组号，只有一组
+static const int BUF_GROUP = 0;
+
+uring_loop::uring_loop(int max_fd, unsigned entries, int buf_count, int buf_size, int send_timeout_ms)
+    : m_ring_fd(-1), m_max_fd(max_fd), m_sq_ptr(NULL), m_cq_ptr(NULL), m_sq_size(0),
+      m_cq_size(0), m_sqes(NULL), m_sqes_size(0), m_sq_head(NULL), m_sq_tail(NULL), m_sq_mask(NULL),
+      m_sq_array(NULL), m_sq_entries(0), m_sq_local_tail(0), m_sq_submitted(0), m_cq_head(NULL), m_cq_tail(NULL),
+      m_cq_mask(NULL), m_cqes(NULL), m_buf_ring(NULL), m_buf_ring_size(0), m_bufs(NULL), m_buf_count(buf_count),
+      m_buf_size(buf_size), m_buf_tail(0), m_last_bid(-1), m_last_aux(-1), m_listenfd(-1),
+      m_send_timeout(send_timeout_ms > 0), m_writable_pos(0), m_sleeping(false), m_woken(false), m_wake_fd(-1),
+      m_wake_buf(0)
+{
+    // 缓冲区环的长度必须是2的幂，且不超过32768
+    if (max_fd <= 0 || buf_size <= 0 || buf_count <= 0 || buf_count > 32768 || (buf_count & (buf_count - 1)) != 0)
+    {
+        throw std::exception();
+    }
+    memset(&m_tick_ts, 0, sizeof(m_tick_ts));
+    memset(&m_send_ts, 0, sizeof(m_send_ts));
+    m_send_ts.tv_sec = send_timeout_ms / 1000;
+    m_send_ts.tv_nsec = (send_timeout_ms % 1000) * 1000000LL;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 只有主线程提交请求，完成事件推迟到主线程进入io_uring_enter时再处理，减少对主线程的打断
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    m_ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (m_ring_fd < 0 && errno == EINVAL)
+    {
+        // 6.1之前的内核不支持这两个标志
+        memset(&p, 0, sizeof(p));
+        m_ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if (m_ring_fd < 0)
+    {
+        throw std::exception();
+    }
+
+    // 映射提交队列、完成队列和提交队列项
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+    {
+        m_sq_size = m_cq_size = m_sq_size > m_cq_size ? m_sq_size : m_cq_size;
+    }
+    m_sq_ptr = mmap(NULL, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+    {
+        m_sq_ptr = NULL;
+        release();
+        throw std::exception();
+    }
+    m_cq_ptr = single_mmap ? m_sq_ptr
+                           : mmap(NULL, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                                  IORING_OFF_CQ_RING);
+    m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        m_cq_ptr = m_cq_ptr == MAP_FAILED ? NULL : m_cq_ptr;
+        m_sqes = sqes == MAP_FAILED ? NULL : (struct io_uring_sqe *)sqes;
+        release();
+        throw std::exception();
+    }
+    m_sqes = (struct io_uring_sqe *)sqes;
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_entries = p.sq_entries;
+    m_sq_local_tail = m_sq_submitted = *m_sq_tail;
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // 注册接收缓冲区环(5.19+)，失败说明内核太旧，由调用者退回epoll
+    m_buf_ring_size = m_buf_count * sizeof(struct io_uring_buf);
+    m_buf_ring = mmap(NULL, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    m_bufs = (char *)malloc((size_t)m_buf_count * m_buf_size);
+    if (m_buf_ring == MAP_FAILED || m_bufs == NULL)
+    {
+        m_buf_ring = m_buf_ring == MAP_FAILED ? NULL : m_buf_ring;
+        release();
+        throw std::exception();
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)m_buf_ring;
+    reg.ring_entries = m_buf_count;
+    reg.bgid = BUF_GROUP;
+    m_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 || m_wake_fd < 0)
+    {
+        release();
+        throw std::exception();
+    }
+    for (int i = 0; i < m_buf_count; i++)
+    {
+        recycle_buffer(i);
+    }
+    m_conns.resize(m_max_fd);
+    memset(&m_conns[0], 0, m_max_fd * sizeof(conn_state));
+    submit_wake();
+}
+
+uring_loop::~uring_loop()
+{
+    release();
+}
+
+void uring_loop::release()
+{
+    // 关闭io_uring后内核会取消所有未完成的请求
+    if (m_ring_fd >= 0)
+    {
+        close(m_ring_fd);
+        m_ring_fd = -1;
+    }
+    if (m_sqes)
+    {
+        munmap(m_sqes, m_sqes_size);
+        m_sqes = NULL;
+    }
+    if (m_cq_ptr && m_cq_ptr != m_sq_ptr)
+    {
+        munmap(m_cq_ptr, m_cq_size);
+    }
+    m_cq_ptr = NULL;
+    if (m_sq_ptr)
+    {
+        munmap(m_sq_ptr, m_sq_size);
+        m_sq_ptr = NULL;
+    }
+    if (m_buf_ring)
+    {
+        munmap(m_buf_ring, m_buf_ring_size);
+        m_buf_ring = NULL;
+    }
+    free(m_bufs);
+    m_bufs = NULL;
+    if (m_wake_fd >= 0)
+    {
+        close(m_wake_fd);
+        m_wake_fd = -1;
+    }
+    for (size_t i = 0; i < m_aux.size(); i++)
+    {
+        delete m_aux[i];
+    }
+    m_aux.clear();
+}
+
+unsigned long long uring_loop::make_data(int op, unsigned gen, int fd)
+{
+    return ((unsigned long long)op << 56) | ((unsigned long long)(gen & 0xffffff) << 32) | (unsigned)fd;
+}
+
+bool uring_loop::add_conn(int fd)
+{
+    if (fd < 0 || fd >= m_max_fd)
+    {
+        return false;
+    }
+    conn_state &c = m_conns[fd];
+    c.open = true;
+    c.recv_pending = false;
+    c.send_pending = 0;
+    submit_recv(fd);
+    return true;
+}
+
+void uring_loop::remove_conn(int fd)
+{
+    if (fd < 0 || fd >= m_max_fd || !m_conns[fd].open)
+    {
+        return;
+    }
+    // 递增代数后，这个连接之前提交的请求再完成时都会被丢弃
+    conn_state &c = m_conns[fd];
+    unsigned old_gen = c.gen;
+    c.gen = (c.gen + 1) & 0xffffff;
+    c.open = false;
+    // 未完成的请求持有socket的引用，要取消掉socket才会真正关闭
+    if (c.recv_pending)
+    {
+        submit_cancel(make_data(OP_RECV, old_gen, fd));
+    }
+    if (c.send_pending > 0)
+    {
+        submit_cancel(make_data(OP_SEND, old_gen, fd));
+    }
+    c.recv_pending = false;
+    c.send_pending = 0;
+}
+
+void uring_loop::want_read(int fd)
+{
+    enqueue(fd, false);
+}
+
+void uring_loop::want_write(int fd)
+{
+    enqueue(fd, true);
+}
+
+void uring_loop::enqueue(int fd, bool write)
+{
+    request r;
+    r.fd = fd;
+    r.write = write;
+    m_lock.lock();
+    m_requests.push_back(r);
+    bool wake = m_sleeping && !m_woken;
+    m_woken = m_woken || wake;
+    m_lock.unlock();
+    if (wake)
+    {
+        // eventfd的计数不会溢出，写失败时主线程仍会在下一个完成事件后处理请求，不必处理返回值
+        unsigned long long one = 1;
+        ssize_t ret = ::write(m_wake_fd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+bool uring_loop::async_io()
+{
+    return true;
+}
+
+const char *uring_loop::name()
+{
+    return "io_uring";
+}
+
+void uring_loop::accept_multishot(int listenfd)
+{
+    m_listenfd = listenfd;
+    submit_accept();
+}
+
+void uring_loop::watch(int fd, int tag)
+{
+    aux_watch *w = new aux_watch;
+    w->fd = fd;
+    w->tag = tag;
+    m_aux.push_back(w);
+    submit_aux(m_aux.size() - 1);
+}
+
+void uring_loop::set_tick(int seconds)
+{
+    m_tick_ts.tv_sec = seconds;
+    m_tick_ts.tv_nsec = 0;
+    submit_tick();
+}
+
+void uring_loop::send(int fd, const struct iovec *iov, int count)
+{
+    if (fd < 0 || fd >= m_max_fd || !m_conns[fd].open || count <= 0 || count > SEND_IOV_MAX)
+    {
+        return;
+    }
+    conn_state &c = m_conns[fd];
+    memcpy(c.iov, iov, count * sizeof(struct iovec));
+    memset(&c.msg, 0, sizeof(c.msg));
+    c.msg.msg_iov = c.iov;
+    c.msg.msg_iovlen = count;
+    c.send_pending = m_send_timeout ? 2 : 1;
+    c.sent = 0;
+    c.send_error = 0;
+    // 发送和它的超时必须在同一次提交中，否则链接关系会在提交的边界处断开
+    reserve(c.send_pending);
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)&c.msg;
+    sqe->len = 1;
+    // MSG_WAITALL：发不完时内核自己等待可写后继续发，不用回到主线程
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->flags = m_send_timeout ? IOSQE_IO_LINK : 0;
+    sqe->user_data = make_data(OP_SEND, c.gen, fd);
+    if (m_send_timeout)
+    {
+        sqe = get_sqe();
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (unsigned long)&m_send_ts;
+        sqe->len = 1;
+        sqe->user_data = make_data(OP_SEND_TIMEOUT, c.gen, fd);
+    }
+}
+
+bool uring_loop::wait(int timeout_ms)
+{
+    std::vector<request> requests;
+    m_lock.lock();
+    requests.swap(m_requests);
+    m_lock.unlock();
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        int fd = requests[i].fd;
+        // 请求发出后连接已经关闭的，忽略
+        if (fd < 0 || fd >= m_max_fd || !m_conns[fd].open)
+        {
+            continue;
+        }
+        if (requests[i].write)
+        {
+            m_writable.push_back(fd);
+        }
+        else if (!m_conns[fd].recv_pending)
+        {
+            submit_recv(fd);
+        }
+    }
+
+    // 手上没有待交付的事件时才睡眠，睡眠前再确认一次没有新的请求
+    bool idle = m_writable_pos >= m_writable.size() &&
+                *m_cq_head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    if (idle)
+    {
+        m_lock.lock();
+        idle = m_requests.empty();
+        m_sleeping = idle;
+        m_lock.unlock();
+    }
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    int ret = enter(idle ? 1 : 0, idle && timeout_ms >= 0 ? &ts : NULL);
+    int saved_errno = errno;
+    if (idle)
+    {
+        m_lock.lock();
+        m_sleeping = false;
+        m_lock.unlock();
+    }
+    // 被信号打断、完成队列暂时满了、等待超时，都在处理完已有的事件后重试
+    return ret >= 0 || saved_errno == EINTR || saved_errno == EBUSY || saved_errno == EAGAIN ||
+           saved_errno == ETIME;
+}
+
+bool uring_loop::next(event &ev)
+{
+    // 上一个事件交付的缓冲区此时已经用完
+    if (m_last_bid >= 0)
+    {
+        recycle_buffer(m_last_bid);
+        m_last_bid = -1;
+    }
+    if (m_last_aux >= 0)
+    {
+        submit_aux(m_last_aux);
+        m_last_aux = -1;
+    }
+    if (m_writable_pos < m_writable.size())
+    {
+        ev.type = EV_WRITABLE;
+        ev.fd = m_writable[m_writable_pos++];
+        ev.res = 0;
+        ev.data = NULL;
+        return true;
+    }
+    m_writable.clear();
+    m_writable_pos = 0;
+
+    while (true)
+    {
+        unsigned head = *m_cq_head;
+        if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+        struct io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+        unsigned long long data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+        int op = (int)(data >> 56);
+        unsigned gen = (unsigned)(data >> 32) & 0xffffff;
+        int fd = (int)(data & 0xffffffff);
+        bool stale = (op == OP_RECV || op == OP_SEND || op == OP_SEND_TIMEOUT) &&
+                     (fd < 0 || fd >= m_max_fd || m_conns[fd].gen != gen || !m_conns[fd].open);
+        switch (op)
+        {
+        case OP_ACCEPT:
+            // 多次触发的accept因为出错等原因结束时重新提交
+            if (!(flags & IORING_CQE_F_MORE))
+            {
+                submit_accept();
+            }
+            if (res < 0)
+            {
+                continue;
+            }
+            ev.type = EV_ACCEPT;
+            ev.fd = res;
+            ev.res = res;
+            ev.data = NULL;
+            return true;
+        case OP_RECV:
+        {
+            int bid = (flags & IORING_CQE_F_BUFFER) ? (int)(flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+            if (stale)
+            {
+                if (bid >= 0)
+                {
+                    recycle_buffer(bid);
+                }
+                continue;
+            }
+            m_conns[fd].recv_pending = false;
+            if (res == -ENOBUFS)
+            {
+                // 缓冲区暂时用完了，等已交付的缓冲区归还后再收
+                submit_recv(fd);
+                continue;
+            }
+            m_last_bid = bid;
+            ev.type = EV_READ;
+            ev.fd = fd;
+            ev.res = res > 0 && bid < 0 ? -EIO : res;
+            ev.data = bid >= 0 ? m_bufs + (size_t)bid * m_buf_size : NULL;
+            return true;
+        }
+        case OP_SEND:
+        case OP_SEND_TIMEOUT:
+        {
+            if (stale)
+            {
+                continue;
+            }
+            conn_state &c = m_conns[fd];
+            if (op == OP_SEND)
+            {
+                if (res < 0 && c.send_error == 0)
+                {
+                    c.send_error = res;
+                }
+                c.sent += res > 0 ? res : 0;
+            }
+            else if (res == -ETIME)
+            {
+                // 超时先于发送完成，没发完的sendmsg会以-ECANCELED结束
+                c.send_error = -ETIME;
+            }
+            if (--c.send_pending > 0)
+            {
+                continue;
+            }
+            ev.type = EV_SENT;
+            ev.fd = fd;
+            ev.res = c.send_error != 0 ? c.send_error : c.sent;
+            ev.data = NULL;
+            return true;
+        }
+        case OP_TICK:
+            submit_tick();
+            ev.type = EV_TICK;
+            ev.fd = -1;
+            ev.res = 0;
+            ev.data = NULL;
+            return true;
+        case OP_AUX:
+            if (fd < 0 || fd >= (int)m_aux.size())
+            {
+                continue;
+            }
+            if (res <= 0)
+            {
+                // 读到文件尾说明对端已关闭，不再读；被打断时重新提交
+                if (res == -EINTR || res == -EAGAIN)
+                {
+                    submit_aux(fd);
+                }
+                continue;
+            }
+            m_last_aux = fd;
+            ev.type = EV_AUX;
+            ev.fd = m_aux[fd]->tag;
+            ev.res = res;
+            ev.data = m_aux[fd]->buf;
+            return true;
+        case OP_WAKE:
+            m_lock.lock();
+            m_woken = false;
+            m_lock.unlock();
+            submit_wake();
+            continue;
+        default:
+            continue;
+        }
+    }
+}
+
+void uring_loop::reserve(unsigned n)
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sq_local_tail - head + n > m_sq_entries)
+    {
+        enter(0);
+    }
+}
+
+struct io_uring_sqe *uring_loop::get_sqe()
+{
+    reserve(1);
+    unsigned idx = m_sq_local_tail & *m_sq_mask;
+    struct io_uring_sqe *sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[idx] = idx;
+    m_sq_local_tail++;
+    return sqe;
+}
+
+int uring_loop::enter(unsigned min_complete, struct __kernel_timespec *ts)
+{
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = m_sq_local_tail - m_sq_submitted;
+    // 总是带上GETEVENTS：DEFER_TASKRUN模式下完成事件只在这时才放进完成队列
+    int ret;
+    if (ts)
+    {
+        // 等待超时通过扩展参数传入，不必为此提交一个超时请求
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (unsigned long)ts;
+        ret = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+    else
+    {
+        ret = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+    if (ret > 0)
+    {
+        m_sq_submitted += ret;
+    }
+    return ret;
+}
+
+void uring_loop::submit_recv(int fd)
+{
+    conn_state &c = m_conns[fd];
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = m_buf_size;
+    // 不指定地址，由内核从缓冲区环中取一块，数据到达时才占用缓冲区
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = make_data(OP_RECV, c.gen, fd);
+    c.recv_pending = true;
+}
+
+void uring_loop::submit_accept()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = make_data(OP_ACCEPT, 0, m_listenfd);
+}
+
+void uring_loop::submit_aux(int index)
+{
+    aux_watch *w = m_aux[index];
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = w->fd;
+    sqe->addr = (unsigned long)w->buf;
+    sqe->len = sizeof(w->buf);
+    sqe->off = (unsigned long long)-1;
+    sqe->user_data = make_data(OP_AUX, 0, index);
+}
+
+void uring_loop::submit_wake()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wake_fd;
+    sqe->addr = (unsigned long)&m_wake_buf;
+    sqe->len = sizeof(m_wake_buf);
+    sqe->off = (unsigned long long)-1;
+    sqe->user_data = make_data(OP_WAKE, 0, 0);
+}
+
+void uring_loop::submit_tick()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&m_tick_ts;
+    sqe->len = 1;
+    sqe->user_data = make_data(OP_TICK, 0, 0);
+}
+
+void uring_loop::submit_cancel(unsigned long long data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = make_data(OP_CANCEL, 0, 0);
+}
+
+void uring_loop::recycle_buffer(int bid)
+{
+    // 环的尾指针与第0项的保留字段重叠，只写addr/len/bid不会碰到它
+    struct io_uring_buf *bufs = (struct io_uring_buf *)m_buf_ring;
+    struct io_uring_buf *b = &bufs[m_buf_tail & (m_buf_count - 1)];
+    b->addr = (unsigned long)(m_bufs + (size_t)bid * m_buf_size);
+    b->len = m_buf_size;
+    b->bid = bid;
+    m_buf_tail++;
+    __atomic_store_n(&((struct io_uring_buf_ring *)m_buf_ring)->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,191 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <linux/io_uring.h>
+#include <vector>
+#include "event_loop.h"
+#include "../thread_pool/locker.h"
+
+/*
+    基于io_uring的事件循环，直接使用io_uring_setup/io_uring_enter/io_uring_register系统调用，
+    不依赖liburing。需要5.19以上的内核(多次触发的accept、注册的缓冲区环)，不满足时构造函数抛出异常，
+    由调用者退回epoll。
+
+    与epoll的就绪通知不同，这里提交的是读写请求本身，主线程收到的是完成事件：
+    - 监听socket上提交一次多次触发的accept，之后每个新连接产生一个EV_ACCEPT；
+    - 每个连接等待读时提交一个recv，数据由内核放进事先注册的缓冲区环中的一块(provided buffer)，
+      EV_READ交付这块数据，主线程拷贝进连接的读缓存后缓冲区随即归还；
+    - 发送时把响应头和正文作为一个sendmsg提交(与writev一样是一次发送，分成两个send会让
+      小响应的第二段等待Nagle和延迟确认)，MSG_WAITALL让内核发完为止，再链接一个超时
+      (IORING_OP_LINK_TIMEOUT)，超时未发完则取消；完成后产生一个EV_SENT。
+      正文本来就在内存中(缓存或mmap)，sendmsg就相当于sendfile；
+    - 定时心跳用IORING_OP_TIMEOUT，信号管道、关闭管道这类辅助描述符用一直挂着的read。
+    一轮io_uring_enter同时完成提交和收割，负载高时每个请求几乎不再需要单独的系统调用。
+
+    提交队列只由创建它的主线程操作：工作线程调用want_read/want_write时只把请求放进加锁的
+    队列，主线程正在等待时再写一次eventfd把它唤醒；主线程在下一轮wait()中统一提交。
+    连接关闭时取消它未完成的请求，并递增该fd的代数，之后到达的旧完成事件都会被丢弃，
+    不会被误认为是复用了这个fd的新连接的事件。
+*/
+class uring_loop : public event_loop
+{
+public:
+    enum EVENT_TYPE
+    {
+        EV_ACCEPT = 0, // 新连接，fd为新连接的描述符
+        EV_READ,       // 连接读到数据，res为字节数，0为对端关闭，小于0为错误
+        EV_WRITABLE,   // 连接的响应已经生成(want_write)，等待主线程提交发送
+        EV_SENT,       // 一次发送全部完成，res为发送的字节数，小于0为错误或超时
+        EV_TICK,       // 定时心跳
+        EV_AUX         // 辅助描述符读到数据，fd为watch时指定的tag
+    };
+    static const int SEND_IOV_MAX = 2;
+    struct event
+    {
+        int type;
+        int fd;
+        int res;
+        // EV_READ和EV_AUX的数据，在下一次调用next()之前有效
+        const char *data;
+    };
+
+    /*
+        max_fd：连接描述符的上限；entries：提交队列长度；buf_count/buf_size：接收缓冲区的个数
+        (2的幂)和大小；send_timeout_ms：一次发送的超时，0为不限制
+    */
+    uring_loop(int max_fd, unsigned entries, int buf_count, int buf_size, int send_timeout_ms);
+    ~uring_loop();
+
+    bool add_conn(int fd);
+    void remove_conn(int fd);
+    void want_read(int fd);
+    void want_write(int fd);
+    bool async_io();
+    const char *name();
+
+    // 在监听socket上提交多次触发的accept
+    void accept_multishot(int listenfd);
+    // 持续读一个辅助描述符，读到的数据以EV_AUX交付，tag区分来源
+    void watch(int fd, int tag);
+    // 每隔seconds秒产生一次EV_TICK
+    void set_tick(int seconds);
+    // 发送iov中的数据(最多SEND_IOV_MAX块)，全部完成后产生一个EV_SENT，只在主线程中调用
+    void send(int fd, const struct iovec *iov, int count);
+    // 提交积压的请求，没有待处理的事件时等待至少一个完成事件，timeout_ms>=0时最多等这么久；出错返回false
+    bool wait(int timeout_ms = -1);
+    // 取出下一个事件，没有时返回false
+    bool next(event &ev);
+
+private:
+    // 一个请求的user_data：高8位为操作类型，中间24位为连接的代数，低32位为fd或tag
+    enum OP
+    {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND,
+        OP_SEND_TIMEOUT,
+        OP_TICK,
+        OP_AUX,
+        OP_WAKE,
+        OP_CANCEL
+    };
+    static unsigned long long make_data(int op, unsigned gen, int fd);
+
+    struct conn_state
+    {
+        unsigned gen;
+        bool open;
+        bool recv_pending;
+        // 发送链中还没完成的请求数，已发送的字节数，第一个错误
+        int send_pending;
+        int sent;
+        int send_error;
+        // sendmsg完成前内核一直引用这两个结构
+        struct msghdr msg;
+        struct iovec iov[SEND_IOV_MAX];
+    };
+    struct aux_watch
+    {
+        int fd;
+        int tag;
+        char buf[256];
+    };
+    // 来自任意线程的want_read/want_write
+    struct request
+    {
+        int fd;
+        bool write;
+    };
+
+    // 记下一个来自任意线程的want_read/want_write，主线程正在等待时把它唤醒
+    void enqueue(int fd, bool write);
+    // 保证提交队列中至少有n个空位，不够时先提交一次
+    void reserve(unsigned n);
+    struct io_uring_sqe *get_sqe();
+    // 把已填好的请求交给内核，min_complete>0时等待完成，ts不为NULL时最多等待ts
+    int enter(unsigned min_complete, struct __kernel_timespec *ts = NULL);
+    void submit_recv(int fd);
+    void submit_accept();
+    void submit_aux(int index);
+    void submit_wake();
+    void submit_tick();
+    void submit_cancel(unsigned long long data);
+    // 把一块接收缓冲区还给内核
+    void recycle_buffer(int bid);
+    // 释放io_uring和缓冲区，构造失败时也会调用
+    void release();
+
+private:
+    int m_ring_fd;
+    int m_max_fd;
+    // 提交队列和完成队列
+    void *m_sq_ptr;
+    void *m_cq_ptr;
+    size_t m_sq_size;
+    size_t m_cq_size;
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned m_sq_entries;
+    unsigned m_sq_local_tail;
+    unsigned m_sq_submitted;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+    // 接收缓冲区环
+    void *m_buf_ring;
+    size_t m_buf_ring_size;
+    char *m_bufs;
+    int m_buf_count;
+    int m_buf_size;
+    unsigned short m_buf_tail;
+    // 上一个交付出去的接收缓冲区和辅助读，下一次next()时归还或重新提交
+    int m_last_bid;
+    int m_last_aux;
+
+    int m_listenfd;
+    struct __kernel_timespec m_tick_ts;
+    struct __kernel_timespec m_send_ts;
+    bool m_send_timeout;
+    std::vector<conn_state> m_conns;
+    std::vector<aux_watch *> m_aux;
+    // 待交付的EV_WRITABLE
+    std::vector<int> m_writable;
+    size_t m_writable_pos;
+
+    // 跨线程的请求队列，以及主线程等待时用来唤醒它的eventfd
+    locker m_lock;
+    std::vector<request> m_requests;
+    bool m_sleeping;
+    bool m_woken;
+    int m_wake_fd;
+    unsigned long long m_wake_buf;
+};
+
+#endif
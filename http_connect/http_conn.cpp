@@ -1,4 +1,5 @@
 #include "http_conn.h"
+#include "../thread_pool/threadPool.hpp"
 
 // 定义HTTP响应的一些状态信息
 const char *ok_200_title = "OK";
@@ -86,17 +87,16 @@ bool get_registration_map(
     if (mysql_query(mysql, "SELECT username,password FROM user"))
     {
         LOG_ERROR("mysql:SELECT error:%s\n", mysql_error(mysql));
+        return false;
     }
-    MYSQL_RES *res_mysql = mysql_store_result(mysql);
+    // 全表扫描使用流式结果集，逐行拉取，不在客户端缓存整张表
+    sql_result res_mysql = sql_result::use(mysql);
     MYSQL_ROW row;
-    string tmp_username;
-    string tmp_password;
-    while (row = mysql_fetch_row(res_mysql))
+    while ((row = res_mysql.fetch_row()))
     {
-        tmp_username = row[0];
-        tmp_password = row[1];
-        regis_map[tmp_username] = tmp_password;
+        regis_map[row[0]] = row[1];
     }
+    return true;
 }
 
 // 定义类的静态成员变量
@@ -104,39 +104,162 @@ bool get_registration_map(
 值得注意的是，如果将静态成员变量的值在头文件的类外进行定义，则会触发多重定义
 这和之前写简单程序时，随手将静态成员变量的定义写在头文件内的习惯相悖
  */
-int http_conn::m_epollfd = -1;
-int http_conn::m_user_count = 0;
+event_loop *http_conn::m_loop = NULL;
+std::atomic<int> http_conn::m_user_count(0);
+session_store *http_conn::m_session_store = NULL;
+register_batcher *http_conn::m_register_batcher = NULL;
+overload_controller *http_conn::m_overload = NULL;
+static_cache *http_conn::m_static_cache = NULL;
+bool http_conn::m_reactor = false;
+int http_conn::m_close_fd = -1;
+threadPool<http_conn> *http_conn::m_db_executor = NULL;
+
+// 会话Cookie的名字
+const char *session_cookie_name = "sid";
+
+// 与METHOD枚举对应的方法名，用于访问日志
+static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+
+static long long monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 
 void http_conn::process()
 {
-    // 解析HTTP请求
-    HTTP_CODE parseReturn = parseRequest();
-    LOG_DEBUG("--解析结果：%d [0:NOREQUEST,1:GETREQUEST]", parseReturn);
-    if (parseReturn == NO_REQUEST)
+    long long dequeue_us = monotonic_us();
+    // 排队从读完(主线程已解析过则从解析完)开始算，解析从取出任务开始算
+    long long queue_start_us = m_read_done_us;
+    long long parse_start_us = dequeue_us;
+    if (m_reactor && !m_dispatched)
     {
-        /*
-        当前连接传来的数据还是不够完整，将连接socket在epoll中的状态修改回读就绪
-        并结束当前线程的执行，之后会在主线程的下一轮epoll检测中，再次检测到该连
-        接，由于采用proactor模式，则主线程会再次将执行该对象的读函数，从而将可能的
-        新内容继续搬到当前连接的读缓存内，使其有可能变为一个完整的请求报文。
-        */
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+        // 反应堆模式：先完成主线程分发过来的读写事件
+        if (m_io_write)
+        {
+            m_io_write = false;
+            if (!write())
+            {
+                close_later();
+            }
+            return;
+        }
+        // 排队发生在读之前，从主线程分发事件时算起
+        queue_start_us = m_event_us;
+        if (!read())
+        {
+            close_later();
+            return;
+        }
+        parse_start_us = m_read_done_us;
+    }
+    HTTP_CODE parseReturn = GET_REQUEST;
+    if (m_dispatched)
+    {
+        // 在数据库执行器中继续执行，请求已经在第一段解析完
+        m_dispatched = false;
+    }
+    else
+    {
+        if (m_parsed_inline)
+        {
+            // 主线程已解析完，读和解析阶段也已在主线程记录
+            m_parsed_inline = false;
+            queue_start_us = m_parsed_us;
+        }
+        else
+        {
+            // 解析HTTP请求
+            parseReturn = parseRequest();
+            LOG_DEBUG("--解析结果：%d [0:NOREQUEST,1:GETREQUEST]", parseReturn);
+            m_parsed_us = monotonic_us();
+            TRACE_PROBE2(parse_done, m_sockfd, (int)parseReturn);
+            if (parseReturn == NO_REQUEST)
+            {
+                /*
+                当前连接传来的数据还是不够完整，将连接socket在epoll中的状态修改回读就绪
+                并结束当前线程的执行，之后会在主线程的下一轮epoll检测中，再次检测到该连
+                接，由于采用proactor模式，则主线程会再次将执行该对象的读函数，从而将可能的
+                新内容继续搬到当前连接的读缓存内，使其有可能变为一个完整的请求报文。
+                */
+                m_loop->want_read(m_sockfd);
+                return;
+            }
+            // 请求不完整时不计入，等完整请求到达后读阶段包含了等待后续数据的时间
+            if (m_request_start_us > 0 && m_read_done_us > 0)
+            {
+                metrics::record_phase(metrics::PHASE_READ, m_read_done_us - m_request_start_us);
+            }
+            metrics::record_phase(metrics::PHASE_PARSE, m_parsed_us - parse_start_us);
+        }
+        if (m_request_start_us > 0 && queue_start_us > 0)
+        {
+            metrics::record_phase(metrics::PHASE_QUEUE, dequeue_us - queue_start_us);
+            if (m_overload)
+            {
+                m_overload->observe_queue_delay(dequeue_us - queue_start_us);
+            }
+        }
+        // 需要访问数据库的请求转交给数据库执行器，不占用处理静态请求的线程
+        if (parseReturn == GET_REQUEST && m_db_executor && is_db_request())
+        {
+            m_dispatched = true;
+            if (m_db_executor->append(this))
+            {
+                return;
+            }
+            m_dispatched = false;
+            metrics::add(metrics::SHED_POOL_FULL);
+            prepare_unavailable();
+            m_loop->want_write(m_sockfd);
+            return;
+        }
+    }
+    // 请求完整，执行请求：定位目标文件，POST登录/注册还要访问数据库
+    if (parseReturn == GET_REQUEST)
+    {
+        parseReturn = doRequest();
     }
     //  生成响应
     //  传入的parseReturn可能是除了noreq之外的所有状态包括bad和一些成功的格式
     bool writeReturn = processResponse(parseReturn);
+    m_response_ready_us = monotonic_us();
+    TRACE_PROBE2(do_request_done, m_sockfd, (int)parseReturn);
+    // 转交给数据库执行器的请求，执行阶段包含在数据库执行器中排队的时间
+    metrics::record_phase(metrics::PHASE_HANDLE, m_response_ready_us - m_parsed_us);
     if (!writeReturn)
     {
         // 如果写失败了，则关闭连接
-        close_conn();
+        close_later();
+        return;
     }
     // 写入到缓存，将连接作为任务丢入到epoll连接队列中，声明其写就绪
 
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    m_loop->want_write(m_sockfd);
     // 结束线程
 }
 
+bool http_conn::is_db_request()
+{
+    // POST /2 登录、POST /3 注册需要查询或写入数据库
+    if (m_method != POST)
+    {
+        return false;
+    }
+    const char *op = strrchr(m_url, '/');
+    if (op == NULL)
+    {
+        return false;
+    }
+    if (op[1] == '2')
+    {
+        // 带有效会话的登录请求在doRequest()中直接进入欢迎页，不访问数据库，留在静态线程池
+        return !check_session();
+    }
+    return op[1] == '3';
+}
+
 void http_conn::init(int sockfd, const struct sockaddr_in &addr)
 {
     m_sockfd = sockfd;
@@ -165,9 +288,13 @@ void http_conn::init(int sockfd, const struct sockaddr_in &addr)
     即使不采用ONESHOT模式，该项目也能正常运行，但如果采用的是REACTOR事件模式，则
     由辅助线程来自行进行数据的读写，则十分有必要添加ONESHOT监听事件模式。
     */
-    addfd(m_epollfd, m_sockfd, EPOLLIN | EPOLLONESHOT | EPOLLET);
-    m_user_count++;
+    m_close_requested.store(false, std::memory_order_relaxed);
+    m_io_write = false;
+    m_event_us = 0;
+    m_user_count.fetch_add(1, std::memory_order_relaxed);
     init();
+    // 最后才登记到事件循环，反应堆模式下事件一到就可能由工作线程处理
+    m_loop->add_conn(m_sockfd);
 }
 
 void http_conn::init(int sockfd, const sockaddr_in &addr, util_timer *timer)
@@ -188,20 +315,20 @@ void http_conn::close_conn()
     // 如果m_timer有绑定定时器，则断开绑定
     if (m_sockfd != -1)
     {
-
-        removefd(m_epollfd, m_sockfd);
+        TRACE_PROBE1(close, m_sockfd);
+        m_loop->remove_conn(m_sockfd);
         close(m_sockfd);
         m_sockfd = -1;
         // 绑定的定时器会被timerList销毁，我们只需要提前断开绑定即可
         m_timer = NULL;
-        m_user_count--;
+        m_user_count.fetch_sub(1, std::memory_order_relaxed);
+        metrics::add(metrics::CONN_CLOSED);
         // 绑定的数据库连接池断开
         m_db_connect_pool = NULL;
-        printf("--http_conn class close connect,and pointer to timer,db_connect_pool in http_conn set to NULL.\n");
-        LOG_INFO("--http_conn class close connect,and pointer to timer,db_connect_pool in http_conn set to NULL.");
-        LOG_INFO("--delete 1 http_conn,now %d http-connect is linking!", http_conn::m_user_count);
-        // 每次结束一个连接，则将日志文件指针维护的缓存强推到日志文件里，刷新缓存
-        log::get_instance()->file_flush();
+        CONSOLE_TRACE("--http_conn class close connect,and pointer to timer,db_connect_pool in http_conn set to NULL.\n");
+        LOG_DEBUG("--http_conn class close connect,and pointer to timer,db_connect_pool in http_conn set to NULL.");
+        LOG_DEBUG("--delete 1 http_conn,now %d http-connect is linking!", http_conn::m_user_count.load());
+        // 不再在每次关闭连接时刷日志，由日志类的刷盘策略按时间/字节数统一刷盘
     }
 }
 
@@ -212,8 +339,15 @@ bool http_conn::read()
     {
         return false;
     }
+    if (m_read_idx == 0)
+    {
+        // 新请求的第一批数据，从这里开始计算访问日志中的耗时
+        m_request_start_us = monotonic_us();
+    }
     // 读取到的字节
     int bytesRead = 0;
+    // 本次一共读到的字节，最后一次性计入指标
+    int bytesTotal = 0;
     while (1)
     {
         /*
@@ -236,6 +370,7 @@ bool http_conn::read()
              */
             if (errno == EAGAIN || errno == EWOULDBLOCK)
                 break;
+            metrics::add(metrics::BYTES_IN, bytesTotal);
             return false;
         }
         else if (bytesRead == 0)
@@ -244,21 +379,53 @@ bool http_conn::read()
             recv返回结果为0，代表客户端已经关闭连接，则本次连接的读取任务视作被
             中断，应该直接返回读取失败
             */
+            metrics::add(metrics::BYTES_IN, bytesTotal);
             return false;
         }
         else
         {
             // recv成功
             m_read_idx += bytesRead;
+            bytesTotal += bytesRead;
         }
     }
-    char ip[16] = {0};
-    inet_ntop(AF_INET, &m_address.sin_addr.s_addr, ip, INET_ADDRSTRLEN);
-    std::cout << "--接收到请求报文...\n";
-    LOG_INFO("--从%s:%d接收到请求报文如下:\n%s", ip, m_address.sin_port, m_read_buf);
+    on_read_done(bytesTotal);
     return true;
 }
 
+bool http_conn::feed(const char *data, int len)
+{
+    // 与read()一致：读缓存被填满说明请求过大，关闭连接
+    if (len >= READ_BUFFER_SIZE - m_read_idx)
+    {
+        metrics::add(metrics::BYTES_IN, len);
+        return false;
+    }
+    if (m_read_idx == 0)
+    {
+        m_request_start_us = monotonic_us();
+    }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    on_read_done(len);
+    return true;
+}
+
+void http_conn::on_read_done(int bytes)
+{
+    metrics::add(metrics::BYTES_IN, bytes);
+    m_read_done_us = monotonic_us();
+    TRACE_PROBE3(read_done, m_sockfd, bytes, m_read_idx);
+    CONSOLE_TRACE("--接收到请求报文...\n");
+    // 完整报文只在调试级别记录，平时每个请求只有一条访问日志
+    if (log::is_enabled(log::LEVEL_DEBUG))
+    {
+        char ip[16] = {0};
+        inet_ntop(AF_INET, &m_address.sin_addr.s_addr, ip, INET_ADDRSTRLEN);
+        LOG_DEBUG("--从%s:%d接收到请求报文如下:\n%s", ip, m_address.sin_port, m_read_buf);
+    }
+}
+
 bool http_conn::write()
 {
     // 修改参考：https://blog.csdn.net/ad838931963/article/details/118598882
@@ -267,8 +434,8 @@ bool http_conn::write()
     if (m_bytes_to_send == 0)
     {
         // 将要发送的字节为0，这一次响应结束。
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
         init();
+        m_loop->want_read(m_sockfd);
         return true;
     }
 
@@ -282,7 +449,7 @@ bool http_conn::write()
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if (errno == EAGAIN)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                m_loop->want_write(m_sockfd);
                 /*
                 主线程写失败了，但是是因为m_sockfd写缓存暂时没空间,于是
                 让主线程退出该连接的write，且同时将该连接重新作为任务挂到队列中。
@@ -293,55 +460,256 @@ bool http_conn::write()
             // 主线程写失败了，且是因为别的原因，那么说明该连接有问题，将会关闭映射
             // 并返回false，而这会在之后使得连接关闭
             unmap();
+            log_access();
             return false;
         }
         // 可以正常将对象的就绪写缓存 写到sockfd的TCP写缓存中，那就一直不断写
-        m_bytes_to_send -= temp;
-        m_bytes_have_send += temp;
-        // 如果已发送的字节大于报头，证明报头发送完毕，且m_iv_count > 1
-        if (m_bytes_have_send >= m_iv[0].iov_len)
+        bool done = false;
+        if (!on_sent(temp, &done))
+        {
+            return false;
+        }
+        if (done)
         {
-            // 将分散写的第一块写来源待写数据长度置0，不再需要对第一块的内容做输出
-            m_iv[0].iov_len = 0;
-            // 不断更新第二块写来源写的进度
-            m_iv[1].iov_base = m_file_address + (m_bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = m_bytes_to_send;
+            return true;
+        }
+    }
+}
+
+bool http_conn::on_sent(int bytes, bool *done)
+{
+    *done = false;
+    if (bytes < 0)
+    {
+        // 发送出错或超时，与writev失败一样关闭映射后关闭连接
+        unmap();
+        log_access();
+        return false;
+    }
+    m_bytes_to_send -= bytes;
+    m_bytes_have_send += bytes;
+    metrics::add(metrics::BYTES_OUT, bytes);
+    // 如果已发送的字节大于报头，证明报头发送完毕，且m_iv_count > 1
+    if (m_bytes_have_send >= m_iv[0].iov_len)
+    {
+        // 将分散写的第一块写来源待写数据长度置0，不再需要对第一块的内容做输出
+        m_iv[0].iov_len = 0;
+        // 不断更新第二块写来源写的进度
+        m_iv[1].iov_base = (char *)m_body_address + (m_bytes_have_send - m_write_idx);
+        m_iv[1].iov_len = m_bytes_to_send;
+    }
+    else
+    {
+        // 否则，已发送的字节不如报头，说明一次发送没有将报头发送完
+        m_iv[0].iov_base = m_write_buf + m_bytes_have_send;
+        m_iv[0].iov_len -= bytes;
+    }
+
+    // 如果将发送的数据长度小于等于0，代表已经没有数据可发，代表发送完毕
+    if (m_bytes_to_send <= 0)
+    {
+        // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
+        unmap();
+        CONSOLE_TRACE("--已经发出%d bytes 数据。\n", m_bytes_have_send);
+        LOG_DEBUG("--发送响应报文头如下:\n%s", m_write_buf);
+        // 每个请求在响应发送完时记录一条访问日志，并按状态码计数
+        log_access();
+        metrics::add_response(m_status);
+        record_write_phases();
+        TRACE_PROBE3(write_done, m_sockfd, m_status, m_bytes_have_send);
+        if (m_linger)
+        {
+            CONSOLE_TRACE("--connect is keep-alive...\n");
+            LOG_DEBUG("--connect is keep-alive...");
+            // 对除了对象本身的sockfd和地址以外，连接对象其余的成员数据清空；
+            // 先清空再注册读事件，反应堆模式下注册后新请求可能立刻由另一个工作线程处理
+            init();
+            m_loop->want_read(m_sockfd);
+            *done = true;
+            return true;
         }
         else
         {
-            // 否则，已发送的字节不如报头，说明一次发送没有将报头发送完
-            m_iv[0].iov_base = m_write_buf + m_bytes_have_send;
-            m_iv[0].iov_len -= temp;
+            // 返回了false，之后本对象指向的连接将关闭。
+            CONSOLE_TRACE("--connect is not keep-alive.\n");
+            LOG_DEBUG("--connect is not keep-alive...");
+            return false;
         }
+    }
+    return true;
+}
 
-        // 如果将发送的数据长度小于等于0，代表已经没有数据可发，代表发送完毕
-        if (m_bytes_to_send <= 0)
+int http_conn::get_send_iov(struct iovec *iov)
+{
+    int count = 0;
+    for (int i = 0; i < m_iv_count; i++)
+    {
+        if (m_iv[i].iov_len > 0)
         {
-            // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
-            unmap();
-            std::cout << "--已经发出" << m_bytes_have_send << " bytes 数据。\n";
-            char ip[16] = {0};
-            inet_ntop(AF_INET, &m_address.sin_addr.s_addr, ip, INET_ADDRSTRLEN);
-            LOG_INFO("--已向%s:%d发出%d bytes数据", ip, m_address.sin_port, m_bytes_have_send);
-            LOG_INFO("--发送响应报文头如下:\n%s", m_write_buf);
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-            if (m_linger)
-            {
-                std::cout << "--connect is keep-alive...\n";
-                LOG_INFO("--connect is keep-alive...");
-                // 对除了对象本身的sockfd和地址以外，连接对象其余的成员数据清空
-                init();
-                return true;
-            }
-            else
-            {
-                // 返回了false，之后本对象指向的连接将关闭。
-                std::cout << "--connect is not keep-alive.\n";
-                LOG_INFO("--connect is not keep-alive...");
-                return false;
-            }
+            iov[count++] = m_iv[i];
         }
     }
+    return count;
+}
+
+http_conn::INLINE_RESULT http_conn::process_inline()
+{
+    // 只处理头部已经完整到达且不带请求体的GET请求，其余的交给线程池
+    if (!m_static_cache || m_read_idx < 4 || strncmp(m_read_buf, "GET ", 4) != 0)
+    {
+        return INLINE_NONE;
+    }
+    char *header_end = (char *)memmem(m_read_buf, m_read_idx, "\r\n\r\n", 4);
+    if (header_end == NULL)
+    {
+        return INLINE_NONE;
+    }
+    // parseRequest()每次都从请求行开始解析，而已解析的行会被截断，
+    // 所以这里只解析一定能一次解析完的请求：带Content-Length的GET可能还在等请求体，交给工作线程
+    for (char *p = m_read_buf; (p = (char *)memchr(p, '\n', header_end - p)) != NULL;)
+    {
+        ++p;
+        if (strncasecmp(p, "Content-Length:", 15) == 0)
+        {
+            return INLINE_NONE;
+        }
+    }
+    HTTP_CODE ret = parseRequest();
+    if (ret == NO_REQUEST)
+    {
+        // 头部完整且没有请求体，不会走到这里；万一走到，解析状态已无法恢复，关闭连接
+        return INLINE_CLOSE;
+    }
+    m_parsed_us = monotonic_us();
+    TRACE_PROBE2(parse_done, m_sockfd, (int)ret);
+    if (m_request_start_us > 0 && m_read_done_us > 0)
+    {
+        metrics::record_phase(metrics::PHASE_READ, m_read_done_us - m_request_start_us);
+        metrics::record_phase(metrics::PHASE_PARSE, m_parsed_us - m_read_done_us);
+    }
+    if (ret == GET_REQUEST)
+    {
+        // 只查缓存中最近校验过的条目，不做任何系统调用；其余的交给工作线程stat、读文件
+        int len = strlen(doc_root);
+        strcpy(m_real_file, doc_root);
+        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+        m_cached = m_static_cache->lookup(m_real_file);
+        if (!m_cached)
+        {
+            m_parsed_inline = true;
+            return INLINE_NONE;
+        }
+        metrics::add(metrics::STATIC_CACHE_HITS);
+        m_body_address = m_cached->data;
+        m_file_stat.st_size = m_cached->size;
+        ret = FILE_REQUEST;
+    }
+    // 命中缓存的文件，以及格式错误的请求，都在这里直接生成响应并发送
+    bool ok = processResponse(ret);
+    m_response_ready_us = monotonic_us();
+    TRACE_PROBE2(do_request_done, m_sockfd, (int)ret);
+    metrics::record_phase(metrics::PHASE_HANDLE, m_response_ready_us - m_parsed_us);
+    metrics::add(metrics::INLINE_RESPONSES);
+    if (!ok)
+    {
+        return INLINE_CLOSE;
+    }
+    return send_response() ? INLINE_DONE : INLINE_CLOSE;
+}
+
+bool http_conn::reply_unavailable()
+{
+    prepare_unavailable();
+    return send_response();
+}
+
+bool http_conn::send_response()
+{
+    if (m_loop->async_io())
+    {
+        m_loop->want_write(m_sockfd);
+        return true;
+    }
+    return write();
+}
+
+void http_conn::expire()
+{
+    if (m_reactor && !m_dispatched && m_io_write)
+    {
+        // 响应已经生成好，发送它只需要一次writev，比丢弃它更能减轻积压
+        m_io_write = false;
+        if (!write())
+        {
+            close_later();
+        }
+        return;
+    }
+    if (!m_overload)
+    {
+        close_later();
+        return;
+    }
+    // 排队时间同样计入阶段统计和过载控制，否则被丢弃的请求会让排队时间看起来很正常；
+    // 在数据库执行器中过期的请求，第一段的排队时间已经计入过
+    if (m_dispatched)
+    {
+        m_dispatched = false;
+    }
+    else if (m_read_done_us > 0 || m_reactor)
+    {
+        // 反应堆模式下请求还没有读，排队从主线程分发读事件时算起
+        long long queue_start_us = m_reactor ? m_event_us : (m_parsed_inline ? m_parsed_us : m_read_done_us);
+        long long queued = monotonic_us() - queue_start_us;
+        m_parsed_inline = false;
+        metrics::record_phase(metrics::PHASE_QUEUE, queued);
+        m_overload->observe_queue_delay(queued);
+    }
+    prepare_unavailable();
+    m_loop->want_write(m_sockfd);
+}
+
+void http_conn::on_event(bool writable)
+{
+    m_io_write = writable;
+    m_event_us = monotonic_us();
+}
+
+void http_conn::close_later()
+{
+    if (m_close_fd < 0)
+    {
+        close_conn();
+        return;
+    }
+    m_close_requested.store(true, std::memory_order_release);
+    int fd = m_sockfd;
+    // 不超过PIPE_BUF的写入是原子的，多个工作线程同时写也不会交错
+    if (::write(m_close_fd, &fd, sizeof(fd)) != sizeof(fd))
+    {
+        LOG_ERROR("--failed to hand fd %d over to the main thread for closing", fd);
+    }
+}
+
+bool http_conn::take_close_request()
+{
+    return m_close_requested.exchange(false, std::memory_order_acq_rel);
+}
+
+void http_conn::prepare_unavailable()
+{
+    // 503只有报文头和一小段正文，整个放进写缓存，走与错误响应相同的单块写路径
+    int len = m_overload->get_response_len();
+    memcpy(m_write_buf, m_overload->get_response(), len);
+    m_write_idx = len;
+    m_iv[0].iov_base = m_write_buf;
+    m_iv[0].iov_len = len;
+    m_iv_count = 1;
+    m_bytes_to_send = len;
+    m_bytes_have_send = 0;
+    m_body_len = m_overload->get_body_len();
+    m_status = 503;
+    m_linger = false;
 }
 
 int http_conn::getSockfd()
@@ -359,8 +727,22 @@ void http_conn::init()
     m_start_line = 0;
     m_bytes_to_send = 0;
     m_bytes_have_send = 0;
+    m_body_len = 0;
     m_content_length = 0;
     m_content = NULL;
+    m_cookie = NULL;
+    m_user_agent = NULL;
+    m_referer = NULL;
+    m_status = 0;
+    m_request_start_us = 0;
+    m_read_done_us = 0;
+    m_response_ready_us = 0;
+    m_parsed_us = 0;
+    m_dispatched = false;
+    m_parsed_inline = false;
+    m_cached.reset();
+    m_body_address = NULL;
+    m_set_session_id[0] = '\0';
     m_method = GET;
     m_url = NULL;
     m_version = NULL;
@@ -462,8 +844,20 @@ http_conn::HTTP_CODE http_conn::parseRequest()
     }
 
     /* check_state = EXIT */
-    // 如果不是从状态机到达出口状态，则处理主状态机的出口状态
-    return doRequest();
+    // 如果不是从状态机到达出口状态，则得到了一个完整的请求，交给调用者执行
+    return GET_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::parse(const char *request, int len)
+{
+    init();
+    if (len > READ_BUFFER_SIZE - 1)
+    {
+        len = READ_BUFFER_SIZE - 1;
+    }
+    memcpy(m_read_buf, request, len);
+    m_read_idx = len;
+    return parseRequest();
 }
 
 bool http_conn::processResponse(HTTP_CODE ret)
@@ -471,6 +865,7 @@ bool http_conn::processResponse(HTTP_CODE ret)
     switch (ret)
     {
     case INTERNAL_ERROR:
+        m_status = 500;
         add_status_line(500, error_500_title);
         add_headers(strlen(error_500_form));
         if (!add_content(error_500_form))
@@ -479,6 +874,7 @@ bool http_conn::processResponse(HTTP_CODE ret)
         }
         break;
     case BAD_REQUEST:
+        m_status = 400;
         add_status_line(400, error_400_title);
         add_headers(strlen(error_400_form));
         if (!add_content(error_400_form))
@@ -487,6 +883,7 @@ bool http_conn::processResponse(HTTP_CODE ret)
         }
         break;
     case NO_RESOURCE:
+        m_status = 404;
         add_status_line(404, error_404_title);
         add_headers(strlen(error_404_form));
         if (!add_content(error_404_form))
@@ -495,6 +892,7 @@ bool http_conn::processResponse(HTTP_CODE ret)
         }
         break;
     case FORBIDDEN_REQUEST:
+        m_status = 403;
         add_status_line(403, error_403_title);
         add_headers(strlen(error_403_form));
         if (!add_content(error_403_form))
@@ -503,6 +901,7 @@ bool http_conn::processResponse(HTTP_CODE ret)
         }
         break;
     case FILE_REQUEST:
+        m_status = 200;
         add_status_line(200, ok_200_title);
         add_headers(m_file_stat.st_size);
         /*
@@ -516,7 +915,7 @@ bool http_conn::processResponse(HTTP_CODE ret)
         */
         m_iv[0].iov_base = m_write_buf;
         m_iv[0].iov_len = m_write_idx;
-        m_iv[1].iov_base = m_file_address;
+        m_iv[1].iov_base = (char *)m_body_address;
         m_iv[1].iov_len = m_file_stat.st_size;
         m_bytes_to_send = m_write_idx + m_file_stat.st_size;
         m_iv_count = 2;
@@ -643,6 +1042,25 @@ http_conn::HTTP_CODE http_conn::parseHeaders(char *text)
         text += strspn(text, " \t");
         m_host = text;
     }
+    else if (strncasecmp(text, "User-Agent:", 11) == 0)
+    {
+        text += 11;
+        text += strspn(text, " \t");
+        m_user_agent = text;
+    }
+    else if (strncasecmp(text, "Referer:", 8) == 0)
+    {
+        text += 8;
+        text += strspn(text, " \t");
+        m_referer = text;
+    }
+    else if (strncasecmp(text, "Cookie:", 7) == 0)
+    {
+        // 处理Cookie头部字段  Cookie: sid=xxxx; other=yyyy
+        text += 7;
+        text += strspn(text, " \t");
+        m_cookie = text;
+    }
     else
     {
         // printf("oop! unknow header: %s\n", text);
@@ -753,8 +1171,8 @@ http_conn::HTTP_CODE http_conn::doRequest()
         break;
         case '1':
         {
-            // '1'代表跳转到登录页面
-            string next_url = "/log.html";
+            // '1'代表跳转到登录页面，已登录的用户直接进入欢迎页
+            string next_url = check_session() ? "/welcome.html" : "/log.html";
             strncpy(m_real_file + len, next_url.c_str(),
                     FILENAME_LEN - len - 1);
         }
@@ -762,6 +1180,13 @@ http_conn::HTTP_CODE http_conn::doRequest()
         case '2':
         {
             // '2'代表登录检测
+            if (check_session())
+            {
+                // 会话有效，说明之前已经登录过，不再查询数据库
+                strncpy(m_real_file + len, "/welcome.html",
+                        FILENAME_LEN - len - 1);
+                break;
+            }
             char usr_name[32], pwd[32];
             /*
                 登录检测发送的POST请求中的请求体的内容格式固定如下：
@@ -800,10 +1225,16 @@ http_conn::HTTP_CODE http_conn::doRequest()
                             FILENAME_LEN - len - 1);
                     break;
                 }
-                MYSQL_RES *result = mysql_store_result(conn);
-                if (mysql_fetch_row(result))
+                // 结果集由sql_result持有，离开作用域时自动释放
+                sql_result result = sql_result::store(conn);
+                if (result.fetch_row())
                 {
                     LOG_INFO("--用户：%s ,登录成功", usr_name);
+                    // 登录成功，建立会话，会话ID随响应的Set-Cookie下发
+                    if (m_session_store && !m_session_store->create(usr_name, m_set_session_id))
+                    {
+                        m_set_session_id[0] = '\0';
+                    }
                     // 查询成功，则证明用户名登录成功
                     strncpy(m_real_file + len, "/welcome.html",
                             FILENAME_LEN - len - 1);
@@ -851,6 +1282,23 @@ http_conn::HTTP_CODE http_conn::doRequest()
                 pwd[copy_idx++] = m_content[check_idx++];
             }
             pwd[copy_idx] = '\0';
+            if (m_register_batcher)
+            {
+                // 交给注册批处理线程，与同一时间窗内的其他注册请求合并成一次查询+一次写入
+                int result = m_register_batcher->submit(usr_name, pwd);
+                if (result == register_batcher::REGISTER_OK)
+                {
+                    strncpy(m_real_file + len, "/log.html", FILENAME_LEN - len - 1);
+                    LOG_INFO("--用户： %s,注册成功！", usr_name);
+                }
+                else
+                {
+                    strncpy(m_real_file + len, "/registerError.html", FILENAME_LEN - len - 1);
+                    LOG_INFO("--用户： %s,注册失败，失败原因:%s", usr_name,
+                             result == register_batcher::REGISTER_EXISTS ? "注册用户名已存在" : "数据库写入失败");
+                }
+                break;
+            }
             // 获取数据库连接，并利用连接查询post输入的用户名
             connection_pool_wrapper safe_connect(*m_db_connect_pool);
             MYSQL *conn = safe_connect.get_raw_connection();
@@ -861,8 +1309,8 @@ http_conn::HTTP_CODE http_conn::doRequest()
                          "SELECT * from user where username = '%s'",
                          usr_name);
                 mysql_query(conn, query_cmd);
-                MYSQL_RES *result = mysql_store_result(conn);
-                if (mysql_fetch_row(result))
+                sql_result result = sql_result::store(conn);
+                if (result.fetch_row())
                 {
                     // 说明已有同名用户名存在
                     strncpy(m_real_file + len, "/registerError.html",
@@ -929,6 +1377,19 @@ http_conn::HTTP_CODE http_conn::doRequest()
         return BAD_REQUEST;
     }
 
+    // 小文件从缓存中取，不再每次打开、映射
+    if (m_static_cache)
+    {
+        m_cached = m_static_cache->get(m_real_file, m_file_stat);
+        if (m_cached)
+        {
+            metrics::add(metrics::STATIC_CACHE_HITS);
+            m_body_address = m_cached->data;
+            return FILE_REQUEST;
+        }
+        metrics::add(metrics::STATIC_CACHE_MISSES);
+    }
+
     // 以只读方式打开文件
     int fd = open(m_real_file, O_RDONLY);
     // 创建内存映射
@@ -938,6 +1399,7 @@ http_conn::HTTP_CODE http_conn::doRequest()
     */
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    m_body_address = m_file_address;
 
     return FILE_REQUEST;
 }
@@ -949,9 +1411,11 @@ bool http_conn::add_status_line(int status, const char *title)
 
 bool http_conn::add_headers(int content_len)
 {
+    m_body_len = content_len;
     add_content_length(content_len);
     add_content_type();
     add_linger();
+    add_set_cookie();
     add_blank_line();
     return true;
 }
@@ -1009,11 +1473,94 @@ bool http_conn::add_linger()
     return add_response("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
 
+bool http_conn::add_set_cookie()
+{
+    if (m_set_session_id[0] == '\0')
+    {
+        return true;
+    }
+    return add_response("Set-Cookie: %s=%s; Max-Age=%d; Path=/; HttpOnly\r\n",
+                        session_cookie_name, m_set_session_id, m_session_store->get_ttl());
+}
+
+bool http_conn::check_session()
+{
+    if (!m_session_store || !m_cookie)
+    {
+        return false;
+    }
+    // 在Cookie头中找到 sid=xxxx，值以';'或行尾结束
+    int name_len = strlen(session_cookie_name);
+    const char *p = m_cookie;
+    while (*p)
+    {
+        p += strspn(p, " \t;");
+        if (strncmp(p, session_cookie_name, name_len) == 0 && p[name_len] == '=')
+        {
+            char sid[session_store::SESSION_ID_LEN + 1];
+            const char *value = p + name_len + 1;
+            int value_len = strcspn(value, "; \t");
+            if (value_len != session_store::SESSION_ID_LEN)
+            {
+                return false;
+            }
+            memcpy(sid, value, value_len);
+            sid[value_len] = '\0';
+            std::string username;
+            if (m_session_store->validate(sid, &username))
+            {
+                LOG_INFO("--用户：%s ,会话有效，跳过数据库查询", username.c_str());
+                return true;
+            }
+            return false;
+        }
+        p += strcspn(p, ";");
+    }
+    return false;
+}
+
 bool http_conn::add_blank_line()
 {
     return add_response("%s", "\r\n");
 }
 
+void http_conn::log_access(int status)
+{
+    if (access_log::get_sample_every() <= 0 || !log::is_enabled(log::LEVEL_INFO))
+    {
+        return;
+    }
+    char ip[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &m_address.sin_addr.s_addr, ip, INET_ADDRSTRLEN);
+    // 请求行解析失败时方法和URL都不可信，按"-"记录
+    bool parsed = m_url != NULL && m_version != NULL;
+    long long latency = m_request_start_us > 0 ? monotonic_us() - m_request_start_us : 0;
+    // 响应头总在正文之前发出，已发送的字节数减去响应头的长度即为已发送的正文
+    long long header_len = (long long)m_bytes_have_send + m_bytes_to_send - m_body_len;
+    long long body_sent = m_bytes_have_send - header_len;
+    if (body_sent < 0)
+    {
+        body_sent = 0;
+    }
+    access_log::record(ip, parsed ? method_names[m_method] : NULL, parsed ? m_url : NULL,
+                       parsed ? m_version : NULL, status ? status : m_status, body_sent,
+                       m_referer, m_user_agent, latency);
+}
+
+void http_conn::record_write_phases()
+{
+    if (m_response_ready_us <= 0)
+    {
+        return;
+    }
+    long long now = monotonic_us();
+    metrics::record_phase(metrics::PHASE_WRITE, now - m_response_ready_us);
+    if (m_request_start_us > 0)
+    {
+        metrics::record_phase(metrics::PHASE_TOTAL, now - m_request_start_us);
+    }
+}
+
 void http_conn::unmap()
 {
 
@@ -1022,4 +1569,6 @@ void http_conn::unmap()
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    m_cached.reset();
+    m_body_address = NULL;
 }
@@ -15,11 +15,22 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <stdarg.h>
+#include <atomic>
 #include "../timer/listTimer.h"
 #include "../log/log.h"
+#include "../log/access_log.h"
 #include "../mysql_conn_pool/mysql_conn_pool.h"
+#include "../mysql_conn_pool/register_batcher.h"
+#include "../session/session_store.h"
+#include "../metrics/metrics.h"
+#include "../metrics/probes.h"
+#include "overload_controller.h"
+#include "static_cache.h"
+#include "../event_loop/event_loop.h"
 
 class util_timer;
+template <typename T>
+class threadPool;
 
 class http_conn
 {
@@ -98,9 +109,25 @@ public:
         LINE_OPEN
     };
 
+    /*
+        主线程快路径的结果
+        INLINE_NONE :   没有在主线程处理完，照常交给线程池(可能已经解析过)
+        INLINE_DONE :   已在主线程生成响应并发送(或等待事件循环继续发送)
+        INLINE_CLOSE:   已处理，调用者应关闭连接
+    */
+    enum INLINE_RESULT
+    {
+        INLINE_NONE = 0,
+        INLINE_DONE,
+        INLINE_CLOSE
+    };
+
     // http_conn(){}
     // ~http_conn(){}
-    // 处理客户端请求：解析请求报文，生成响应报文,由线程池中的工作线程调用
+    /*
+        处理客户端请求：解析请求报文，生成响应报文,由线程池中的工作线程调用。
+        反应堆模式下还要先完成主线程分发过来的读(读完再解析)或写事件
+    */
     void process();
     // 通过传入socket描述符和客户端地址初始化连接
     void init(int sockfd, const struct sockaddr_in &addr);
@@ -110,18 +137,59 @@ public:
     void init(int sockfd, const struct sockaddr_in &addr, util_timer *timer, connection_pool *db_connect_pool);
     // 关闭连接
     void close_conn();
-    // 非阻塞读，由主线程以proactor模式调用
+    // 非阻塞读，模拟proactor模式下由主线程调用，反应堆模式下由工作线程调用
     bool read();
-    // 非阻塞写，由主线程以proactor模式调用
+    // 非阻塞写，模拟proactor模式下由主线程调用，反应堆模式下由工作线程调用
     bool write();
+    /*
+        io_uring模式下代替read()：主线程把recv完成时收到的数据拷贝进读缓存，
+        读缓存放不下时返回false，调用者应关闭连接
+    */
+    bool feed(const char *data, int len);
+    // io_uring模式下取出还没发送的响应块(跳过空块)，返回块数
+    int get_send_iov(struct iovec *iov);
+    /*
+        io_uring模式下一次发送完成后由主线程调用，bytes为发送的字节数，小于0为出错。
+        与write()一样，返回false表示调用者应关闭连接；返回true时done表示响应是否已全部发出，
+        没发完时调用者接着发送get_send_iov()取出的剩余部分
+    */
+    bool on_sent(int bytes, bool *done);
+    // 反应堆模式下，主线程把连接的就绪事件交给线程池之前调用，记下是读还是写
+    void on_event(bool writable);
+    /*
+        主线程收到工作线程的关闭请求后调用：连接仍然是请求关闭时的那一个(没有被定时器关闭后
+        复用)时返回true，由主线程删除定时器并关闭连接
+    */
+    bool take_close_request();
+    /*
+        主线程读完请求后调用：完整的GET请求命中静态文件缓存时，直接在主线程解析、
+        生成响应并发送，不经过线程池；其他请求返回INLINE_NONE交给线程池，
+        已经解析过的不会再解析一遍
+    */
+    INLINE_RESULT process_inline();
+    /*
+        过载时由主线程调用：不解析已读到的请求，直接回复预先生成的503并在发送完后关闭连接。
+        与write()一样，返回false表示调用者应关闭连接，返回true表示剩余部分等待EPOLLOUT再发
+    */
+    bool reply_unavailable();
+    /*
+        请求在线程池中排队过久时由工作线程调用，代替process()：同样不解析请求，
+        把503放进写缓存后注册写事件，由主线程发送并关闭连接
+    */
+    void expire();
 
     // 获取socketfd
     int getSockfd();
+    /*
+        只解析一段请求报文(超出读缓冲的部分被截断)，不读写套接字，也不执行请求，
+        供基准测试等在连接之外驱动解析器的场合使用
+    */
+    HTTP_CODE parse(const char *request, int len);
 
 private:
     // 初始化没有公开接口进行传值的成员变量
     void init();
-    // 解析http请求
+    // 解析http请求，得到完整的请求时返回GET_REQUEST，由调用者执行doRequest
     HTTP_CODE parseRequest();
     // 构建http应答
     bool processResponse(HTTP_CODE ret);
@@ -151,10 +219,30 @@ private:
     bool add_content_length(int content_length);
     bool add_content_type();
     bool add_linger();
+    bool add_set_cookie();
     bool add_blank_line();
+    // 从请求的Cookie头中取出会话ID，校验通过返回true
+    bool check_session();
 
     // 关闭内存映射
     void unmap();
+    // 为当前请求记录一条访问日志，status为0时按本次响应的状态码记录
+    void log_access(int status = 0);
+    // 响应发送完时记录写阶段和总耗时
+    void record_write_phases();
+    // 把预先生成的503放进写缓存，发送完后关闭连接
+    void prepare_unavailable();
+    // 解析完的请求是否需要访问数据库
+    bool is_db_request();
+    /*
+        在工作线程中需要关闭连接时调用：定时器链表只能由主线程操作，所以把fd写进关闭管道，
+        由主线程删除定时器并关闭连接；没有设置关闭管道时直接关闭
+    */
+    void close_later();
+    // 读到数据后的记录：计入指标、记下读完的时刻
+    void on_read_done(int bytes);
+    // 在主线程中发送已生成的响应：事件循环异步读写时交给它发送，否则直接write()
+    bool send_response();
 
 private:
     // 当前客户端连接的socket
@@ -183,6 +271,31 @@ private:
     int m_content_length;
     // 解析结果：请求体的字符串指针
     char *m_content;
+    // 解析结果：Cookie头部字段的值
+    char *m_cookie;
+    // 解析结果：User-Agent和Referer头部字段的值，仅用于访问日志
+    char *m_user_agent;
+    char *m_referer;
+    // 本次响应的状态码
+    int m_status;
+    // 收到本次请求第一个字节的时刻(微秒)，用于计算访问日志中的耗时
+    long long m_request_start_us;
+    // 请求数据读完交给线程池的时刻，以及响应生成完的时刻(微秒)，用于分阶段统计耗时
+    long long m_read_done_us;
+    long long m_response_ready_us;
+    // 解析完成的时刻(微秒)
+    long long m_parsed_us;
+    // 请求已解析并转交给数据库执行器，由它继续执行
+    bool m_dispatched;
+    // 请求已在主线程快路径上解析完(缓存未命中)，工作线程不再解析
+    bool m_parsed_inline;
+    // 反应堆模式下交给工作线程的是写事件，以及主线程分发事件的时刻(微秒)
+    bool m_io_write;
+    long long m_event_us;
+    // 工作线程已请求主线程关闭该连接
+    std::atomic<bool> m_close_requested;
+    // 本次响应需要通过Set-Cookie下发的会话ID，为空则不下发
+    char m_set_session_id[session_store::SESSION_ID_LEN + 1];
     /*
     报文解析状态变量会被解析函数内的几个子解析函数改变。为了让变量能跨函数
     的作用，此时将该状态变量作为成员变量来实现在类内空间域的全局性
@@ -195,6 +308,10 @@ private:
     char *m_file_address;
     // 目标文件状态信息
     struct stat m_file_stat;
+    // 命中缓存时持有的缓存条目，响应发送完后释放
+    static_cache::entry_ptr m_cached;
+    // 响应正文的起始位置，指向m_file_address或缓存条目的数据
+    const char *m_body_address;
 
     // 读缓冲区
     char m_write_buf[WRITE_BUFFER_SIZE];
@@ -207,16 +324,39 @@ private:
     int m_bytes_have_send;
     // 记录分散写已经写的数据量
     int m_bytes_to_send;
+    // 本次响应正文的字节数(即Content-Length)，访问日志按CLF只记已发送的正文
+    int m_body_len;
 
     // 绑定的数据库连接池指针
     connection_pool *m_db_connect_pool;
 
 public:
     /* 静态成员变量必须在类外定义，因此放在了类的实现文件中定义 */
-    // 通过静态，使得所有客户端socket绑定到同一epollfd中
-    static int m_epollfd;
-    // 用户连接数量
-    static int m_user_count;
+    // 通过静态，使得所有客户端socket登记到同一个事件循环中
+    static event_loop *m_loop;
+    // 用户连接数量，主线程建立连接时加一，关闭连接可能发生在工作线程，因此是原子的
+    static std::atomic<int> m_user_count;
+    // 所有连接共享的登录会话存储，为NULL则不启用会话
+    static session_store *m_session_store;
+    // 所有连接共享的注册批处理器，为NULL则每个注册请求单独查询、写入
+    static register_batcher *m_register_batcher;
+    /*
+        反应堆模式：主线程只分发就绪事件，套接字的读写由工作线程在EPOLLONESHOT下完成，
+        多个连接的拷贝可以分散到多个核上；为false时是模拟proactor模式，主线程负责所有读写
+    */
+    static bool m_reactor;
+    // 工作线程请求主线程关闭连接的管道写端，写入的是连接的fd，为-1则在工作线程中直接关闭
+    static int m_close_fd;
+    // 所有连接共享的静态文件缓存，为NULL则每次都mmap文件，也不走主线程快路径
+    static static_cache *m_static_cache;
+    // 所有连接共享的过载控制器，为NULL则不做过载控制
+    static overload_controller *m_overload;
+    /*
+        执行登录/注册等数据库请求的线程池，为NULL则所有请求都在解析它的线程中执行。
+        请求先在主线程池中解析，分类为数据库请求的再转交过来，
+        这样数据库变慢时，静态请求不会排在登录/注册请求后面
+    */
+    static threadPool<http_conn> *m_db_executor;
 
 public:
     // 用于和定时器绑定的指针，该定时器会在到时后自动销毁，因此连接类不需要管
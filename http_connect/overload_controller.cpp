@@ -0,0 +1,76 @@
+#include "overload_controller.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../metrics/metrics.h"
+
+static const char *error_503_form = "The server is overloaded, please retry later.\n";
+
+overload_controller::overload_controller(int max_queue_depth, int max_queue_delay_ms, int retry_after)
+    : m_max_queue_depth(max_queue_depth), m_max_queue_delay_us(max_queue_delay_ms * 1000LL),
+      m_queue_delay_us(0), m_body_len(strlen(error_503_form))
+{
+    m_response_len = snprintf(m_response, sizeof(m_response),
+                              "HTTP/1.1 503 Service Unavailable\r\n"
+                              "Retry-After: %d\r\n"
+                              "Content-Length: %d\r\n"
+                              "Content-Type: text/html\r\n"
+                              "Connection: close\r\n"
+                              "\r\n"
+                              "%s",
+                              retry_after, m_body_len, error_503_form);
+}
+
+bool overload_controller::admit(int queue_depth)
+{
+    if (m_max_queue_depth > 0 && queue_depth >= m_max_queue_depth)
+    {
+        metrics::add(metrics::SHED_QUEUE_DEPTH);
+        return false;
+    }
+    if (m_max_queue_delay_us > 0 && queue_depth > 0 &&
+        m_queue_delay_us.load(std::memory_order_relaxed) > m_max_queue_delay_us)
+    {
+        metrics::add(metrics::SHED_QUEUE_DELAY);
+        return false;
+    }
+    return true;
+}
+
+void overload_controller::observe_queue_delay(long long us)
+{
+    // 与TCP的平滑RTT一样取1/8的权重
+    long long avg = m_queue_delay_us.load(std::memory_order_relaxed);
+    m_queue_delay_us.store(avg + (us - avg) / 8, std::memory_order_relaxed);
+}
+
+void overload_controller::reject_connection(int fd)
+{
+    // 新连接的发送缓冲是空的，一次非阻塞发送足以发完；发不出去也直接关闭
+    if (send(fd, m_response, m_response_len, MSG_DONTWAIT | MSG_NOSIGNAL) > 0)
+    {
+        metrics::add_response(503);
+    }
+    close(fd);
+}
+
+long long overload_controller::get_queue_delay() const
+{
+    return m_queue_delay_us.load(std::memory_order_relaxed);
+}
+
+const char *overload_controller::get_response() const
+{
+    return m_response;
+}
+
+int overload_controller::get_response_len() const
+{
+    return m_response_len;
+}
+
+int overload_controller::get_body_len() const
+{
+    return m_body_len;
+}
@@ -0,0 +1,47 @@
+#ifndef OVERLOAD_CONTROLLER_H
+#define OVERLOAD_CONTROLLER_H
+#include <atomic>
+
+/*
+    过载控制
+
+    主线程读完一个请求、准备交给线程池之前先询问admit()：
+    - 线程池排队数达到max_queue_depth时拒绝；
+    - 最近取出的请求排队时间(指数加权平均)超过max_queue_delay_ms，且队列不空时拒绝。
+      队列排空后不再按排队时间拒绝，这样新的请求能重新进入队列、刷新排队时间，
+      不会因为平均值停留在高位而一直拒绝下去。
+    被拒绝的请求由主线程直接回复预先生成好的503(带Retry-After)并关闭连接，
+    不解析请求、不占用工作线程；连接数已满时，刚accept的连接同样回复503后关闭。
+    这样突发流量下被拒绝的客户端能立即得到答复，已接纳的请求延迟保持稳定。
+
+    阈值为0表示不按该项拒绝。
+*/
+class overload_controller
+{
+public:
+    overload_controller(int max_queue_depth, int max_queue_delay_ms, int retry_after);
+    // 是否接纳一个读完的请求进入线程池，queue_depth为线程池当前排队数
+    bool admit(int queue_depth);
+    // 工作线程取出请求时报告它的排队时间(微秒)
+    void observe_queue_delay(long long us);
+    // 连接数已满时，向刚accept的连接尽力发送503，然后关闭
+    void reject_connection(int fd);
+    // 当前排队时间的加权平均值(微秒)
+    long long get_queue_delay() const;
+    // 预先生成的503响应
+    const char *get_response() const;
+    int get_response_len() const;
+    // 503响应中正文的字节数
+    int get_body_len() const;
+
+private:
+    int m_max_queue_depth;
+    long long m_max_queue_delay_us;
+    // 排队时间的指数加权平均，多个工作线程并发更新时偶尔丢失一次更新无关紧要
+    std::atomic<long long> m_queue_delay_us;
+    char m_response[256];
+    int m_response_len;
+    int m_body_len;
+};
+
+#endif
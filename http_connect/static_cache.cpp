@@ -0,0 +1,135 @@
+#include "static_cache.h"
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+static_cache::entry::~entry()
+{
+    free(data);
+}
+
+static_cache::static_cache(long long max_bytes, long long max_file_size, int revalidate_ms)
+    : m_bytes(0), m_max_bytes(max_bytes), m_max_file_size(max_file_size), m_revalidate_us(revalidate_ms * 1000LL)
+{
+}
+
+long long static_cache::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static_cache::entry_ptr static_cache::load(const char *path, const struct stat &st)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return entry_ptr();
+    }
+    entry_ptr e(new entry);
+    e->size = st.st_size;
+    e->mtime = st.st_mtim;
+    // 空文件也分配1字节，data不为NULL
+    e->data = (char *)malloc(e->size > 0 ? e->size : 1);
+    size_t done = 0;
+    while (e->data != NULL && done < e->size)
+    {
+        ssize_t n = read(fd, e->data + done, e->size - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    // 读取途中文件被截断等情况，不缓存
+    if (e->data == NULL || done != e->size)
+    {
+        return entry_ptr();
+    }
+    e->checked_us.store(now_us(), std::memory_order_relaxed);
+    return e;
+}
+
+static_cache::entry_ptr static_cache::get(const char *path, const struct stat &st)
+{
+    if (st.st_size > m_max_file_size)
+    {
+        return entry_ptr();
+    }
+    std::string key(path);
+    long long replaced = 0;
+    m_lock.lock();
+    std::unordered_map<std::string, entry_ptr>::iterator it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        entry_ptr e = it->second;
+        if ((off_t)e->size == st.st_size && e->mtime.tv_sec == st.st_mtim.tv_sec &&
+            e->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            m_lock.unlock();
+            e->checked_us.store(now_us(), std::memory_order_relaxed);
+            return e;
+        }
+        replaced = e->size;
+    }
+    bool full = m_bytes - replaced + st.st_size > m_max_bytes;
+    m_lock.unlock();
+    if (full)
+    {
+        return entry_ptr();
+    }
+
+    // 在锁外读文件，同一文件被并发读入时以后写入的为准
+    entry_ptr e = load(path, st);
+    if (!e)
+    {
+        return e;
+    }
+    m_lock.lock();
+    it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        m_bytes -= it->second->size;
+        it->second = e;
+    }
+    else
+    {
+        m_entries[key] = e;
+    }
+    m_bytes += e->size;
+    m_lock.unlock();
+    return e;
+}
+
+static_cache::entry_ptr static_cache::lookup(const char *path)
+{
+    entry_ptr e;
+    m_lock.lock();
+    std::unordered_map<std::string, entry_ptr>::iterator it = m_entries.find(path);
+    if (it != m_entries.end())
+    {
+        e = it->second;
+    }
+    m_lock.unlock();
+    if (e && now_us() - e->checked_us.load(std::memory_order_relaxed) > m_revalidate_us)
+    {
+        e.reset();
+    }
+    return e;
+}
+
+long long static_cache::get_bytes()
+{
+    m_lock.lock();
+    long long bytes = m_bytes;
+    m_lock.unlock();
+    return bytes;
+}
@@ -0,0 +1,58 @@
+#ifndef STATIC_CACHE_H
+#define STATIC_CACHE_H
+#include <sys/stat.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "../thread_pool/locker.h"
+
+/*
+    静态文件缓存
+
+    把不超过max_file_size的静态文件整个读进内存，总大小不超过max_bytes，满了以后不再缓存新文件。
+    - get()由工作线程在stat通过权限检查之后调用：文件大小和修改时间不变则直接返回缓存，
+      否则重新读入；同时刷新条目的校验时刻；
+    - lookup()给主线程的快路径使用，不做任何系统调用，只返回revalidate_ms内校验过的条目，
+      超过这个时间的请求交给工作线程走一次get()重新校验。
+    条目由shared_ptr管理，文件更新时旧条目在正在发送它的连接释放后才真正释放。
+*/
+class static_cache
+{
+public:
+    struct entry
+    {
+        char *data;
+        size_t size;
+        struct timespec mtime;
+        // 最近一次与文件系统核对的时刻(微秒，单调时钟)
+        std::atomic<long long> checked_us;
+        entry() : data(NULL), size(0), checked_us(0) {}
+        ~entry();
+    };
+    typedef std::shared_ptr<entry> entry_ptr;
+
+    static_cache(long long max_bytes, long long max_file_size, int revalidate_ms);
+    // path已经stat过并通过检查，st为它的状态；文件过大、缓存已满或读取失败时返回空
+    entry_ptr get(const char *path, const struct stat &st);
+    // 快路径的查找，没有或者需要重新校验时返回空
+    entry_ptr lookup(const char *path);
+    // 已缓存的字节数
+    long long get_bytes();
+
+private:
+    static long long now_us();
+    // 把整个文件读入一个新条目，失败返回空
+    static entry_ptr load(const char *path, const struct stat &st);
+
+private:
+    locker m_lock;
+    std::unordered_map<std::string, entry_ptr> m_entries;
+    long long m_bytes;
+    long long m_max_bytes;
+    long long m_max_file_size;
+    long long m_revalidate_us;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "access_log.h"
+#include "log.h"
+
+std::atomic<int> access_log::m_sample_every(1);
+
+// 采样计数与时间字符串缓存都是线程局部的，记录访问日志不需要任何共享的锁或原子写
+static __thread unsigned int t_access_seq = 0;
+static __thread time_t t_clf_sec = -1;
+static __thread char t_clf_time[32];
+
+void access_log::set_sample_every(int sample_every)
+{
+    m_sample_every.store(sample_every < 0 ? 0 : sample_every, std::memory_order_relaxed);
+}
+
+int access_log::get_sample_every()
+{
+    return m_sample_every.load(std::memory_order_relaxed);
+}
+
+bool access_log::sampled(int status)
+{
+    int every = m_sample_every.load(std::memory_order_relaxed);
+    if (every <= 0)
+    {
+        return false;
+    }
+    // 服务端错误总是记录，便于排查
+    if (status >= 500)
+    {
+        return true;
+    }
+    return every == 1 || (t_access_seq++ % every) == 0;
+}
+
+const char *access_log::clf_time()
+{
+    time_t now = time(NULL);
+    if (now != t_clf_sec)
+    {
+        struct tm tm_now;
+        localtime_r(&now, &tm_now);
+        strftime(t_clf_time, sizeof(t_clf_time), "%d/%b/%Y:%H:%M:%S %z", &tm_now);
+        t_clf_sec = now;
+    }
+    return t_clf_time;
+}
+
+int access_log::escape(const char *src, char *dst, int size)
+{
+    static const char hex[] = "0123456789abcdef";
+    int len = 0;
+    for (; *src != '\0'; src++)
+    {
+        unsigned char c = (unsigned char)*src;
+        // 放不下一个完整的转义序列时截断，不留下半个转义
+        if (c == '"' || c == '\\')
+        {
+            if (len + 2 >= size)
+            {
+                break;
+            }
+            dst[len++] = '\\';
+            dst[len++] = c;
+        }
+        else if (c < 0x20 || c >= 0x7f)
+        {
+            if (len + 4 >= size)
+            {
+                break;
+            }
+            dst[len++] = '\\';
+            dst[len++] = 'x';
+            dst[len++] = hex[c >> 4];
+            dst[len++] = hex[c & 0xf];
+        }
+        else
+        {
+            if (len + 1 >= size)
+            {
+                break;
+            }
+            dst[len++] = c;
+        }
+    }
+    dst[len] = '\0';
+    return len;
+}
+
+void access_log::record(const char *client, const char *method, const char *url, const char *version,
+                        int status, long long bytes, const char *referer, const char *user_agent,
+                        long long latency_us)
+{
+    if (!log::is_enabled(log::LEVEL_INFO) || !sampled(status))
+    {
+        return;
+    }
+    // 来自客户端的字段按Apache的做法转义，否则其中的引号会破坏字段边界，甚至伪造出整条记录
+    char url_buf[1024];
+    char version_buf[32];
+    char referer_buf[512];
+    char agent_buf[512];
+    escape(url ? url : "-", url_buf, sizeof(url_buf));
+    escape(version ? version : "-", version_buf, sizeof(version_buf));
+    escape(referer ? referer : "-", referer_buf, sizeof(referer_buf));
+    escape(user_agent ? user_agent : "-", agent_buf, sizeof(agent_buf));
+    // CLF中没有发送正文时字节数记为"-"
+    char bytes_buf[24] = "-";
+    if (bytes > 0)
+    {
+        snprintf(bytes_buf, sizeof(bytes_buf), "%lld", bytes);
+    }
+    LOG_INFO("%s - - [%s] \"%s %s %s\" %d %s \"%s\" \"%s\" %lldus",
+             client ? client : "-", clf_time(), method ? method : "-", url_buf,
+             version_buf, status, bytes_buf, referer_buf, agent_buf, latency_us);
+}
@@ -0,0 +1,48 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+#include <atomic>
+
+/*
+    访问日志：每个请求在响应发送完(或连接出错)时产生一条，
+    格式为Combined Log Format再附加服务端耗时：
+        client - - [10/Oct/2026:13:55:36 +0800] "GET /index.html HTTP/1.1" 200 2326 "referer" "user-agent" 532us
+    来自客户端的URL、协议版本、Referer、User-Agent中的 " 和 \ 转义为 \" 和 \\，不可打印字节转义为 \xhh，与Apache一致。
+    记录经由日志类写出，所以与服务器日志使用同一种(异步/双缓冲/延迟格式化)写入模式。
+
+    请求量大时可以按1/N采样，5xx响应不受采样限制，总是记录
+*/
+class access_log
+{
+public:
+    /*
+        设置采样：每sample_every个请求记录一条，1为全部记录，0为关闭访问日志
+    */
+    static void set_sample_every(int sample_every);
+    static int get_sample_every();
+    /*
+        记录一条访问日志，字符串参数为NULL时输出为"-"
+        param:
+            client: 客户端地址
+            method/url/version: 请求行，无法解析时为NULL
+            status: 响应状态码
+            bytes: 已发送的正文字节数(不含响应头)，为0时记为"-"
+            referer/user_agent: 请求头中的对应字段
+            latency_us: 从收到请求到响应发送完的耗时
+    */
+    static void record(const char *client, const char *method, const char *url, const char *version,
+                       int status, long long bytes, const char *referer, const char *user_agent,
+                       long long latency_us);
+
+private:
+    // 按采样率决定当前请求是否记录
+    static bool sampled(int status);
+    // 把src转义后写入dst(最多size-1字节，超出时截断)，返回写入的长度
+    static int escape(const char *src, char *dst, int size);
+    // 取得当前秒的CLF时间字符串，每个线程每秒只格式化一次
+    static const char *clf_time();
+
+private:
+    static std::atomic<int> m_sample_every;
+};
+
+#endif
@@ -1,13 +1,28 @@
 #ifndef BLOCK_QUEUE_H
 #define BLOCK_QUEUE_H
 #include <stdlib.h> // exit
+#include <utility>
+#include <vector>
 #include "../thread_pool/locker.h"
 
+/*
+    队列满时push的处理策略
+    QUEUE_BLOCK:       生产者阻塞等待，直到消费者取走元素(背压)
+    QUEUE_DROP_NEWEST: 丢弃本次要放入的元素
+    QUEUE_DROP_OLDEST: 丢弃队头最旧的元素，为本次的元素腾出位置
+*/
+enum E_QUEUE_POLICY
+{
+    QUEUE_BLOCK = 0,
+    QUEUE_DROP_NEWEST,
+    QUEUE_DROP_OLDEST
+};
+
 template <class T>
 class block_queue
 {
 public:
-    block_queue(int max_size = 1000);
+    block_queue(int max_size = 1000, int policy = QUEUE_DROP_NEWEST);
     ~block_queue();
     // 清空队列
     void clear();
@@ -18,33 +33,58 @@ public:
     int get_size();
     int get_max_size();
     /*
-    往队列尾添加元素，最终将所有等待队列元素的线程唤醒
-    生产者角色
+    往队列尾添加元素，并唤醒一个等待队列元素的线程
+    生产者角色，队列满时按构造时指定的策略处理
+    return(bool):
+        true: 元素已入队(DROP_OLDEST策略下可能挤掉了一个旧元素)
+        false: 元素被丢弃，或队列已关闭
     */
     bool push(const T &item);
+    // 移动版本，入队时不拷贝元素
+    bool push(T &&item);
     /*
     从队列头拿取元素，无元素则将阻塞等待
     */
     bool pop(T &item);
+    /*
+    批量取出队列中当前所有的元素(追加到items尾部)，无元素则阻塞等待，
+    消费者一次唤醒即可处理一批元素。队列关闭且已取空时返回false
+    */
+    bool pop_all(std::vector<T> &items);
+    // 因队列满而被丢弃的元素数
+    long long get_dropped();
+    // 生产者因队列满而阻塞等待的次数
+    long long get_blocked();
     // 发出唤醒信号，请求清理一下队列
     void flush();
     // 关闭队列，队列不再能拿出东西，所有阻塞进程都不再阻塞返回false
     void close();
 
+private:
+    // 队列满时按策略腾位置或等待，调用者需持有m_mutex，返回false表示本次元素应被丢弃
+    bool make_room();
+
 private:
     locker m_mutex;
+    // 队列非空，消费者在其上等待
     cond m_cond;
+    // 队列未满，QUEUE_BLOCK策略下生产者在其上等待
+    cond m_not_full;
     T *m_array;
     int m_size;
     int m_max_size;
     int m_front;
     int m_back;
     bool m_is_close;
+    int m_policy;
+    long long m_dropped;
+    long long m_blocked;
 };
 
 template <class T>
-inline block_queue<T>::block_queue(int max_size) : m_mutex(locker()), m_cond(cond()), m_array(NULL),
-                                                   m_size(0), m_max_size(max_size), m_front(-1), m_back(-1)
+inline block_queue<T>::block_queue(int max_size, int policy)
+    : m_mutex(locker()), m_cond(cond()), m_array(NULL), m_size(0), m_max_size(max_size),
+      m_front(-1), m_back(-1), m_policy(policy), m_dropped(0), m_blocked(0)
 {
     if (max_size <= 0)
     {
@@ -119,7 +159,8 @@ inline bool block_queue<T>::pop_front(T &value)
         m_mutex.unlock();
         return false;
     }
-    value = m_array[m_front];
+    // m_front指向的是上一个出队的位置，队头元素在它的下一位
+    value = m_array[(m_front + 1) % m_max_size];
     m_mutex.unlock();
     return true;
 }
@@ -160,15 +201,41 @@ inline int block_queue<T>::get_max_size()
     return tmp;
 }
 
+template <class T>
+inline bool block_queue<T>::make_room()
+{
+    if (m_size < m_max_size)
+    {
+        return true;
+    }
+    if (m_policy == QUEUE_BLOCK)
+    {
+        m_blocked++;
+        while (m_size >= m_max_size && !m_is_close)
+        {
+            m_not_full.wait(m_mutex.get_mutex());
+        }
+        return !m_is_close;
+    }
+    m_dropped++;
+    if (m_policy == QUEUE_DROP_OLDEST)
+    {
+        // 挤掉队头最旧的元素
+        m_front = (m_front + 1) % m_max_size;
+        m_array[m_front] = T();
+        m_size--;
+        return true;
+    }
+    return false;
+}
+
 template <class T>
 inline bool block_queue<T>::push(const T &item)
 {
     m_mutex.lock();
-    if (m_size >= m_max_size)
+    if (m_is_close || !make_room())
     {
-        // 如果队列元素已满,则唤醒所有阻塞线程
         m_mutex.unlock();
-        m_cond.broadcast();
         return false;
     }
     m_back = (m_back + 1) % m_max_size;
@@ -176,7 +243,24 @@ inline bool block_queue<T>::push(const T &item)
     m_size++;
     m_mutex.unlock();
     m_cond.signal();
-    return false;
+    return true;
+}
+
+template <class T>
+inline bool block_queue<T>::push(T &&item)
+{
+    m_mutex.lock();
+    if (m_is_close || !make_room())
+    {
+        m_mutex.unlock();
+        return false;
+    }
+    m_back = (m_back + 1) % m_max_size;
+    m_array[m_back] = std::move(item); // 移动赋值，不拷贝元素内容
+    m_size++;
+    m_mutex.unlock();
+    m_cond.signal();
+    return true;
 }
 
 template <class T>
@@ -200,12 +284,60 @@ inline bool block_queue<T>::pop(T &item)
     }
     /* m_front,m_size都属于临界资源，读写时都需在上锁的状态下进行 */
     m_front = (m_front + 1) % m_max_size;
-    item = m_array[m_front]; // 赋值，每次数据出队也会发生一次拷贝
+    item = std::move(m_array[m_front]); // 移动出队，不拷贝元素内容
     m_size--;
     m_mutex.unlock();
+    m_not_full.signal();
     return true;
 }
 
+template <class T>
+inline bool block_queue<T>::pop_all(std::vector<T> &items)
+{
+    m_mutex.lock();
+    while (m_size <= 0)
+    {
+        if (m_is_close)
+        {
+            m_mutex.unlock();
+            return false;
+        }
+        if (!m_cond.wait(m_mutex.get_mutex()))
+        {
+            m_mutex.unlock();
+            return false;
+        }
+    }
+    while (m_size > 0)
+    {
+        m_front = (m_front + 1) % m_max_size;
+        items.push_back(std::move(m_array[m_front]));
+        m_size--;
+    }
+    m_mutex.unlock();
+    // 一次腾出了大量空位，唤醒所有等待的生产者
+    m_not_full.broadcast();
+    return true;
+}
+
+template <class T>
+inline long long block_queue<T>::get_dropped()
+{
+    m_mutex.lock();
+    long long tmp = m_dropped;
+    m_mutex.unlock();
+    return tmp;
+}
+
+template <class T>
+inline long long block_queue<T>::get_blocked()
+{
+    m_mutex.lock();
+    long long tmp = m_blocked;
+    m_mutex.unlock();
+    return tmp;
+}
+
 template <class T>
 inline void block_queue<T>::flush()
 {
@@ -219,6 +351,7 @@ inline void block_queue<T>::close()
     m_is_close = true;
     m_mutex.unlock();
     m_cond.broadcast();
+    m_not_full.broadcast();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include "deferred_log.h"
+#include <stdio.h>
+
+// 依次读取一条记录中的参数
+struct deferred_arg_reader
+{
+    const char *p;
+    int left;
+
+    // 没有参数可读(格式串与参数个数不符)时返回false
+    bool next(const deferred_arg_header **h, const char **data)
+    {
+        if (left <= 0)
+        {
+            return false;
+        }
+        *h = (const deferred_arg_header *)p;
+        *data = p + sizeof(deferred_arg_header);
+        if ((*h)->type == DEFERRED_STRING)
+        {
+            p = *data + deferred_align((*h)->len + 1);
+        }
+        else
+        {
+            p = *data + 8;
+        }
+        left--;
+        return true;
+    }
+};
+
+static long long arg_as_signed(const deferred_arg_header *h, const char *data)
+{
+    if (h->type == DEFERRED_DOUBLE)
+    {
+        double d;
+        memcpy(&d, data, 8);
+        return (long long)d;
+    }
+    if (h->type == DEFERRED_STRING)
+    {
+        return 0;
+    }
+    long long v;
+    memcpy(&v, data, 8);
+    return v;
+}
+
+static unsigned long long arg_as_unsigned(const deferred_arg_header *h, const char *data)
+{
+    long long v = arg_as_signed(h, data);
+    // 32位的有符号数按printf的行为截成32位再解释为无符号数，如%u打印-1得到4294967295
+    if (h->type == DEFERRED_INT32)
+    {
+        return (unsigned int)v;
+    }
+    return (unsigned long long)v;
+}
+
+static double arg_as_double(const deferred_arg_header *h, const char *data)
+{
+    if (h->type == DEFERRED_DOUBLE)
+    {
+        double d;
+        memcpy(&d, data, 8);
+        return d;
+    }
+    return (double)arg_as_signed(h, data);
+}
+
+int deferred_format(char *buf, int size, const deferred_record_header *record)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+    deferred_arg_reader reader;
+    reader.p = (const char *)(record + 1);
+    reader.left = record->nargs;
+
+    const char *f = record->format;
+    int pos = 0;
+    // 每段输出之后都检查是否已写满，写满后直接截断
+    while (*f != '\0' && pos < size - 1)
+    {
+        if (*f != '%')
+        {
+            buf[pos++] = *f++;
+            continue;
+        }
+        const char *spec_begin = f++;
+        if (*f == '%')
+        {
+            buf[pos++] = '%';
+            f++;
+            continue;
+        }
+
+        // 重新拼出一个去掉长度修饰、宽度精度已展开的转换说明，如"%-08.3" + "ll" + "d"
+        char spec[64];
+        int spec_len = 0;
+        spec[spec_len++] = '%';
+        while (*f != '\0' && strchr("-+ #0'", *f) != NULL && spec_len < 16)
+        {
+            spec[spec_len++] = *f++;
+        }
+        const deferred_arg_header *h = NULL;
+        const char *data = NULL;
+        bool missing = false;
+        // 宽度和精度：数字照抄，'*'取一个int参数
+        for (int part = 0; part < 2; part++)
+        {
+            if (part == 1)
+            {
+                if (*f != '.')
+                {
+                    break;
+                }
+                spec[spec_len++] = *f++;
+            }
+            if (*f == '*')
+            {
+                f++;
+                if (reader.next(&h, &data))
+                {
+                    spec_len += snprintf(spec + spec_len, 16, "%d", (int)arg_as_signed(h, data));
+                }
+                else
+                {
+                    missing = true;
+                }
+            }
+            while (*f >= '0' && *f <= '9' && spec_len < 48)
+            {
+                spec[spec_len++] = *f++;
+            }
+        }
+        // 参数的真实宽度已经记录在参数里，长度修饰只需跳过
+        while (*f != '\0' && strchr("hlLqjzt", *f) != NULL)
+        {
+            f++;
+        }
+        char conv = *f;
+        if (conv == '\0')
+        {
+            break;
+        }
+        f++;
+
+        if (conv == 'n')
+        {
+            // %n在日志里没有意义，只消耗参数
+            reader.next(&h, &data);
+            continue;
+        }
+        if (strchr("diouxXcfFeEgGaAsp", conv) == NULL)
+        {
+            // 不认识的转换说明原样输出
+            int n = f - spec_begin;
+            if (n > size - 1 - pos)
+            {
+                n = size - 1 - pos;
+            }
+            memcpy(buf + pos, spec_begin, n);
+            pos += n;
+            continue;
+        }
+        if (missing || !reader.next(&h, &data))
+        {
+            pos += snprintf(buf + pos, size - pos, "<missing>");
+            if (pos > size - 1)
+            {
+                pos = size - 1;
+            }
+            continue;
+        }
+
+        int n = 0;
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = conv;
+            spec[spec_len] = '\0';
+            n = snprintf(buf + pos, size - pos, spec, arg_as_signed(h, data));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = conv;
+            spec[spec_len] = '\0';
+            n = snprintf(buf + pos, size - pos, spec, arg_as_unsigned(h, data));
+            break;
+        case 'c':
+            spec[spec_len++] = conv;
+            spec[spec_len] = '\0';
+            n = snprintf(buf + pos, size - pos, spec, (int)arg_as_signed(h, data));
+            break;
+        case 's':
+            spec[spec_len++] = conv;
+            spec[spec_len] = '\0';
+            n = snprintf(buf + pos, size - pos, spec, h->type == DEFERRED_STRING ? data : "<?>");
+            break;
+        case 'p':
+            spec[spec_len++] = conv;
+            spec[spec_len] = '\0';
+            n = snprintf(buf + pos, size - pos, spec, (void *)(uintptr_t)arg_as_unsigned(h, data));
+            break;
+        default:
+            // 浮点数
+            spec[spec_len++] = conv;
+            spec[spec_len] = '\0';
+            n = snprintf(buf + pos, size - pos, spec, arg_as_double(h, data));
+            break;
+        }
+        // snprintf返回的是完整输出应有的长度，被截断时按实际写入的长度算
+        if (n > 0)
+        {
+            pos += n;
+        }
+        if (pos > size - 1)
+        {
+            pos = size - 1;
+        }
+    }
+    buf[pos] = '\0';
+    return pos;
+}
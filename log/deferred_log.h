@@ -0,0 +1,174 @@
+#ifndef DEFERRED_LOG_H
+#define DEFERRED_LOG_H
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <type_traits>
+
+/*
+    延迟格式化日志模式下的二进制日志记录
+
+    调用线程只把时间戳、格式串指针和原始参数值按下面的布局拷进自己的缓冲，
+    vsnprintf/localtime等格式化工作全部留给后台写线程。
+    格式串和__FILE__都是字符串字面量，生命周期贯穿整个程序，只记录指针；
+    作为参数传入的字符串则可能是临时的，必须连内容一起拷贝。
+
+    一条记录 = deferred_record_header + nargs个参数，参数 = deferred_arg_header + 数据，
+    数值参数的数据固定8字节，字符串参数的数据为内容+'\0'，整体按8字节对齐
+*/
+struct deferred_record_header
+{
+    // 整条记录(含头)的字节数
+    uint32_t size;
+    int32_t level;
+    int32_t line;
+    int32_t nargs;
+    struct timespec ts;
+    const char *file;
+    const char *format;
+};
+
+enum E_DEFERRED_ARG
+{
+    DEFERRED_INT32 = 0,
+    DEFERRED_INT64,
+    DEFERRED_UINT32,
+    DEFERRED_UINT64,
+    DEFERRED_DOUBLE,
+    DEFERRED_STRING,
+    DEFERRED_POINTER
+};
+
+struct deferred_arg_header
+{
+    uint32_t type;
+    // 字符串参数的长度(不含'\0')，数值参数不用
+    uint32_t len;
+};
+
+inline size_t deferred_align(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+/*
+    计算单个参数编码后的字节数，max_str是字符串参数最多保留的字节数
+*/
+inline size_t deferred_arg_size(size_t max_str, const char *s)
+{
+    size_t len = s == NULL ? 6 : strnlen(s, max_str);
+    return sizeof(deferred_arg_header) + deferred_align(len + 1);
+}
+
+inline size_t deferred_arg_size(size_t max_str, char *s)
+{
+    return deferred_arg_size(max_str, (const char *)s);
+}
+
+template <typename T>
+inline size_t deferred_arg_size(size_t, T)
+{
+    // 整数、浮点数、枚举和其他指针都固定占8字节
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+                  "deferred log only supports printf-compatible arguments");
+    return sizeof(deferred_arg_header) + 8;
+}
+
+inline size_t deferred_args_size(size_t)
+{
+    return 0;
+}
+
+template <typename T, typename... Args>
+inline size_t deferred_args_size(size_t max_str, T value, Args... rest)
+{
+    return deferred_arg_size(max_str, value) + deferred_args_size(max_str, rest...);
+}
+
+/*
+    把单个参数编码到p，返回下一个参数的写入位置
+*/
+inline char *deferred_encode_value(char *p, uint32_t type, const void *value)
+{
+    deferred_arg_header *h = (deferred_arg_header *)p;
+    h->type = type;
+    h->len = 0;
+    memcpy(p + sizeof(deferred_arg_header), value, 8);
+    return p + sizeof(deferred_arg_header) + 8;
+}
+
+inline char *deferred_encode_arg(char *p, size_t max_str, const char *s)
+{
+    if (s == NULL)
+    {
+        s = "(null)";
+    }
+    size_t len = strnlen(s, max_str);
+    deferred_arg_header *h = (deferred_arg_header *)p;
+    h->type = DEFERRED_STRING;
+    h->len = len;
+    p += sizeof(deferred_arg_header);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p + deferred_align(len + 1);
+}
+
+inline char *deferred_encode_arg(char *p, size_t max_str, char *s)
+{
+    return deferred_encode_arg(p, max_str, (const char *)s);
+}
+
+inline char *deferred_encode_arg(char *p, size_t, double value)
+{
+    return deferred_encode_value(p, DEFERRED_DOUBLE, &value);
+}
+
+inline char *deferred_encode_arg(char *p, size_t, float value)
+{
+    // 与可变参数一样，float提升为double
+    double d = value;
+    return deferred_encode_value(p, DEFERRED_DOUBLE, &d);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, char *>::type
+deferred_encode_arg(char *p, size_t, T value)
+{
+    // 保留参数原本的宽度和符号，后台按格式串的转换说明再解释，使%u/%x等与printf结果一致
+    if (std::is_enum<T>::value || std::is_signed<T>::value)
+    {
+        int64_t v = (int64_t)value;
+        return deferred_encode_value(p, sizeof(T) <= 4 ? DEFERRED_INT32 : DEFERRED_INT64, &v);
+    }
+    uint64_t v = (uint64_t)value;
+    return deferred_encode_value(p, sizeof(T) <= 4 ? DEFERRED_UINT32 : DEFERRED_UINT64, &v);
+}
+
+template <typename T>
+inline char *deferred_encode_arg(char *p, size_t, const T *value)
+{
+    // 非字符串的指针只记录地址，对应%p
+    uint64_t v = (uint64_t)(uintptr_t)value;
+    return deferred_encode_value(p, DEFERRED_POINTER, &v);
+}
+
+inline char *deferred_encode_args(char *p, size_t)
+{
+    return p;
+}
+
+template <typename T, typename... Args>
+inline char *deferred_encode_args(char *p, size_t max_str, T value, Args... rest)
+{
+    p = deferred_encode_arg(p, max_str, value);
+    return deferred_encode_args(p, max_str, rest...);
+}
+
+/*
+    由后台写线程调用：按printf的规则用记录中的参数展开格式串，写入buf
+    return(int):
+        写入的字节数(不含结尾的'\0')，超出size时截断
+*/
+int deferred_format(char *buf, int size, const deferred_record_header *record);
+
+#endif
@@ -1,12 +1,22 @@
 #include "log.h"
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <dirent.h>
 // 定义静态成员变量
 locker log::m_mutex;
 
+std::atomic<int> log::m_log_level(log::LEVEL_DEBUG);
+std::atomic<bool> log::m_console_trace(false);
+
 log *log::get_instance()
 {
-    m_mutex.lock();
+    /*
+        C++11起局部静态变量的初始化由编译器保证线程安全且只执行一次，
+        初始化完成后每次访问只是一次判断，不再需要加锁
+    */
     static log instance;
-    m_mutex.unlock();
     return &instance;
 }
 
@@ -28,12 +38,133 @@ void get_next_log_full_name(char *next_full_name, size_t size, char *full_name,
     }
 }
 
-bool log::init(int level, const char *file_name, int log_buf_size, int max_lines, int max_queue_size)
+time_t log::day_end(time_t now, struct tm *tm_now)
 {
+    localtime_r(&now, tm_now);
+    struct tm next = *tm_now;
+    next.tm_hour = 0;
+    next.tm_min = 0;
+    next.tm_sec = 0;
+    next.tm_mday += 1;
+    next.tm_isdst = -1;
+    return mktime(&next);
+}
+
+void log::today_log_name(char *buf, size_t size, const struct tm &tm_cur)
+{
+    snprintf(buf, size, "%s%d_%02d_%02d_%s", m_dir_name, tm_cur.tm_year + 1900,
+             tm_cur.tm_mon + 1, tm_cur.tm_mday, m_log_name);
+}
+
+int log::last_log_index(const char *log_base_name)
+{
+    // 编号为n的日志文件名是 "前缀_n.后缀"(没有后缀时是 "前缀_n")，见get_next_log_full_name
+    const char *base = strrchr(log_base_name, '/');
+    base = base == NULL ? log_base_name : base + 1;
+    const char *ext = strrchr(base, '.');
+    size_t pre_len = ext == NULL ? strlen(base) : (size_t)(ext - base);
+
+    DIR *dir = opendir(m_dir_name);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+    int last = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strncmp(name, base, pre_len) != 0 || name[pre_len] != '_')
+        {
+            continue;
+        }
+        char *num_end = NULL;
+        long n = strtol(name + pre_len + 1, &num_end, 10);
+        if (num_end == name + pre_len + 1)
+        {
+            continue;
+        }
+        // 编号之后必须恰好是原来的后缀(或原来的后缀+".gz"，即已压缩的归档)，排除其他同前缀的文件
+        const char *suffix = ext == NULL ? "" : ext;
+        size_t suffix_len = strlen(suffix);
+        if (strncmp(num_end, suffix, suffix_len) != 0 ||
+            (num_end[suffix_len] != '\0' && strcmp(num_end + suffix_len, ".gz") != 0))
+        {
+            continue;
+        }
+        // 归档的编号已经用过，新日志从它的下一个编号开始
+        long next = num_end[suffix_len] == '\0' ? n : n + 1;
+        if (next > last)
+        {
+            last = next;
+        }
+    }
+    closedir(dir);
+    return last;
+}
+
+bool log::open_log_file(const struct tm &tm_cur, int index)
+{
+    char log_full_name[256] = {0};
+    today_log_name(log_full_name, sizeof(log_full_name), tm_cur);
+    char next_log_full_name[256] = {0};
+    const char *name = log_full_name;
+    if (index > 0)
+    {
+        get_next_log_full_name(next_log_full_name, 255, log_full_name, index);
+        name = next_log_full_name;
+    }
+    FILE *fp = fopen(name, "a");
+    if (fp == NULL)
+    {
+        // 新文件打不开时继续写原来的文件，不丢日志
+        return false;
+    }
+    if (m_fp != NULL)
+    {
+        // 旧文件关闭时会把缓冲中的数据写出，之后缓冲才能交给新文件使用
+        struct timespec begin;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        fclose(m_fp);
+        m_fp = NULL;
+        if (m_unflushed_bytes > 0)
+        {
+            record_flush(begin);
+        }
+        // 旧文件不会再写入，交给归档线程压缩；submit只是入队，不会阻塞写文件的线程
+        if (m_archiver != NULL)
+        {
+            m_archiver->submit(m_log_full_name);
+        }
+    }
+    if (m_file_buf != NULL)
+    {
+        setvbuf(fp, m_file_buf, _IOFBF, m_file_buf_size);
+    }
+    // 追加模式打开，文件当前的大小就是已写入的字节数
+    struct stat st;
+    long long size = fstat(fileno(fp), &st) == 0 ? st.st_size : 0;
+    m_fp = fp;
+    strncpy(m_log_full_name, name, sizeof(m_log_full_name) - 1);
+    m_file_size = size;
+    m_file_count = index;
+    return true;
+}
+
+// 双缓冲模式下当前线程的缓冲，第一次写日志时创建
+static __thread thread_log_buffer *t_log_buffer = NULL;
+
+bool log::init(int level, const char *file_name, int log_buf_size, long long max_file_size, int max_queue_size, int mode)
+{
+    if (mode < 0)
+    {
+        // 未指定模式时沿用原来的约定：队列长度>0为异步，否则为同步
+        mode = max_queue_size > 0 ? ASYNC : SYNC;
+    }
     m_log_buf_size = log_buf_size;
-    m_max_lines = max_lines;
+    m_max_file_size = max_file_size;
     m_log_level = level;
-    m_count = 0;
+    m_file_size = 0;
     m_file_count = 0;
     /*
         生成日志文件，并打开
@@ -57,34 +188,26 @@ bool log::init(int level, const char *file_name, int log_buf_size, int max_lines
         };
 
     */
-    // 获取当前时间的tm结构体
-    struct tm *tm_cur = localtime(&cur.tv_sec);
-    m_today = tm_cur->tm_mday;
+    // 获取当前时间的tm结构体，并记下今天结束的时刻，之后跨天检查只需比较一次时间戳
+    struct tm tm_cur;
+    m_day_end = day_end(cur.tv_sec, &tm_cur);
 
-    // 日志文件创建的绝对路径/相对路径
-    char log_full_name[256] = {0};
     // 从后往前找到参数filename中第一个/的位置
     const char *p = strrchr(file_name, '/');
     if (p == NULL)
     {
         // 若输入的文件名中没有/，则代表输入的filename是相对路径
-        // 则log_full_name记录的也将是相对路径，日志文件名=当前时间+输入文件名
+        // 则日志文件记录的也将是相对路径，日志文件名=当前时间+输入文件名
         strcpy(m_log_name, file_name);
         strcpy(m_dir_name, "./");
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s",
-                 tm_cur->tm_year + 1900, tm_cur->tm_mon + 1,
-                 tm_cur->tm_mday, file_name);
     }
     else
     {
         // 若输入的文件名中有/,则表示输入的filename是绝对路径
-        // 则log_full_name记录的也将是绝对路径，
+        // 则日志文件记录的也将是绝对路径，
         // 日志文件名=输入文件名所在文件夹+当前时间+输入文件名
         strcpy(m_log_name, p + 1);                         // p+1代表/之后第一个字符
         strncpy(m_dir_name, file_name, p - file_name + 1); // p-file_name+1是文件所在文件夹的路径长度
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", m_dir_name,
-                 tm_cur->tm_year + 1900, tm_cur->tm_mon + 1,
-                 tm_cur->tm_mday, m_log_name);
     }
 
     // ******临界
@@ -94,59 +217,52 @@ bool log::init(int level, const char *file_name, int log_buf_size, int max_lines
     {
         file_flush();
         fclose(m_fp);
+        m_fp = NULL;
     }
-
-    m_fp = fopen(log_full_name, "a+");
-    if (m_fp == NULL)
+    /*
+        重启时不再逐行读取今天已有的日志来计算行数：扫描一次目录找到今天编号最大的日志文件，
+        用fstat取得它的字节数，写满了就从下一个编号开始。启动耗时与日志文件的大小无关
+    */
+    if (m_file_buf == NULL && m_flush_bytes > 0)
+    {
+        // 文件指针的缓冲比刷盘水位多出一行的长度，stdio不会自行刷新，何时落盘只由刷盘策略决定
+        m_file_buf_size = m_flush_bytes + m_log_buf_size;
+        m_file_buf = new char[m_file_buf_size];
+    }
+    if (m_archiver == NULL && m_archive_compress)
+    {
+        m_archiver = new log_archiver(m_dir_name, m_log_name, m_archive_compress,
+                                      m_archive_max_files, m_archive_max_bytes);
+        if (!m_archiver->start())
+        {
+            delete m_archiver;
+            m_archiver = NULL;
+        }
+    }
+    char log_base_name[256] = {0};
+    today_log_name(log_base_name, sizeof(log_base_name), tm_cur);
+    m_file_count = last_log_index(log_base_name);
+    if (!open_log_file(tm_cur, m_file_count))
     {
-        // 打开文件失败
+        m_mutex.unlock();
         return false;
     }
-    // 由于日志类是单例模式，因此所有成员指针指向的数据都应该在堆区上
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size); // 缓存初始化
-    // TODO:可以优化检查，以文件为单位检查而不是逐行检查
-    while (fgets(m_buf, m_log_buf_size, m_fp))
+    if (m_file_size >= m_max_file_size && !open_log_file(tm_cur, m_file_count + 1))
     {
-        m_count++;
+        m_mutex.unlock();
+        return false;
     }
-    if (m_count >= m_max_lines)
+    // 由于日志类是单例模式，因此所有成员指针指向的数据都应该在堆区上
+    if (m_buf == NULL)
     {
-        char next_log_full_name[256] = {0};
-        while (1)
-        {
-            m_file_count++;
-            get_next_log_full_name(next_log_full_name, 255, log_full_name, m_file_count);
-            fclose(m_fp);
-            // 打开文件，并继续检查
-            m_fp = fopen(next_log_full_name, "a+");
-            m_count = 0;
-
-            if (m_fp == NULL)
-            {
-                return false;
-            }
-            while (fgets(m_buf, m_log_buf_size, m_fp))
-            {
-                m_count++;
-            }
-            // 如果当前日志文件的记录也满了，则继续检查下一个文件
-            if ((m_count >= m_max_lines))
-            {
-                continue;
-            }
-            else
-            {
-                // 否则当前日志文件还可以继续写
-                break;
-            }
-        }
+        m_buf = new char[m_log_buf_size];
     }
     memset(m_buf, '\0', m_log_buf_size); // 缓存初始化
+    m_last_flush_ms = now_ms();
+    m_flush_deadline_ms.store(m_last_flush_ms + m_flush_interval_ms, std::memory_order_relaxed);
     m_mutex.unlock();
     //******出临界区
 
-    m_today = tm_cur->tm_mday;
     /*
         异步模式：设置阻塞队列的长度 > 0，
         同步模式: 应设置阻塞队列长度 = 0
@@ -159,12 +275,32 @@ bool log::init(int level, const char *file_name, int log_buf_size, int max_lines
     title += " | | | | | | (_) | |  |   <| |__| (_) | (_| |       \\o.0|\n";
     title += " |_| |_| |_|\\___/|_|  |_|\\_\\_____\\___/ \\__, |      =(___)=\n";
     title += "                                       |___/ \n";
-    if (max_queue_size > 0)
+    if (mode == BUFFERED || mode == DEFERRED)
+    {
+        if (m_async_thread == 0)
+        {
+            // 后台写线程一启动就会按m_mode选择工作函数，所以要先设置模式
+            m_mode = mode;
+            // 线程退出时由pthread_key的析构回调把它的缓冲交还给后台写线程
+            if (pthread_key_create(&m_buffer_key, retire_buffer) != 0 ||
+                pthread_create(&m_async_thread, NULL, work, NULL) != 0)
+            {
+                m_mode = SYNC;
+                return false;
+            }
+        }
+        const char *mode_name = m_mode == DEFERRED ? "延迟格式化" : "双缓冲";
+        printf("--日志%s模式开启,后台写线程tid:%ld\n", mode_name, m_async_thread);
+        LOG_INFO("%s", title.c_str());
+        LOG_DEBUG("--日志%s模式开启,后台写线程tid:%ld", mode_name, m_async_thread);
+    }
+    else if (mode == ASYNC && max_queue_size > 0)
     {
         if (m_async_thread == 0)
         {
             m_is_async = true;
-            m_log_queue = new block_queue<std::string>(max_queue_size);
+            m_mode = ASYNC;
+            m_log_queue = new block_queue<std::string>(max_queue_size, m_queue_policy);
             // 模仿线程池的构建，对这部分代码进行优化
             if (pthread_create(&m_async_thread, NULL, work, NULL) != 0)
             {
@@ -190,7 +326,7 @@ bool log::init(int level, const char *file_name, int log_buf_size, int max_lines
 
 void log::write_log(int level, const char *file, const int line, const char *format, ...)
 {
-    if (level < m_log_level)
+    if (level < m_log_level.load(std::memory_order_relaxed))
     {
         return;
     }
@@ -198,11 +334,27 @@ void log::write_log(int level, const char *file, const int line, const char *for
     struct timeval cur = {0, 0};
     // 使用getttimeofday可以获得微秒信息
     gettimeofday(&cur, NULL);
-    struct tm *tm_cur = localtime(&cur.tv_sec);
+    // localtime返回的是全局静态结构体，多线程下要用可重入的localtime_r
+    struct tm tm_cur;
+    localtime_r(&cur.tv_sec, &tm_cur);
     va_list args;
     va_start(args, format);
-    // 是否有必要特地使用string 来装载本次m_buf的内容？
-    std::string log_str;
+    if (m_mode == BUFFERED)
+    {
+        // 双缓冲模式：直接格式化进本线程的前台缓冲，不经过任何共享锁，也没有中间拷贝
+        // 行缓存大小超过每线程缓冲时按缓冲容量截断，否则begin_append永远等不到足够的空间
+        int line_size = m_log_buf_size < BUFFERED_CAPACITY ? m_log_buf_size : BUFFERED_CAPACITY;
+        thread_log_buffer *buf = local_buffer();
+        char *dst = buf->begin_append(line_size);
+        int size = format_line(dst, line_size, level, file, line, cur, tm_cur, format, args);
+        buf->commit(size);
+        va_end(args);
+        if (level >= LEVEL_ERROR)
+        {
+            request_flush();
+        }
+        return;
+    }
     /*
         此处临界区的必要性：对于日志类的行缓存必须保持互斥访问，
         这是因为当前日志类将处在多线程项目环境下，可能有多个线程
@@ -213,120 +365,258 @@ void log::write_log(int level, const char *file, const int line, const char *for
     */
     //******临界区
     m_mutex.lock();
-    char level_str[16] = {0};
+    int size = format_line(m_buf, m_log_buf_size, level, file, line, cur, tm_cur, format, args);
+    va_end(args);
+    // 写入日志文件或写入阻塞队列
+    if (m_is_async)
+    {
+        // 只有异步模式需要把行缓存拷贝成string交给队列，之后整条移动入队，不再拷贝
+        std::string log_str(m_buf, size);
+        m_mutex.unlock();
+        //******出临界区
+        // 异步模式下由异步线程写文件，也由它负责切换文件和刷盘
+        if (level >= LEVEL_ERROR)
+        {
+            m_flush_requested.store(true, std::memory_order_relaxed);
+        }
+        // 入队放在临界区之外：QUEUE_BLOCK策略下队列满时会在这里等待，
+        // 若还持有m_mutex，需要m_mutex才能写文件的异步线程就永远腾不出位置。
+        // 入队失败说明该行按策略被丢弃，计数由队列维护
+        m_log_queue->push(std::move(log_str));
+        return;
+    }
+    // 同步模式，则是当前进程直接从行缓存写入日志文件，需要上锁；
+    // 写入与切换文件在同一个临界区内完成，不会有别的线程在两者之间写入
+    fputs(m_buf, m_fp);
+    m_file_size += size;
+    m_unflushed_bytes += size;
+    check_rotate(cur.tv_sec);
+    maybe_flush(level >= LEVEL_ERROR);
+    m_mutex.unlock();
+    //******出临界区
+}
+
+int log::format_line(char *buf, int size, int level, const char *file, int line,
+                     const struct timeval &cur, const struct tm &tm_cur,
+                     const char *format, va_list args)
+{
+    const char *level_str = level_name(level);
+    // (时间+日志等级)前缀 格式化输入到buf缓存中
+    // snprintf成功返回写入缓存的字符总数，其中不包括结尾的null字符
+    int prefix_size =
+        snprintf(buf, 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld[%s]file:%s:%d: ",
+                 tm_cur.tm_year + 1900, tm_cur.tm_mon + 1,
+                 tm_cur.tm_mday, tm_cur.tm_hour, tm_cur.tm_min,
+                 tm_cur.tm_sec, cur.tv_usec, level_str, file, line);
+    if (prefix_size > 127)
+    {
+        prefix_size = 127;
+    }
+    // (可变参数)内容 可变参格式化输入到buf缓存中
+    int content_size =
+        vsnprintf(buf + prefix_size, size - prefix_size - 1, format, args);
+    // vsnprintf返回的是完整输出应有的长度，内容被截断时要按实际写入的长度算
+    if (content_size < 0)
+    {
+        content_size = 0;
+    }
+    else if (content_size > size - prefix_size - 2)
+    {
+        content_size = size - prefix_size - 2;
+    }
+    buf[prefix_size + content_size] = '\n';
+    buf[prefix_size + content_size + 1] = '\0';
+    return prefix_size + content_size + 1;
+}
+
+const char *log::level_name(int level)
+{
     switch (level)
     {
     case LEVEL_DEBUG:
-        strcpy(level_str, "DEBUG");
-        break;
+        return "DEBUG";
     case LEVEL_INFO:
-        strcpy(level_str, "INFO");
-        break;
+        return "INFO";
     case LEVEL_WARN:
-        strcpy(level_str, "WARN");
-        break;
+        return "WARN";
     case LEVEL_ERROR:
-        strcpy(level_str, "ERROR");
-        break;
+        return "ERROR";
     default:
-        strcpy(level_str, "UNKOWN");
-        break;
+        return "UNKOWN";
     }
-    // (时间+日志等级)前缀 格式化输入到m_buf缓存中
-    // snprintf成功返回写入缓存的字符总数，其中不包括结尾的null字符
-    int prefix_size =
-        snprintf(m_buf, 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld[%s]file:%s:%d: ",
-                 tm_cur->tm_year + 1900, tm_cur->tm_mon + 1,
-                 tm_cur->tm_mday, tm_cur->tm_hour, tm_cur->tm_min,
-                 tm_cur->tm_sec, cur.tv_usec, level_str, file, line);
-    // (可变参数)内容 可变参格式化输入到m_buf缓存中
-    int content_size =
-        vsnprintf(m_buf + prefix_size, m_log_buf_size - prefix_size - 2,
-                  format, args);
-    m_buf[prefix_size + content_size] = '\n';
-    m_buf[prefix_size + content_size + 1] = '\0';
-    // TODO:看到下面这行拷贝放弃使用sting类型的log_str,直接将m_buf作为字符串输入到日志中
-    log_str = m_buf; // 调用string容器的关于字符串的赋值函数，拷贝一次
-    // 写入日志文件或写入阻塞队列
+}
+
+void log::check_rotate(time_t now)
+{
+    if (now >= m_day_end)
+    {
+        // 服务器工作跨天了，则创建今天的日志，今天的文件编号从0开始
+        struct tm tm_cur;
+        m_day_end = day_end(now, &tm_cur);
+        open_log_file(tm_cur, 0);
+    }
+    else if (m_file_size >= m_max_file_size)
+    {
+        // 如果超过了最大字节数，则在基础日志全名之上加上当日的日志文件计数号
+        struct tm tm_cur;
+        localtime_r(&now, &tm_cur);
+        open_log_file(tm_cur, m_file_count + 1);
+    }
+}
+
+void log::file_flush()
+{
     if (m_is_async)
     {
-        m_log_queue->push(log_str);
+        m_log_queue->flush();
     }
-    else
+    else if (m_mode == BUFFERED || m_mode == DEFERRED)
     {
-        // 同步模式，则是当前进程写入日志文件，需要上锁
-        fputs(log_str.c_str(), m_fp);
+        // 双缓冲模式下由后台写线程负责落盘，这里只是催它尽快收一次缓冲
+        m_writer_signal.notify();
     }
+    m_mutex.lock();
+    maybe_flush(true);
     m_mutex.unlock();
-    //******出临界区
-    va_end(args);
+}
 
-    /*
-        TODO:这段逻辑有点小bug但不影响正确运行，
-        主要是因为输入一次的记录可能不止占一行导致的：
-        一个日志文件最多8000条日志，不止8000行字符
+void log::set_flush_policy(int interval_ms, long long bytes)
+{
+    m_flush_interval_ms = interval_ms > 0 ? interval_ms : DEFAULT_FLUSH_INTERVAL_MS;
+    m_flush_bytes = bytes > 0 ? bytes : DEFAULT_FLUSH_BYTES;
+}
 
-        两段临界区之间没有共享的临界量，应该不会有关联
-    */
-    //******临界区
-    m_mutex.lock();
-    // 新增一行记录，并检查是否要新开辟一个日志文件
-    m_count++;
-    if ((m_today != tm_cur->tm_mday) || (m_count >= m_max_lines))
-    {
-        char log_new_full_name[256] = {0};
-        char time_str[16] = {0};
-        // 格式化生成 用于插入新的日志文件名的时间字符串
-        snprintf(time_str, 16, "%d_%02d_%02d_", tm_cur->tm_year + 1900,
-                 tm_cur->tm_mon + 1, tm_cur->tm_mday);
-        if (m_today != tm_cur->tm_mday)
-        {
-            // 如果今天不是最近一次更新的日,即服务器工作跨天了，则创建今天的日志，更新m_today和m_count
-            snprintf(log_new_full_name, 255, "%s%s%s", m_dir_name, time_str, m_log_name);
-            m_today = tm_cur->tm_mday;
-            m_count = 0;
-            m_file_count = 1;
-        }
-        else
-        {
-            // 如果超过了最大行，则在基础日志全名之上加上当日的日志文件计数号
-            char log_full_name[256] = {0};
-            m_file_count++;
-            m_count = 0;
-            snprintf(log_full_name, 255, "%s%s%s", m_dir_name, time_str, m_log_name);
-            get_next_log_full_name(log_new_full_name, 255, log_full_name, m_file_count);
-        }
-        // 修改日志类维护的打开文件指针，需要上锁
-        fflush(m_fp);
-        fclose(m_fp);
-        m_fp = fopen(log_new_full_name, "a");
+void log::set_archive_policy(bool compress, int max_files, long long max_bytes)
+{
+    m_archive_compress = compress;
+    m_archive_max_files = max_files;
+    m_archive_max_bytes = max_bytes;
+}
+
+void log::set_queue_policy(int policy)
+{
+    m_queue_policy = policy;
+}
+
+long long log::get_dropped_lines()
+{
+    return m_log_queue ? m_log_queue->get_dropped() : 0;
+}
+
+long long log::get_blocked_pushes()
+{
+    return m_log_queue ? m_log_queue->get_blocked() : 0;
+}
+
+void log::flush_if_due()
+{
+    // 达到水位的刷盘已在写入时完成，这里只管间隔；主循环每轮都会调用，未到期时不抢写日志线程的锁
+    if (now_ms() < m_flush_deadline_ms.load(std::memory_order_relaxed))
+    {
+        return;
     }
+    m_mutex.lock();
+    maybe_flush(false);
     m_mutex.unlock();
 }
 
-void log::file_flush()
+int log::flush_timeout_ms()
 {
-    if (m_is_async)
+    long long deadline = m_flush_deadline_ms.load(std::memory_order_relaxed);
+    if (m_mode == BUFFERED || m_mode == DEFERRED || deadline == 0)
     {
-        m_log_queue->flush();
+        return -1;
     }
-    m_mutex.lock();
+    long long left = deadline - now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+void log::request_flush()
+{
+    m_flush_requested.store(true, std::memory_order_relaxed);
+    m_writer_signal.notify();
+}
+
+long long log::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void log::maybe_flush(bool force)
+{
+    long long now = now_ms();
+    if (!force && m_unflushed_bytes < m_flush_bytes && now - m_last_flush_ms < m_flush_interval_ms)
+    {
+        return;
+    }
+    m_last_flush_ms = now;
+    m_flush_deadline_ms.store(now + m_flush_interval_ms, std::memory_order_relaxed);
+    if (m_unflushed_bytes == 0 || m_fp == NULL)
+    {
+        return;
+    }
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
     fflush(m_fp);
+    record_flush(begin);
+}
+
+void log::record_flush(const struct timespec &begin)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long us = (end.tv_sec - begin.tv_sec) * 1000000LL + (end.tv_nsec - begin.tv_nsec) / 1000;
+    m_flush_count++;
+    m_flush_total_us += us;
+    if (us > m_flush_max_us)
+    {
+        m_flush_max_us = us;
+    }
+    m_unflushed_bytes = 0;
+}
+
+void log::report_flush_stats()
+{
+    // 先在锁内取出并清零，再在锁外写日志，同步模式写日志本身也要m_mutex
+    m_mutex.lock();
+    long long count = m_flush_count;
+    long long total_us = m_flush_total_us;
+    long long max_us = m_flush_max_us;
+    m_flush_count = 0;
+    m_flush_total_us = 0;
+    m_flush_max_us = 0;
     m_mutex.unlock();
+    LOG_INFO("--日志刷盘统计: %lld次, 平均%lldus, 最大%lldus", count,
+             count > 0 ? total_us / count : 0LL, max_us);
+    if (m_is_async)
+    {
+        LOG_INFO("--日志队列统计: 累计丢弃%lld行, 阻塞等待%lld次", get_dropped_lines(), get_blocked_pushes());
+    }
 }
 
 int log::get_log_level()
 {
-    return m_log_level;
+    return m_log_level.load(std::memory_order_relaxed);
 }
 
 void log::set_log_level(int level)
 {
-    m_log_level = level;
+    m_log_level.store(level, std::memory_order_relaxed);
 }
 
-log::log() : m_count(0), m_file_count(1), m_is_async(false),
-             m_log_queue(NULL), m_buf(NULL), m_async_thread(0)
+void log::set_console_trace(bool on)
+{
+    m_console_trace.store(on, std::memory_order_relaxed);
+}
+
+log::log() : m_fp(NULL), m_buf(NULL), m_file_size(0), m_file_count(0), m_is_async(false), m_mode(SYNC),
+             m_async_thread(0), m_log_queue(NULL), m_queue_policy(QUEUE_DROP_NEWEST), m_archive_compress(false),
+             m_archive_max_files(0), m_archive_max_bytes(0), m_archiver(NULL),
+             m_flush_interval_ms(DEFAULT_FLUSH_INTERVAL_MS), m_flush_bytes(DEFAULT_FLUSH_BYTES),
+             m_unflushed_bytes(0), m_last_flush_ms(0), m_flush_deadline_ms(0), m_flush_requested(false), m_file_buf(NULL), m_file_buf_size(0),
+             m_flush_count(0), m_flush_total_us(0), m_flush_max_us(0), m_prefix_sec(-1)
 {
     /*
         默认构造函数将使得日志记录为0，日志记录模式默认为同步,
@@ -334,64 +624,268 @@ log::log() : m_count(0), m_file_count(1), m_is_async(false),
         指针是否指向了实际存在的数据，如果有，则需要释放
         对于未提及的成员变量的初始化则全部交给无参定义
     */
+    m_log_full_name[0] = '\0';
 }
 
 log::~log()
 {
-    if (m_async_thread != 0)
+    if (m_async_thread != 0 && (m_mode == BUFFERED || m_mode == DEFERRED))
     {
-        m_mutex.lock();
-        while (m_log_queue && !m_log_queue->empty())
-        {
-            // 使得任务队列中的任务全部完成
-            m_log_queue->flush();
-        }
-        // 关闭队列将使得异步线程执行的函数结束
-        m_log_queue->close();
-        m_mutex.unlock();
+        // 通知后台写线程把所有线程缓冲中剩余的日志写完后退出
+        m_writer_signal.stop();
         pthread_join(m_async_thread, NULL);
-        // printf("--日志异步线程已回收,tid=%ld\n", m_async_thread);
     }
-    // 如果阻塞队列指针非空，代表存在一个new出来的阻塞队列，需要及时释放
-    if (!m_log_queue)
+    else if (m_async_thread != 0)
     {
-        delete m_log_queue;
-    }
-    // 如果日志缓存指针非空，代表在init过程中在堆区申请了日志缓存空间，需要及时释放
-    if (!m_buf)
-    {
-        delete[] m_buf;
+        /*
+            关闭队列：异步线程会先取完队列中剩余的日志写入文件，pop_all随后返回false使其退出。
+            这里不能持有m_mutex等待队列变空，异步线程写文件也需要m_mutex
+        */
+        m_log_queue->close();
+        pthread_join(m_async_thread, NULL);
+        // printf("--日志异步线程已回收,tid=%ld\n", m_async_thread);
     }
+    // 释放new出来的阻塞队列和日志缓存(delete空指针是安全的)
+    m_is_async = false;
+    delete m_log_queue;
+    m_log_queue = NULL;
+    delete[] m_buf;
+    m_buf = NULL;
     // 关闭对象打开的文件指针
     if (m_fp != NULL)
     {
         file_flush();
         m_mutex.lock();
         fclose(m_fp);
+        m_fp = NULL;
         m_mutex.unlock();
     }
+    // 文件指针关闭之后才能释放它使用的缓冲
+    delete[] m_file_buf;
+    // 等归档线程处理完已提交的文件再退出
+    delete m_archiver;
 }
 
 void *log::work(void *args)
 {
     // 线程的工作内容就是执行日志实例对象的异步写日志函数
-    log::get_instance()->async_write_log();
+    log *instance = log::get_instance();
+    if (instance->m_mode == BUFFERED || instance->m_mode == DEFERRED)
+    {
+        instance->buffered_write_log();
+    }
+    else
+    {
+        instance->async_write_log();
+    }
     return args;
 }
 
+thread_log_buffer *log::local_buffer()
+{
+    if (t_log_buffer == NULL)
+    {
+        // 每个线程只在第一次写日志时登记一次，之后都只访问自己的缓冲
+        // 缓冲积累到刷盘水位(最多半块)时提前唤醒后台写线程
+        int notify = m_flush_bytes < BUFFERED_CAPACITY / 2 ? (int)m_flush_bytes : BUFFERED_CAPACITY / 2;
+        t_log_buffer = new thread_log_buffer(BUFFERED_CAPACITY, notify, &m_writer_signal);
+        pthread_setspecific(m_buffer_key, t_log_buffer);
+        m_buffers_lock.lock();
+        m_thread_buffers.push_back(t_log_buffer);
+        m_buffers_lock.unlock();
+    }
+    return t_log_buffer;
+}
+
+void log::retire_buffer(void *buffer)
+{
+    ((thread_log_buffer *)buffer)->retire();
+}
+
+void log::buffered_write_log()
+{
+    while (true)
+    {
+        // 定时醒来收一次缓冲；有线程缓冲过半或写满时会被提前唤醒
+        bool stop = m_writer_signal.wait(m_flush_interval_ms);
+        m_flush_requested.store(false, std::memory_order_relaxed);
+        drain_thread_buffers();
+        if (stop)
+        {
+            break;
+        }
+    }
+}
+
+void log::drain_thread_buffers()
+{
+    // 登记表只在新线程第一次写日志时才会变化，拷贝一份后就不必持锁写文件
+    m_buffers_lock.lock();
+    std::vector<thread_log_buffer *> buffers(m_thread_buffers);
+    m_buffers_lock.unlock();
+
+    std::vector<struct iovec> iov;
+    std::vector<thread_log_buffer *> dead;
+    m_render_text.clear();
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        // 先判断是否退役再对调，保证退役线程的最后一批数据已经被换下来
+        bool retired = buffers[i]->retired();
+        char *data = NULL;
+        int len = 0;
+        buffers[i]->swap(&data, &len);
+        if (len > 0 && m_mode == DEFERRED)
+        {
+            // 二进制记录先格式化成文本，全部线程的文本拼在一起最后作为一块写入
+            render_deferred(data, len, m_render_text);
+        }
+        else if (len > 0)
+        {
+            struct iovec v;
+            v.iov_base = data;
+            v.iov_len = len;
+            iov.push_back(v);
+        }
+        else if (retired)
+        {
+            dead.push_back(buffers[i]);
+        }
+    }
+    if (!m_render_text.empty())
+    {
+        struct iovec v;
+        v.iov_base = &m_render_text[0];
+        v.iov_len = m_render_text.size();
+        iov.push_back(v);
+    }
+
+    if (!iov.empty())
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < iov.size(); i++)
+        {
+            bytes += iov[i].iov_len;
+        }
+        m_mutex.lock();
+        // 先把经FILE*写入的内容刷出去，再用writev把所有线程的缓冲一次写入，整个过程记为一次刷盘
+        struct timespec begin;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        fflush(m_fp);
+        int fd = fileno(m_fp);
+        for (size_t i = 0; i < iov.size(); i += IOV_MAX)
+        {
+            int cnt = (iov.size() - i) < IOV_MAX ? (iov.size() - i) : IOV_MAX;
+            writev_all(fd, &iov[i], cnt);
+        }
+        m_unflushed_bytes += bytes;
+        record_flush(begin);
+        m_file_size += bytes;
+        check_rotate(time(NULL));
+        m_mutex.unlock();
+    }
+
+    if (!dead.empty())
+    {
+        m_buffers_lock.lock();
+        for (size_t i = 0; i < dead.size(); i++)
+        {
+            for (size_t j = 0; j < m_thread_buffers.size(); j++)
+            {
+                if (m_thread_buffers[j] == dead[i])
+                {
+                    m_thread_buffers.erase(m_thread_buffers.begin() + j);
+                    break;
+                }
+            }
+            delete dead[i];
+        }
+        m_buffers_lock.unlock();
+    }
+}
+
+void log::render_deferred(const char *data, int len, std::string &out)
+{
+    const char *end = data + len;
+    while (data < end)
+    {
+        const deferred_record_header *record = (const deferred_record_header *)data;
+        if (record->ts.tv_sec != m_prefix_sec)
+        {
+            // 每秒只做一次本地时间换算，同一秒内的日志共用日期前缀
+            struct tm tm_cur;
+            localtime_r(&record->ts.tv_sec, &tm_cur);
+            snprintf(m_date_prefix, sizeof(m_date_prefix), "%d-%02d-%02d %02d:%02d:%02d",
+                     tm_cur.tm_year + 1900, tm_cur.tm_mon + 1, tm_cur.tm_mday,
+                     tm_cur.tm_hour, tm_cur.tm_min, tm_cur.tm_sec);
+            m_prefix_sec = record->ts.tv_sec;
+        }
+        // 与format_line的格式保持一致：前缀 + 内容 + 换行
+        size_t start = out.size();
+        out.resize(start + m_log_buf_size);
+        char *line_buf = &out[start];
+        int prefix_size =
+            snprintf(line_buf, 128, "%s.%06ld[%s]file:%s:%d: ", m_date_prefix,
+                     record->ts.tv_nsec / 1000, level_name(record->level), record->file, record->line);
+        if (prefix_size > 127)
+        {
+            prefix_size = 127;
+        }
+        int content_size = deferred_format(line_buf + prefix_size, m_log_buf_size - prefix_size - 1, record);
+        line_buf[prefix_size + content_size] = '\n';
+        out.resize(start + prefix_size + content_size + 1);
+        data += record->size;
+    }
+}
+
+void log::writev_all(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0)
+    {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        // 处理部分写入：跳过已经写完的块，调整写了一半的块
+        while (cnt > 0 && n >= (ssize_t)iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
 void log::async_write_log()
 {
-    std::string single_log;
-    while (m_log_queue->pop(single_log))
+    std::vector<std::string> batch;
+    while (m_log_queue->pop_all(batch))
     {
         /*
-            pop为false的条件只有条件变量本身出了问题，
+            pop_all为false的条件是队列已关闭并取空，或者条件变量本身出了问题，
             一般都将不断从阻塞队列取记录，如果队列空了，
-            则导致线程阻塞，直到有新的内容被push，从而唤醒阻塞
+            则导致线程阻塞，直到有新的内容被push，从而唤醒阻塞。
+            每次唤醒取走队列中的全部日志，整批写入只加一次锁
         */
         m_mutex.lock();
-        fputs(single_log.c_str(), m_fp);
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            fputs(batch[i].c_str(), m_fp);
+            m_file_size += batch[i].size();
+            m_unflushed_bytes += batch[i].size();
+            check_rotate(time(NULL));
+        }
+        // 攒到水位、间隔到期或遇到ERROR时再刷
+        maybe_flush(m_flush_requested.exchange(false, std::memory_order_relaxed));
         m_mutex.unlock();
+        batch.clear();
         //  printf("--tid:%ld log async-thread finish 1 job.\n", pthread_self());
     }
 }
@@ -7,14 +7,29 @@
 #include <stdarg.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <vector>
+#include <atomic>
 #include "block_queue.hpp"
+#include "thread_log_buffer.h"
+#include "deferred_log.h"
+#include "log_archiver.h"
 class log
 {
 public:
+    /*
+        SYNC:     调用线程加锁直接写文件
+        ASYNC:    调用线程加锁格式化后送入阻塞队列，由异步线程写文件
+        BUFFERED: 每个调用线程格式化进自己的双缓冲，由后台写线程定时对调缓冲并批量写文件
+        DEFERRED: 同BUFFERED，但调用线程只往双缓冲里拷贝时间戳、格式串指针和原始参数，
+                  格式化全部由后台写线程完成
+    */
     enum E_LOG_MODE
     {
         SYNC = 0,
-        ASYNC
+        ASYNC,
+        BUFFERED,
+        DEFERRED
     };
 
     enum E_LOG_LEVEL
@@ -25,21 +40,26 @@ public:
         LEVEL_ERROR
     };
     /*
-        当前项目未指定c++版本，因此默认是旧版本c++
-        使用加锁访问局部静态变量来使用懒汉模式
+        懒汉模式的单例，依赖C++11局部静态变量的线程安全初始化，访问无锁
     */
     static log *get_instance();
+    // 运行时等级判断，由日志宏在求值任何参数之前内联调用
+    static bool is_enabled(int level)
+    {
+        return level >= m_log_level.load(std::memory_order_relaxed);
+    }
     /*
         param:
             file_name: 日志拟设路径（绝对/相对均可）
             log_buf_size: 日志缓冲区大小
-            max_lines: 日志最大行数
+            max_file_size: 单个日志文件的最大字节数，写满后切换到当天的下一个编号
             max_queue_size: 协助日志记录的任务阻塞队列最大长度
+            mode: 日志模式E_LOG_MODE，缺省时按max_queue_size推断(>0异步，否则同步)
         return(bool):
             ture: 初始化成功
             false: 初始化失败
     */
-    bool init(int level, const char *file_name, int log_buf_size, int max_lines, int max_queue_size);
+    bool init(int level, const char *file_name, int log_buf_size, long long max_file_size, int max_queue_size, int mode = -1);
     /*
         以日志等级 + 格式化输入 生成日志行
         当以同步模式调用该函数，当前程序会直接将日志行输入到日志文件中
@@ -52,11 +72,66 @@ public:
             line: 调用该函数记录来自的文件名代码的具体代码所在行号(由宏生成)
             format,...: 格式化输入参数
     */
-    void write_log(int level, const char *file, const int line, const char *format, ...);
-    // 将文件指针所带的缓冲强制写入到文件中，可以在调用若干次记录函数后调用一次提高效率
+    void write_log(int level, const char *file, const int line, const char *format, ...)
+        __attribute__((format(printf, 5, 6)));
+    /*
+        日志宏的入口：延迟格式化模式下只记录二进制参数，其余模式转交write_log。
+        参数按值接收，数组会退化为指针，字符串参数会连内容一起拷贝
+    */
+    template <typename... Args>
+    void log_line(int level, const char *file, const int line, const char *format, Args... args)
+    {
+        if (m_mode == DEFERRED)
+        {
+            write_deferred(level, file, line, format, args...);
+        }
+        else
+        {
+            // 格式串已在日志宏的调用处检查过，这里只是转发
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+            write_log(level, file, line, format, args...);
+#pragma GCC diagnostic pop
+        }
+    }
+    // 将文件指针所带的缓冲强制写入到文件中，只应在退出等确实需要立刻落盘的时候调用，平时交给刷盘策略
     void file_flush();
-    void set_log_level(int level);
-    int get_log_level();
+    /*
+        设置刷盘策略(组提交)，需在init之前调用：
+        距上次刷盘超过interval_ms毫秒，或未刷盘的数据达到bytes字节时刷一次；
+        ERROR日志会立即触发一次刷盘。
+        同步/异步模式下刷的是文件指针的用户态缓冲(其大小设为bytes)，
+        双缓冲/延迟格式化模式下则是后台写线程收缓冲并写入文件的周期和水位
+    */
+    void set_flush_policy(int interval_ms, long long bytes);
+    /*
+        设置归档策略，需在init之前调用：切换下来的日志文件由后台低优先级线程gzip压缩，
+        并且只保留最新的max_files个/总计max_bytes字节的归档(0为不限制)
+    */
+    void set_archive_policy(bool compress, int max_files, long long max_bytes);
+    // 设置异步模式下阻塞队列满时的处理策略E_QUEUE_POLICY，需在init之前调用，默认丢弃新日志
+    void set_queue_policy(int policy);
+    // 异步模式下因队列满被丢弃的日志行数、写日志线程因队列满而阻塞的次数，非异步模式为0
+    long long get_dropped_lines();
+    long long get_blocked_pushes();
+    // 距上次刷盘已超过间隔时刷一次，供主循环定时调用，避免空闲时日志长期滞留在缓冲中
+    void flush_if_due();
+    /*
+        主循环最多还能睡多久(毫秒)就该调用flush_if_due，用作epoll_wait等的超时；
+        双缓冲模式由后台写线程定时落盘，未初始化时也没有要刷的文件，均返回-1
+    */
+    int flush_timeout_ms();
+    // 以INFO日志输出刷盘次数、平均及最大耗时(异步模式附带队列丢弃数)，并清零刷盘统计
+    void report_flush_stats();
+    static void set_log_level(int level);
+    static int get_log_level();
+    // 控制台跟踪输出的开关，默认关闭，见CONSOLE_TRACE
+    static void set_console_trace(bool on);
+    static bool console_trace()
+    {
+        return m_console_trace.load(std::memory_order_relaxed);
+    }
 
 private:
     log();
@@ -72,8 +147,78 @@ private:
         异步写的内容已经存放在阻塞队列中，所以无需像同步写函数那样要接收内容
     */
     void async_write_log();
+    // 按统一格式生成一行日志(含结尾换行)到buf中，返回写入的字节数(不含结尾的'\0')
+    int format_line(char *buf, int size, int level, const char *file, int line,
+                    const struct timeval &cur, const struct tm &tm_cur,
+                    const char *format, va_list args);
+    // 按刷盘策略决定是否刷新文件指针的缓冲，force为true时无条件刷新，调用者需持有m_mutex
+    void maybe_flush(bool force);
+    // 记录一次刷盘的耗时，调用者需持有m_mutex
+    void record_flush(const struct timespec &begin);
+    static long long now_ms();
+    // 检查是否跨天或超过最大字节数，需要时切换到新的日志文件，调用者需持有m_mutex
+    void check_rotate(time_t now);
+    // 返回now所在这一天结束(次日零点)的时间戳，并把now的本地时间存入tm_now
+    static time_t day_end(time_t now, struct tm *tm_now);
+    // 生成tm_cur这一天编号为0的日志文件全名
+    void today_log_name(char *buf, size_t size, const struct tm &tm_cur);
+    // 扫描日志目录，返回今天已有的日志文件的最大编号，没有编号文件时为0
+    int last_log_index(const char *log_base_name);
+    // 打开tm_cur这一天编号为index的日志文件作为当前文件，失败时保留原文件，调用者需持有m_mutex
+    bool open_log_file(const struct tm &tm_cur, int index);
+
+    // 双缓冲模式：取得当前线程的日志缓冲，第一次调用时创建并登记
+    thread_log_buffer *local_buffer();
+    // 双缓冲模式：线程退出时pthread_key的析构回调
+    static void retire_buffer(void *buffer);
+    // 双缓冲模式：后台写线程的主循环
+    void buffered_write_log();
+    // 双缓冲模式：对调所有线程的缓冲，并把换下来的数据一次性写入文件
+    void drain_thread_buffers();
+    static void writev_all(int fd, struct iovec *iov, int cnt);
+
+    // 延迟格式化模式：把一条日志的二进制记录追加到本线程的缓冲
+    template <typename... Args>
+    void write_deferred(int level, const char *file, const int line, const char *format, Args... args)
+    {
+        size_t size = sizeof(deferred_record_header) + deferred_args_size(m_log_buf_size, args...);
+        if (size > (size_t)BUFFERED_CAPACITY)
+        {
+            // 单条记录超过整块缓冲(参数极多的长字符串)，无法写入，只能丢弃
+            return;
+        }
+        thread_log_buffer *buf = local_buffer();
+        char *dst = buf->begin_append(size);
+        deferred_record_header *record = (deferred_record_header *)dst;
+        // 粗粒度时钟走vDSO且不需要换算本地时间，本地时间由后台写线程按秒缓存
+        clock_gettime(CLOCK_REALTIME_COARSE, &record->ts);
+        record->size = size;
+        record->level = level;
+        record->line = line;
+        record->nargs = sizeof...(Args);
+        record->file = file;
+        record->format = format;
+        deferred_encode_args(dst + sizeof(deferred_record_header), m_log_buf_size, args...);
+        buf->commit(size);
+        if (level >= LEVEL_ERROR)
+        {
+            request_flush();
+        }
+    }
+    // ERROR日志：请求后台线程尽快把日志落盘
+    void request_flush();
+    // 延迟格式化模式：由后台写线程把一块缓冲中的二进制记录格式化为文本追加到out
+    void render_deferred(const char *data, int len, std::string &out);
+    // 日志等级的名字
+    static const char *level_name(int level);
 
 private:
+    // 双缓冲模式下每个线程每块缓冲的大小
+    static const int BUFFERED_CAPACITY = 64 * 1024;
+    // 刷盘策略的默认值：每100ms或每64KB刷一次
+    static const int DEFAULT_FLUSH_INTERVAL_MS = 100;
+    static const int DEFAULT_FLUSH_BYTES = 64 * 1024;
+
     // 路径名
     char m_dir_name[128];
     // 日志文件名
@@ -84,31 +229,124 @@ private:
     int m_log_buf_size;
     // 临界资源：日志一行的缓存区
     char *m_buf;
-    // 日志的最大行数
-    int m_max_lines;
+    // 单个日志文件的最大字节数
+    long long m_max_file_size;
     // 日志的阻塞队列的最大长度
     int m_max_queue_size;
-    // 临界资源：当前日志文件的行数
-    long long m_count;
+    // 临界资源：当前日志文件的字节数
+    long long m_file_size;
     // 临界资源：当天的日志文件计数
     int m_file_count;
     // 日志的记录模式（同步false/异步true）
     bool m_is_async;
-    // 临界资源：日志类最近一次更新的当天(montn-day)
-    int m_today;
-    // 日志记录等级，默认为最低级DEBUG级
-    int m_log_level;
+    // 日志模式E_LOG_MODE
+    int m_mode;
+    // 临界资源：当前日志文件所属的这一天结束的时间戳
+    time_t m_day_end;
+    // 日志记录等级，默认为最低级DEBUG级；所有线程在宏里读它，故为原子变量
+    static std::atomic<int> m_log_level;
+    // 是否向控制台输出跟踪信息
+    static std::atomic<bool> m_console_trace;
     // 异步线程号
     pthread_t m_async_thread;
     // 阻塞任务队列，一个任务即为一个string，表示一行记录
     block_queue<std::string> *m_log_queue;
+    // 阻塞队列满时的处理策略
+    int m_queue_policy;
+    // 归档策略及归档线程，未开启归档时为NULL
+    bool m_archive_compress;
+    int m_archive_max_files;
+    long long m_archive_max_bytes;
+    log_archiver *m_archiver;
+    // 临界资源：当前日志文件的全名，切换后交给归档线程
+    char m_log_full_name[256];
     // 多线程访问单例模式上锁
     static locker m_mutex;
+
+    // 双缓冲模式：所有已登记的线程缓冲，受m_buffers_lock保护
+    std::vector<thread_log_buffer *> m_thread_buffers;
+    locker m_buffers_lock;
+    // 双缓冲模式：线程退出时用于退役其缓冲
+    pthread_key_t m_buffer_key;
+    // 双缓冲模式：后台写线程的唤醒信号
+    writer_signal m_writer_signal;
+
+    // 刷盘策略：刷盘间隔、水位，临界资源：未刷盘的字节数及上次刷盘的时刻
+    int m_flush_interval_ms;
+    long long m_flush_bytes;
+    long long m_unflushed_bytes;
+    long long m_last_flush_ms;
+    // 下一次按间隔刷盘的时刻，flush_if_due先不加锁地比较它，未到期就不碰m_mutex
+    std::atomic<long long> m_flush_deadline_ms;
+    // ERROR日志请求尽快刷盘，由写文件的线程检查并清除
+    std::atomic<bool> m_flush_requested;
+    // 文件指针的用户态缓冲，比刷盘水位略大
+    char *m_file_buf;
+    long long m_file_buf_size;
+    // 临界资源：刷盘统计，次数、总耗时、最大耗时(微秒)
+    long long m_flush_count;
+    long long m_flush_total_us;
+    long long m_flush_max_us;
+
+    // 延迟格式化模式：后台写线程缓存的"年-月-日 时:分:秒"前缀及其对应的秒，每秒只调用一次localtime_r
+    time_t m_prefix_sec;
+    // 各字段按int的最大宽度算最长72字节，留足空间以免截断
+    char m_date_prefix[80];
+    // 延迟格式化模式：后台写线程格式化出的文本，复用以免每次重新分配
+    std::string m_render_text;
 };
 
-#define LOG_DEBUG(format, ...) log::get_instance()->write_log(log::LEVEL_DEBUG, __FILE__, __LINE__, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...) log::get_instance()->write_log(log::LEVEL_INFO, __FILE__, __LINE__, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...) log::get_instance()->write_log(log::LEVEL_WARN, __FILE__, __LINE__, format, ##__VA_ARGS__)
-#define LOG_ERROR(format, ...) log::get_instance()->write_log(log::LEVEL_ERROR, __FILE__, __LINE__, format, ##__VA_ARGS__)
+/*
+    编译期日志等级下限：低于LOG_COMPILE_LEVEL的日志语句在编译时就被整体消除，
+    参数也不会被求值(如生产构建使用 -DLOG_COMPILE_LEVEL=1 去掉所有DEBUG日志)。
+    数值与E_LOG_LEVEL一致：0 DEBUG, 1 INFO, 2 WARN, 3 ERROR
+*/
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
+// 运行时等级不够时，连参数都不求值，也不会访问单例；
+// log_line是模板，编译器不检查它的格式串，所以在if(false)里再以write_log的形式调用一次，借它的format属性做检查
+#define LOG_WRITE(level, format, ...)                                                     \
+    do                                                                                    \
+    {                                                                                     \
+        if (false)                                                                        \
+            log::get_instance()->write_log(level, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+        if (log::is_enabled(level))                                                       \
+            log::get_instance()->log_line(level, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+    } while (0)
+
+// 被编译期消除的日志语句：保留在if(false)里只为了继续做格式检查(见write_log的format属性)、避免未使用变量告警
+#define LOG_DISCARD(level, format, ...)                                                   \
+    do                                                                                    \
+    {                                                                                     \
+        if (false)                                                                        \
+            log::get_instance()->write_log(level, __FILE__, __LINE__, format, ##__VA_ARGS__); \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= 0
+#define LOG_DEBUG(format, ...) LOG_WRITE(log::LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) LOG_DISCARD(log::LEVEL_DEBUG, format, ##__VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL <= 1
+#define LOG_INFO(format, ...) LOG_WRITE(log::LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) LOG_DISCARD(log::LEVEL_INFO, format, ##__VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL <= 2
+#define LOG_WARN(format, ...) LOG_WRITE(log::LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) LOG_DISCARD(log::LEVEL_WARN, format, ##__VA_ARGS__)
+#endif
+#define LOG_ERROR(format, ...) LOG_WRITE(log::LEVEL_ERROR, format, ##__VA_ARGS__)
+
+// 控制台跟踪：只在打开调试开关时输出到终端，平时不在事件循环上做同步的终端I/O
+#define CONSOLE_TRACE(format, ...)                \
+    do                                            \
+    {                                             \
+        if (log::console_trace())                 \
+            printf(format, ##__VA_ARGS__);        \
+    } while (0)
 
 #endif
\ No newline at end of file
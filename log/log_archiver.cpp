@@ -0,0 +1,250 @@
+#include "log_archiver.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <vector>
+#include <algorithm>
+#ifdef LOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// linux/ioprio.h并非所有发行版都提供，这里只用到其中几个常量
+#define ARCHIVER_IOPRIO_WHO_PROCESS 1
+#define ARCHIVER_IOPRIO_CLASS_IDLE 3
+#define ARCHIVER_IOPRIO_CLASS_SHIFT 13
+
+// 每次读取/压缩的块大小
+static const int ARCHIVE_CHUNK = 64 * 1024;
+
+log_archiver::log_archiver(const char *dir, const char *log_name, bool compress, int max_files, long long max_bytes)
+    : m_dir(dir), m_compress(compress && compression_available()), m_max_files(max_files),
+      m_max_bytes(max_bytes), m_thread(0), m_stop(false)
+{
+    // 归档文件名形如 2026_10_19_ServerLog_3.log.gz，用"_"+不带后缀的日志名识别
+    const char *ext = strrchr(log_name, '.');
+    m_stem = ext == NULL ? std::string(log_name) : std::string(log_name, ext - log_name);
+}
+
+log_archiver::~log_archiver()
+{
+    stop();
+}
+
+bool log_archiver::compression_available()
+{
+#ifdef LOG_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool log_archiver::start()
+{
+    if (m_thread != 0)
+    {
+        return true;
+    }
+    m_stop = false;
+    if (pthread_create(&m_thread, NULL, work, this) != 0)
+    {
+        m_thread = 0;
+        return false;
+    }
+    return true;
+}
+
+void log_archiver::stop()
+{
+    if (m_thread == 0)
+    {
+        return;
+    }
+    m_lock.lock();
+    m_stop = true;
+    m_lock.unlock();
+    m_cond.signal();
+    pthread_join(m_thread, NULL);
+    m_thread = 0;
+}
+
+void log_archiver::submit(const std::string &path)
+{
+    m_lock.lock();
+    m_pending.push_back(path);
+    m_lock.unlock();
+    m_cond.signal();
+}
+
+void *log_archiver::work(void *arg)
+{
+    // 只调低本线程的优先级：Linux下setpriority和ioprio_set对线程id生效
+    pid_t tid = syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, ARCHIVER_IOPRIO_WHO_PROCESS, tid,
+            ARCHIVER_IOPRIO_CLASS_IDLE << ARCHIVER_IOPRIO_CLASS_SHIFT);
+    ((log_archiver *)arg)->run();
+    return NULL;
+}
+
+void log_archiver::run()
+{
+    // 启动时先按上限清理一次以前留下的归档
+    enforce_retention();
+    while (true)
+    {
+        m_lock.lock();
+        while (m_pending.empty() && !m_stop)
+        {
+            m_cond.wait(m_lock.get_mutex());
+        }
+        // 退出前把已提交的文件处理完
+        if (m_pending.empty())
+        {
+            m_lock.unlock();
+            break;
+        }
+        std::string path = m_pending.front();
+        m_pending.pop_front();
+        m_lock.unlock();
+
+        archive(path);
+        enforce_retention();
+    }
+}
+
+std::string log_archiver::archive(const std::string &path)
+{
+    if (!m_compress)
+    {
+        return path;
+    }
+#ifdef LOG_HAVE_ZLIB
+    int in = open(path.c_str(), O_RDONLY);
+    if (in < 0)
+    {
+        return path;
+    }
+    // 先写到临时文件，压缩完整后再改名，中途退出不会留下残缺的.gz
+    std::string gz_path = path + ".gz";
+    std::string tmp_path = gz_path + ".tmp";
+    gzFile out = gzopen(tmp_path.c_str(), "wb6");
+    if (out == NULL)
+    {
+        close(in);
+        return path;
+    }
+    gzbuffer(out, ARCHIVE_CHUNK);
+    std::vector<char> buf(ARCHIVE_CHUNK);
+    bool ok = true;
+    off_t done = 0;
+    while (true)
+    {
+        ssize_t n = read(in, &buf[0], buf.size());
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+        if (gzwrite(out, &buf[0], n) != n)
+        {
+            ok = false;
+            break;
+        }
+        // 读过的部分不会再用到，及时让内核丢掉这些页缓存，不挤占服务器的缓存
+        posix_fadvise(in, done, n, POSIX_FADV_DONTNEED);
+        done += n;
+    }
+    close(in);
+    if (gzclose(out) != Z_OK)
+    {
+        ok = false;
+    }
+    if (!ok || rename(tmp_path.c_str(), gz_path.c_str()) != 0)
+    {
+        unlink(tmp_path.c_str());
+        return path;
+    }
+    unlink(path.c_str());
+    return gz_path;
+#else
+    return path;
+#endif
+}
+
+bool log_archiver::is_archive(const char *name)
+{
+    size_t len = strlen(name);
+    if (len < 3 || strcmp(name + len - 3, ".gz") != 0)
+    {
+        return false;
+    }
+    std::string key = "_" + m_stem;
+    return strstr(name, key.c_str()) != NULL;
+}
+
+void log_archiver::enforce_retention()
+{
+    if (m_max_files <= 0 && m_max_bytes <= 0)
+    {
+        return;
+    }
+    /*
+        只有压缩后的归档(.gz)才参与清理，正在写的日志文件永远不会是.gz，
+        不压缩时无法区分已切换下来的文件和正在写的文件，因此不做清理
+    */
+    DIR *dir = opendir(m_dir.c_str());
+    if (dir == NULL)
+    {
+        return;
+    }
+    // (修改时间(纳秒), 文件名, 字节数)；同一秒内会切换出多个文件，只按秒排序时会按文件名误删较新的编号
+    std::vector<std::pair<long long, std::pair<std::string, long long> > > files;
+    long long total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (!is_archive(entry->d_name))
+        {
+            continue;
+        }
+        std::string path = m_dir + entry->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        long long mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        files.push_back(std::make_pair(mtime_ns, std::make_pair(path, (long long)st.st_size)));
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    // 从最旧的归档开始删除，直到数量和总字节数都在上限之内
+    std::sort(files.begin(), files.end());
+    size_t count = files.size();
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        bool over_count = m_max_files > 0 && count > (size_t)m_max_files;
+        bool over_bytes = m_max_bytes > 0 && total > m_max_bytes;
+        if (!over_count && !over_bytes)
+        {
+            break;
+        }
+        if (unlink(files[i].second.first.c_str()) == 0)
+        {
+            count--;
+            total -= files[i].second.second;
+        }
+    }
+}
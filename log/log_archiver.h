@@ -0,0 +1,64 @@
+#ifndef LOG_ARCHIVER_H
+#define LOG_ARCHIVER_H
+#include <pthread.h>
+#include <string>
+#include <deque>
+#include "../thread_pool/locker.h"
+
+/*
+    日志归档：在独立的低优先级线程中处理切换下来的日志文件
+
+    日志类每切换一次文件就把旧文件名交给submit，submit只在短暂持锁下入队，
+    不会阻塞写日志的线程。归档线程把文件gzip压缩为"原文件名.gz"后删除原文件，
+    再按文件数/总字节数上限从最旧的开始删除.gz归档(编译时没有zlib则什么都不做)。
+    归档线程的CPU优先级和I/O优先级都调到最低(nice 19、IOPRIO_CLASS_IDLE)，
+    只在磁盘空闲时工作，不与服务器自身的I/O争抢
+*/
+class log_archiver
+{
+public:
+    /*
+        param:
+            dir: 日志所在目录，以'/'结尾
+            log_name: 日志基础文件名(如ServerLog.log)，用于在目录中识别本日志的归档
+            compress: 是否压缩
+            max_files: 最多保留的归档文件数，0为不限制
+            max_bytes: 归档文件的总字节数上限，0为不限制
+    */
+    log_archiver(const char *dir, const char *log_name, bool compress, int max_files, long long max_bytes);
+    ~log_archiver();
+    // 启动归档线程，失败返回false
+    bool start();
+    // 处理完已提交的文件后停止归档线程
+    void stop();
+    // 提交一个已经切换下来、不会再写入的日志文件
+    void submit(const std::string &path);
+    // 编译时是否带有压缩支持
+    static bool compression_available();
+
+private:
+    static void *work(void *arg);
+    void run();
+    // 压缩单个文件，成功后删除原文件，返回归档文件名；不压缩或失败时返回原文件名
+    std::string archive(const std::string &path);
+    // 按数量/字节数上限删除最旧的归档
+    void enforce_retention();
+    // 判断目录中的文件名是否是本日志的归档
+    bool is_archive(const char *name);
+
+private:
+    std::string m_dir;
+    std::string m_stem;
+    bool m_compress;
+    int m_max_files;
+    long long m_max_bytes;
+
+    pthread_t m_thread;
+    locker m_lock;
+    cond m_cond;
+    // 等待归档的文件
+    std::deque<std::string> m_pending;
+    bool m_stop;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "thread_log_buffer.h"
+#include <time.h>
+
+writer_signal::writer_signal() : m_pending(false), m_stop(false)
+{
+}
+
+void writer_signal::notify()
+{
+    m_lock.lock();
+    m_pending = true;
+    m_lock.unlock();
+    m_cond.signal();
+}
+
+void writer_signal::stop()
+{
+    m_lock.lock();
+    m_stop = true;
+    m_lock.unlock();
+    m_cond.signal();
+}
+
+bool writer_signal::wait(int timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += timeout_ms * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    m_lock.lock();
+    if (!m_pending && !m_stop)
+    {
+        m_cond.timewait(m_lock.get_mutex(), &deadline);
+    }
+    m_pending = false;
+    bool stop = m_stop;
+    m_lock.unlock();
+    return stop;
+}
+
+thread_log_buffer::thread_log_buffer(int capacity, int notify_bytes, writer_signal *writer)
+    : m_writer(writer), m_front(NULL), m_back(NULL), m_front_len(0),
+      m_capacity(capacity), m_notify_bytes(notify_bytes), m_waiting(false), m_retired(false)
+{
+    m_front = new char[capacity];
+    m_back = new char[capacity];
+}
+
+thread_log_buffer::~thread_log_buffer()
+{
+    delete[] m_front;
+    delete[] m_back;
+}
+
+char *thread_log_buffer::begin_append(int need)
+{
+    if (need > m_capacity)
+    {
+        // 整块缓冲都放不下，等多久也等不到，直接拒绝
+        return NULL;
+    }
+    m_lock.lock();
+    while (m_capacity - m_front_len < need)
+    {
+        // 前台缓冲写满，只能等后台写线程换走它
+        m_waiting = true;
+        m_writer->notify();
+        m_swapped.wait(m_lock.get_mutex());
+    }
+    return m_front + m_front_len;
+}
+
+void thread_log_buffer::commit(int len)
+{
+    bool reached = m_front_len < m_notify_bytes && m_front_len + len >= m_notify_bytes;
+    m_front_len += len;
+    m_lock.unlock();
+    // 只在刚达到水位时提醒一次后台写线程，平时它按自己的节奏定时来收
+    if (reached)
+    {
+        m_writer->notify();
+    }
+}
+
+void thread_log_buffer::swap(char **data, int *len)
+{
+    m_lock.lock();
+    char *tmp = m_front;
+    m_front = m_back;
+    m_back = tmp;
+    *data = m_back;
+    *len = m_front_len;
+    m_front_len = 0;
+    if (m_waiting)
+    {
+        m_waiting = false;
+        m_swapped.broadcast();
+    }
+    m_lock.unlock();
+}
+
+void thread_log_buffer::retire()
+{
+    m_lock.lock();
+    m_retired = true;
+    m_lock.unlock();
+}
+
+bool thread_log_buffer::retired()
+{
+    m_lock.lock();
+    bool ret = m_retired;
+    m_lock.unlock();
+    return ret;
+}
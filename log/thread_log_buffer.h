@@ -0,0 +1,85 @@
+#ifndef THREAD_LOG_BUFFER_H
+#define THREAD_LOG_BUFFER_H
+#include "../thread_pool/locker.h"
+
+/*
+    后台写线程的唤醒信号
+
+    条件变量本身不记忆signal，写线程正在写文件时到来的唤醒会丢失，
+    而写满缓冲的线程恰恰在等它，于是要白等一个完整的收缓冲周期。
+    这里用pending标志记住期间到来的唤醒，写线程回来时发现有待处理的唤醒就不再睡眠
+*/
+class writer_signal
+{
+public:
+    writer_signal();
+    // 唤醒后台写线程，写线程正忙时会记住这次唤醒
+    void notify();
+    // 通知后台写线程退出
+    void stop();
+    /*
+        由后台写线程调用：等待被唤醒或超时，已有待处理的唤醒时立即返回
+        return(bool):
+            true: 已被通知退出
+    */
+    bool wait(int timeout_ms);
+
+private:
+    locker m_lock;
+    cond m_cond;
+    bool m_pending;
+    bool m_stop;
+};
+
+/*
+    双缓冲日志模式下，每个写日志线程独占的一对缓冲区
+
+    所属线程把日志行直接格式化进前台缓冲；后台写线程定期把前后台缓冲对调，
+    再把换下来的整块缓冲一次性写入文件。前台缓冲的锁只在所属线程和后台写
+    线程之间竞争(且后者只在对调的一瞬间持有)，不同线程写日志互不影响。
+*/
+class thread_log_buffer
+{
+public:
+    /*
+        param:
+            capacity: 每块缓冲的字节数
+            notify_bytes: 前台缓冲积累到该字节数时提前唤醒后台写线程
+            writer: 后台写线程的唤醒信号，缓冲达到水位或写满时用来唤醒它
+    */
+    thread_log_buffer(int capacity, int notify_bytes, writer_signal *writer);
+    ~thread_log_buffer();
+    /*
+        由所属线程调用：保证前台缓冲至少还有need字节空间并返回写入位置，
+        返回时持有缓冲锁，必须紧接着调用commit()。
+        前台缓冲写满时会唤醒后台写线程，并等待它把缓冲换走。
+        need超过整块缓冲的容量时返回NULL(不持有锁)，调用者应事先截断
+    */
+    char *begin_append(int need);
+    // 提交begin_append之后写入的len字节，并释放缓冲锁
+    void commit(int len);
+    /*
+        由后台写线程调用：对调前后台缓冲，换下来的数据通过data/len返回。
+        返回的数据在下一次swap之前一直有效
+    */
+    void swap(char **data, int *len);
+    // 所属线程退出时调用，之后不会再有写入，由后台写线程在写完剩余数据后释放
+    void retire();
+    bool retired();
+
+private:
+    locker m_lock;
+    // 前台缓冲被换走
+    cond m_swapped;
+    writer_signal *m_writer;
+    char *m_front;
+    char *m_back;
+    int m_front_len;
+    int m_capacity;
+    int m_notify_bytes;
+    // 所属线程是否正在等待缓冲被换走
+    bool m_waiting;
+    bool m_retired;
+};
+
+#endif
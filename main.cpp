@@ -10,24 +10,74 @@
 #include <unistd.h>
 #include <signal.h>
 #include <arpa/inet.h>
+#include <thread>
 
 #include "thread_pool/locker.h"
 #include "thread_pool/threadPool.hpp"
 #include "http_connect/http_conn.h"
 #include "log/log.h"
+#include "log/access_log.h"
 #include "mysql_conn_pool/mysql_conn_pool.h"
+#include "session/session_store.h"
+#include "metrics/metrics.h"
+#include "metrics/metrics_server.h"
+#include "metrics/probes.h"
+#include "event_loop/epoll_loop.h"
+#ifdef WEBSERVER_IO_URING
+#include "event_loop/uring_loop.h"
+#endif
 
 const int MAX_FD = 65535;            // 最大文件描述符个数
 const int MAX_EVENT_NUMBER = 100000; // 最大事件个数
 const int TIME_SLOT = 60;            // alarm信号频率
-const int LOG_MODE = log::ASYNC;     // 写日志的模式
+const int LOG_MODE = log::DEFERRED;  // 写日志的模式
+const long long LOG_MAX_FILE_SIZE = 64LL * 1024 * 1024; // 单个日志文件的最大字节数
+const int LOG_FLUSH_INTERVAL_MS = 100;                  // 日志刷盘间隔
+const long long LOG_FLUSH_BYTES = 64 * 1024;            // 日志刷盘水位
+const int LOG_QUEUE_POLICY = QUEUE_DROP_NEWEST;         // 异步日志队列满时的策略
+const bool LOG_ARCHIVE_COMPRESS = true;                 // 切换下来的日志文件是否压缩归档
+const int LOG_ARCHIVE_MAX_FILES = 100;                  // 最多保留的归档文件数
+const long long LOG_ARCHIVE_MAX_BYTES = 1024LL * 1024 * 1024; // 归档文件的总字节数上限
+const int ACCESS_LOG_SAMPLE = 1;                        // 访问日志采样，每N个请求记录一条，0为关闭
+const int OVERLOAD_MAX_QUEUE_DEPTH = 1024;               // 线程池排队数达到该值时对新请求回复503，0为不限制
+const int OVERLOAD_MAX_QUEUE_DELAY_MS = 200;            // 请求的平均排队时间超过该值时回复503，0为不限制
+const int QUEUE_MAX_DELAY_MS = 1000;                     // 在线程池中排队超过该时间的请求不再处理，直接回复503，0为不限制
+const int QUEUE_CODEL_TARGET_MS = 50;                   // CoDel式自适应丢弃的目标排队时间，0为关闭
+const int QUEUE_CODEL_INTERVAL_MS = 100;                // CoDel的观察间隔
+const int OVERLOAD_RETRY_AFTER = 1;                     // 503响应中建议客户端重试的间隔(秒)
+const long long STATIC_CACHE_MAX_BYTES = 64LL * 1024 * 1024; // 静态文件缓存的总字节数上限，0则不缓存、不走主线程快路径
+const long long STATIC_CACHE_MAX_FILE = 1024 * 1024;        // 超过该大小的文件不缓存，仍然mmap
+const int STATIC_CACHE_REVALIDATE_MS = 1000;                // 缓存条目超过该时间未核对时，交给工作线程stat重新校验
+#ifdef WEBSERVER_IO_URING
+const unsigned URING_ENTRIES = 4096;                    // io_uring提交队列长度
+const int URING_BUF_COUNT = 4096;                       // io_uring接收缓冲区个数，须为2的幂
+const int URING_BUF_SIZE = 2048;                        // 每块接收缓冲区的大小，与连接的读缓存一样大
+const int URING_SEND_TIMEOUT_MS = 60000;                // io_uring下一次响应发送的超时，超时未发完则关闭连接，0为不限制
+#endif
+const int METRICS_PORT = 9100;                          // 指标抓取端口(GET /metrics)，可用-m port覆盖，0为关闭
 static int pipefd[2];
+// 工作线程请求主线程关闭连接的管道，写入的是连接的fd
+static int closefd[2];
 const char *MY_MYSQL_URL = "localhost";
 const char *MY_MYSQL_USERNAME = "root";
 const char *MY_MYSQL_PASSWORD = "Tt123456";
 const char *MY_MYSQL_DBNAME = "webserver";
 const int MY_MYSQL_PORT = 3306;
 const int MY_DBPOOL_MAX_SIZE = 8;
+const int MY_DBPOOL_AFFINE_SIZE = -1; // 线程亲和的专属连接数，-1为与执行数据库请求的线程池的最少线程数一致，0则关闭该模式
+const int THREADPOOL_MIN_THREADS = 0;  // 线程池最少线程数，0为CPU核数
+const int THREADPOOL_MAX_THREADS = 0;  // 线程池最多线程数，0为自动：有数据库执行器时为最少线程数的两倍，否则为最少线程数加上共享数据库连接数
+const int DB_EXECUTOR_MIN_THREADS = 8; // 执行登录/注册请求的数据库执行器的最少线程数(也是专属数据库连接的默认条数)，0则不单独执行数据库请求
+const int DB_EXECUTOR_MAX_THREADS = 0; // 数据库执行器的最多线程数，0为最少线程数加上共享数据库连接数
+const int DB_EXECUTOR_MAX_REQUEST = 1000; // 数据库执行器队列的最大长度
+const int THREADPOOL_MAX_REQUEST = 10000;        // 线程池队列的最大长度
+const int THREADPOOL_IDLE_TIMEOUT_MS = 30000;    // 多于最少线程数的线程空闲这么久后退出
+const int THREADPOOL_GROW_WAIT_US = 1000;        // 平滑后的排队时间超过该值时增加线程
+const int THREADPOOL_GROW_BLOCKED_PERCENT = 50;  // 工作线程阻塞时间占比超过该值时增加线程
+const int SESSION_TTL = 30 * 60;     // 登录会话空闲过期时间(秒)
+const int SESSION_SHARDS = 16;       // 会话表的分片数
+const int REGISTER_BATCH_SIZE = 32;  // 注册批量写入的最大行数，0则关闭批量注册
+const int REGISTER_BATCH_WINDOW = 5; // 注册批次的攒批时间窗(毫秒)
 
 /*
 感觉不用extern应该也行，此处使用extern是为了强调以下函数是声明，但不加其实系统也不会认定为定义
@@ -84,26 +134,304 @@ void addsig(int sig, void(handler)(int), bool restart = false)
     sigaction(sig, &sa, NULL);
 }
 
+// 抓取时读取的瞬时量
+static long long active_connections(void *)
+{
+    return http_conn::m_user_count.load(std::memory_order_relaxed);
+}
+
+static long long pool_queue_depth(void *arg)
+{
+    return ((threadPool<http_conn> *)arg)->get_queue_size();
+}
+
+static long long session_count(void *arg)
+{
+    return ((session_store *)arg)->size();
+}
+
+static long long pool_thread_count(void *arg)
+{
+    return ((threadPool<http_conn> *)arg)->get_thread_count();
+}
+
+/*
+    执行注册请求的线程池中还可能提交注册的线程数：正在执行任务的线程，加上排队的任务
+    (每个都会由一个线程执行)。空闲的线程在新任务到来前不会提交，不计入；线程池会因为
+    等待注册的线程被阻塞而扩容，用线程总数比较的话批次永远等不满
+*/
+static int register_submitters(void *arg)
+{
+    threadPool<http_conn> *p = (threadPool<http_conn> *)arg;
+    return p->get_busy_count() + p->get_queue_size();
+}
+
+static long long pool_blocked_permille(void *arg)
+{
+    return ((threadPool<http_conn> *)arg)->get_blocked_permille();
+}
+
+static long long pool_expired_deadline(void *arg)
+{
+    return ((threadPool<http_conn> *)arg)->get_expired_deadline();
+}
+
+static long long pool_expired_codel(void *arg)
+{
+    return ((threadPool<http_conn> *)arg)->get_expired_codel();
+}
+
+static long long pool_expired(void *arg)
+{
+    return pool_expired_deadline(arg) + pool_expired_codel(arg);
+}
+
+static long long queue_delay(void *arg)
+{
+    return ((overload_controller *)arg)->get_queue_delay();
+}
+
+static long long static_cache_bytes(void *arg)
+{
+    return ((static_cache *)arg)->get_bytes();
+}
+
+static long long log_dropped_lines(void *)
+{
+    return log::get_instance()->get_dropped_lines();
+}
+
+/*
+    每个定时周期把各阶段的耗时分布写一条日志：当前累计分布减去上一周期的快照，
+    得到的就是本周期内的分布，随后把当前分布保存为新的快照
+*/
+static void report_phase_latency(hdr_histogram *last[])
+{
+    hdr_histogram *cur = metrics::new_phase_histogram();
+    for (int phase = 0; phase < metrics::PHASE_NUM; phase++)
+    {
+        cur->reset();
+        metrics::merge_phase(phase, *cur);
+        hdr_histogram *interval = metrics::new_phase_histogram();
+        interval->merge(*cur);
+        interval->subtract(*last[phase]);
+        if (interval->total_count() > 0)
+        {
+            LOG_INFO("--phase %-6s count=%lld p50=%lldus p90=%lldus p99=%lldus max=%lldus",
+                     metrics::phase_name(phase), (long long)interval->total_count(),
+                     (long long)interval->value_at_percentile(50), (long long)interval->value_at_percentile(90),
+                     (long long)interval->value_at_percentile(99), (long long)interval->max());
+        }
+        delete interval;
+        last[phase]->reset();
+        last[phase]->merge(*cur);
+    }
+    delete cur;
+}
+
 // 定时器回调函数，它删除非活动连接socket上的注册事件，并关闭之，同时将连接对象和定时器解绑
 void cb_func(http_conn *user)
 {
-    printf("--timer call back it's client to close fd %d\n", user->getSockfd());
+    CONSOLE_TRACE("--timer call back it's client to close fd %d\n", user->getSockfd());
     LOG_INFO("--timer call back it's client to close fd %d", user->getSockfd());
+    TRACE_PROBE1(timer_expire, user->getSockfd());
     user->close_conn();
 }
 
+// 主线程关闭连接：先删除绑定的定时器
+static void close_user(http_conn *user, sort_timer_lst *timerList)
+{
+    if (user->m_timer)
+    {
+        timerList->del_timer(user->m_timer);
+    }
+    user->close_conn();
+}
+
+// 连接上有活动，推迟它的超时时间
+static void refresh_timer(http_conn *user, sort_timer_lst *timerList)
+{
+    util_timer *timer = user->m_timer;
+    if (timer)
+    {
+        time_t cur = time(NULL);
+        timer->expire = cur + 3 * TIME_SLOT;
+        CONSOLE_TRACE("--adjust timer once\n");
+        LOG_DEBUG("--adjust timer once");
+        timerList->adjust_timer(timer);
+    }
+}
+
+// 初始化新连接并为它创建定时器，连接数已满时回复503后关闭
+static void accept_conn(int cfd, const struct sockaddr_in &clientAddress, http_conn *users,
+                        sort_timer_lst *timerList, overload_controller *overload, connection_pool *db_connect_pool)
+{
+    if (http_conn::m_user_count.load(std::memory_order_relaxed) >= MAX_FD)
+    {
+        metrics::add(metrics::CONN_REJECTED);
+        // 目前连接数满了，告知客户端服务器正忙后关闭
+        overload->reject_connection(cfd);
+        return;
+    }
+    /*
+    将新的客户连接数据，借由连接对象的初始化方法载入到数组中某一个对象中，
+    此处直接使用客户端文件描述符作为数组索引，理论上浪费了前三个位置。
+    初始化方法会将指定对象的成员变量m_sockfd和地址m_addr赋值为传入的cfd
+    和地址，同时，还会顺便将其登记到事件循环中。
+    */
+    // TODO:疑惑，此处new创建的timer对象会放入到timerList中，由其List管理它的释放，是否不够合理
+    metrics::add(metrics::CONN_ACCEPTED);
+    TRACE_PROBE3(accept, cfd, clientAddress.sin_addr.s_addr, clientAddress.sin_port);
+    util_timer *timer = new util_timer;
+    timer->data = &users[cfd];
+    timer->cb_func = cb_func;
+    time_t cur = time(NULL);
+    timer->expire = cur + 3 * TIME_SLOT;
+    CONSOLE_TRACE("--build 1 timer...\n");
+    users[cfd].init(cfd, clientAddress, timer, db_connect_pool);
+    timerList->add_timer(timer);
+    LOG_DEBUG("--build 1 timer,1 http_conn,http_conn load db_connect_pool ,now %d http-connect is linking!",
+              http_conn::m_user_count.load());
+}
+
+// 处理工作线程请求关闭的连接
+static void close_requested(const int *fds, int n, http_conn *users, sort_timer_lst *timerList)
+{
+    for (int j = 0; j < n; j++)
+    {
+        int fd = fds[j];
+        // 请求发出后连接可能已被定时器关闭，fd又被新连接复用，这时不能再关
+        if (fd < 0 || fd >= MAX_FD || !users[fd].take_close_request())
+        {
+            continue;
+        }
+        close_user(&users[fd], timerList);
+    }
+}
+
+// 处理信号管道中读到的信号
+static void handle_signals(const char *signals, int n, bool &timeout, bool &stop_server)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        switch (signals[i])
+        {
+        case SIGALRM:
+        {
+            timeout = true;
+            break; // 该break跳出的是for循环
+        }
+        case SIGTERM:
+        case SIGINT:
+        {
+            stop_server = true;
+        }
+        }
+    }
+}
+
+// 请求数据读完后：命中缓存的直接响应，其余的经过准入检查交给线程池
+static void dispatch_request(http_conn *user, threadPool<http_conn> *pool, overload_controller *overload,
+                             sort_timer_lst *timerList)
+{
+    // 命中缓存的静态文件直接在主线程响应，不进线程池排队
+    http_conn::INLINE_RESULT inline_ret = user->process_inline();
+    if (inline_ret == http_conn::INLINE_CLOSE)
+    {
+        close_user(user, timerList);
+        return;
+    }
+    if (inline_ret == http_conn::INLINE_DONE)
+    {
+        return;
+    }
+    // 过载或者队列已满时不入队，直接回复503；以前入队失败时连接会一直挂起
+    bool admitted = overload->admit(pool->get_queue_size());
+    if (admitted && !pool->append(user))
+    {
+        metrics::add(metrics::SHED_POOL_FULL);
+        admitted = false;
+    }
+    if (!admitted && !user->reply_unavailable())
+    {
+        close_user(user, timerList);
+    }
+}
+
+// 定时心跳：关闭超时连接、清理过期会话、输出周期统计
+static void on_tick(sort_timer_lst *timerList, session_store *sessions, hdr_histogram *phase_snapshots[])
+{
+    time_t cur = time(NULL);
+    char timestr[32];
+    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime(&cur));
+    timerList->tick();
+    // 会话的过期清理同样由定时器心跳驱动
+    int expired = sessions->expire(cur);
+    if (expired > 0)
+    {
+        LOG_INFO("--expire %d session(s), %d left", expired, sessions->size());
+    }
+    printf("--%s: %d http-connet is linking!\n", timestr, http_conn::m_user_count.load());
+    log::get_instance()->report_flush_stats();
+    report_phase_latency(phase_snapshots);
+}
+
 int main(int argc, char *argv[])
 {
+    // 可选的调试开关-d：输出DEBUG级日志(含完整的请求/响应报文)并打开控制台跟踪
+    // 可选的-m port：指标抓取端口，0为关闭
+    // 可选的-r：反应堆模式，套接字读写由工作线程完成，默认由主线程完成(模拟proactor)
+    // 可选的-u：使用io_uring事件循环，编译时头文件太旧或内核不支持时退回epoll
+    bool debug = false;
+    bool reactor = false;
+    bool use_uring = false;
+    int metrics_port = METRICS_PORT;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0)
+        {
+            debug = true;
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            metrics_port = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            reactor = true;
+        }
+        else if (strcmp(argv[i], "-u") == 0)
+        {
+            use_uring = true;
+        }
+    }
+    int log_level = debug ? log::LEVEL_DEBUG : log::LEVEL_INFO;
+    log::set_console_trace(debug);
+    access_log::set_sample_every(ACCESS_LOG_SAMPLE);
+
     // 开启日志
+    log::get_instance()->set_flush_policy(LOG_FLUSH_INTERVAL_MS, LOG_FLUSH_BYTES);
+    log::get_instance()->set_queue_policy(LOG_QUEUE_POLICY);
+    log::get_instance()->set_archive_policy(LOG_ARCHIVE_COMPRESS, LOG_ARCHIVE_MAX_FILES, LOG_ARCHIVE_MAX_BYTES);
     if (LOG_MODE == log::SYNC)
     {
         // 同步日志模型
-        log::get_instance()->init(log::LEVEL_DEBUG, "./ServerLog.log", 2048, 80000, 0);
+        log::get_instance()->init(log_level, "./ServerLog.log", 2048, LOG_MAX_FILE_SIZE, 0);
     }
     else if (LOG_MODE == log::ASYNC)
     {
         // 异步日志模型
-        log::get_instance()->init(log::LEVEL_DEBUG, "./ServerLog.log", 2048, 80000, 32);
+        log::get_instance()->init(log_level, "./ServerLog.log", 2048, LOG_MAX_FILE_SIZE, 32);
+    }
+    else if (LOG_MODE == log::BUFFERED)
+    {
+        // 线程局部双缓冲日志模型
+        log::get_instance()->init(log_level, "./ServerLog.log", 2048, LOG_MAX_FILE_SIZE, 0, log::BUFFERED);
+    }
+    else if (LOG_MODE == log::DEFERRED)
+    {
+        // 延迟格式化日志模型，格式化由后台写线程完成
+        log::get_instance()->init(log_level, "./ServerLog.log", 2048, LOG_MAX_FILE_SIZE, 0, log::DEFERRED);
     }
     // for (int i = 0; i < 15; i++)
     // {
@@ -113,7 +441,7 @@ int main(int argc, char *argv[])
 
     if (argc <= 2)
     {
-        printf("按照如下格式运行：%s ip_address port_number \n", basename(argv[0]));
+        printf("按照如下格式运行：%s ip_address port_number [-d] [-m metrics_port] [-r] [-u]\n", basename(argv[0]));
         exit(-1);
     }
     // 获取ip
@@ -121,7 +449,6 @@ int main(int argc, char *argv[])
     // 获取端口号
     int port = atoi(argv[2]);
     LOG_INFO("--服务器预设参数: IP:%s, PORT:%d", ip, port);
-    log::get_instance()->file_flush();
 
     // 对SIGPIPE信号做处理，实际处理是忽略
     /*
@@ -135,20 +462,146 @@ int main(int argc, char *argv[])
 
     */
     addsig(SIGPIPE, SIG_IGN);
+    /*
+    线程数默认按机器决定：解析、读文件这类CPU上的工作，线程数与核数相同就够了；
+    多出来的线程只在阻塞于数据库时才有用，而同时能访问数据库的线程不会多于连接数，
+    所以执行数据库请求的线程池上限取最少线程数加上共享连接数。
+    数据库请求单独执行时，主线程池只留一倍的余量应对读文件、缺页等阻塞
+    */
+    int min_threads = THREADPOOL_MIN_THREADS;
+    if (min_threads <= 0)
+    {
+        min_threads = std::thread::hardware_concurrency();
+        if (min_threads <= 0)
+        {
+            min_threads = 8;
+        }
+    }
+    int max_threads = THREADPOOL_MAX_THREADS;
+    if (max_threads <= 0)
+    {
+        max_threads = DB_EXECUTOR_MIN_THREADS > 0 ? 2 * min_threads : min_threads + MY_DBPOOL_MAX_SIZE;
+    }
+    int db_min_threads = DB_EXECUTOR_MIN_THREADS > 0 ? DB_EXECUTOR_MIN_THREADS : min_threads;
+    int db_max_threads = DB_EXECUTOR_MAX_THREADS > 0 ? DB_EXECUTOR_MAX_THREADS : db_min_threads + MY_DBPOOL_MAX_SIZE;
     // 创建数据库连接池,并初始化
     connection_pool *db_connect_pool = new connection_pool;
     db_connect_pool->init(MY_DBPOOL_MAX_SIZE, MY_MYSQL_URL, MY_MYSQL_PORT,
                           MY_MYSQL_USERNAME, MY_MYSQL_PASSWORD, MY_MYSQL_DBNAME);
+    // 工作线程各自持有一条专属连接，init建立的共享连接作为溢出池
+    db_connect_pool->enable_thread_affinity(MY_DBPOOL_AFFINE_SIZE < 0 ? db_min_threads : MY_DBPOOL_AFFINE_SIZE);
+    // 创建登录会话存储，所有连接共享
+    session_store *sessions = new session_store(SESSION_TTL, SESSION_SHARDS);
+    http_conn::m_session_store = sessions;
+    // 创建注册批处理器，注册请求按时间窗合并写入数据库
+    register_batcher *registers = NULL;
+    if (REGISTER_BATCH_SIZE > 0)
+    {
+        registers = new register_batcher(db_connect_pool, REGISTER_BATCH_SIZE, REGISTER_BATCH_WINDOW);
+        http_conn::m_register_batcher = registers;
+    }
     // 创建线程池，并初始化线程池
     threadPool<http_conn> *pool = NULL;
+    threadPool<http_conn> *db_executor = NULL;
     try
     {
-        pool = new threadPool<http_conn>;
+        // 只有线程池的工作线程会分到专属数据库连接
+        pool = new threadPool<http_conn>(min_threads, THREADPOOL_MAX_REQUEST, max_threads,
+                                         connection_pool::register_worker);
+        // 数据库请求使用独立的线程和队列，数据库变慢时静态请求的延迟不受影响
+        if (DB_EXECUTOR_MIN_THREADS > 0)
+        {
+            db_executor = new threadPool<http_conn>(db_min_threads, DB_EXECUTOR_MAX_REQUEST, db_max_threads,
+                                                    connection_pool::register_worker);
+        }
     }
     catch (...)
     {
         exit(-1);
     }
+    if (db_executor)
+    {
+        db_executor->set_elastic(THREADPOOL_IDLE_TIMEOUT_MS, THREADPOOL_GROW_WAIT_US, THREADPOOL_GROW_BLOCKED_PERCENT);
+        db_executor->set_queue_deadline(QUEUE_MAX_DELAY_MS, QUEUE_CODEL_TARGET_MS, QUEUE_CODEL_INTERVAL_MS);
+        http_conn::m_db_executor = db_executor;
+    }
+    pool->set_elastic(THREADPOOL_IDLE_TIMEOUT_MS, THREADPOOL_GROW_WAIT_US, THREADPOOL_GROW_BLOCKED_PERCENT);
+    if (registers)
+    {
+        // 注册请求在数据库执行器中执行，没有执行器时在主线程池中执行
+        registers->set_submitters(register_submitters, db_executor ? db_executor : pool);
+    }
+    pool->set_queue_deadline(QUEUE_MAX_DELAY_MS, QUEUE_CODEL_TARGET_MS, QUEUE_CODEL_INTERVAL_MS);
+    // 创建过载控制器，线程池排队过深或过久时由主线程直接回复503
+    overload_controller *overload = new overload_controller(OVERLOAD_MAX_QUEUE_DEPTH, OVERLOAD_MAX_QUEUE_DELAY_MS,
+                                                            OVERLOAD_RETRY_AFTER);
+    http_conn::m_overload = overload;
+    // 创建静态文件缓存，命中的GET请求在主线程直接响应
+    static_cache *file_cache = NULL;
+    if (STATIC_CACHE_MAX_BYTES > 0)
+    {
+        file_cache = new static_cache(STATIC_CACHE_MAX_BYTES, STATIC_CACHE_MAX_FILE, STATIC_CACHE_REVALIDATE_MS);
+        http_conn::m_static_cache = file_cache;
+    }
+    // 注册抓取时读取的指标，然后在独立的管理端口上提供/metrics
+    metrics::register_value("webserver_connections_active", "Currently open client connections.",
+                            false, active_connections, NULL);
+    metrics::register_value("webserver_threadpool_queue_depth", "Requests waiting in the thread pool queue.",
+                            false, pool_queue_depth, pool);
+    metrics::register_value("webserver_threadpool_queue_delay_microseconds",
+                            "Smoothed time requests recently spent waiting in the thread pool queue.",
+                            false, queue_delay, overload);
+    metrics::register_value("webserver_threadpool_threads", "Worker threads in the thread pool.",
+                            false, pool_thread_count, pool);
+    metrics::register_value("webserver_threadpool_blocked_permille",
+                            "Smoothed share of task time workers spent blocked (off CPU), in permille.",
+                            false, pool_blocked_permille, pool);
+    metrics::register_value("webserver_threadpool_expired_deadline_total",
+                            "Requests answered with 503 because they waited in the queue past the deadline.",
+                            true, pool_expired_deadline, pool);
+    metrics::register_value("webserver_threadpool_expired_codel_total",
+                            "Requests answered with 503 by the adaptive (CoDel) queue drop.",
+                            true, pool_expired_codel, pool);
+    if (db_executor)
+    {
+        metrics::register_value("webserver_db_executor_queue_depth",
+                                "Database requests waiting in the database executor queue.",
+                                false, pool_queue_depth, db_executor);
+        metrics::register_value("webserver_db_executor_threads", "Worker threads in the database executor.",
+                                false, pool_thread_count, db_executor);
+        metrics::register_value("webserver_db_executor_expired_total",
+                                "Database requests answered with 503 because they waited too long in the queue.",
+                                true, pool_expired, db_executor);
+    }
+    if (file_cache)
+    {
+        metrics::register_value("webserver_static_cache_bytes", "Bytes of static files held in the cache.",
+                                false, static_cache_bytes, file_cache);
+    }
+    metrics::register_value("webserver_sessions", "Live login sessions.", false, session_count, sessions);
+    metrics::register_value("webserver_log_dropped_lines_total", "Log lines dropped because the async queue was full.",
+                            true, log_dropped_lines, NULL);
+    // 上一个定时周期结束时各阶段的累计分布，用于输出周期内的耗时分布
+    hdr_histogram *phase_snapshots[metrics::PHASE_NUM];
+    for (int i = 0; i < metrics::PHASE_NUM; i++)
+    {
+        phase_snapshots[i] = metrics::new_phase_histogram();
+    }
+    metrics_server *metrics_srv = NULL;
+    if (metrics_port > 0)
+    {
+        metrics_srv = new metrics_server;
+        if (metrics_srv->start(ip, metrics_port))
+        {
+            LOG_INFO("--指标抓取端口: %s:%d/metrics", ip, metrics_port);
+        }
+        else
+        {
+            LOG_ERROR("--指标抓取端口%d监听失败", metrics_port);
+            delete metrics_srv;
+            metrics_srv = NULL;
+        }
+    }
     // 创建一个客户连接数组用于保存所有的客户端信息
     // TODO：感觉可以改进，一开始就创建了65536个连接对象，每个对象都维护各自的读写缓存，感觉太浪费
     http_conn *users = new http_conn[MAX_FD];
@@ -188,6 +641,47 @@ int main(int argc, char *argv[])
     assert(epollfd != -1);
     // 先将服务器监听socket放入epoll监听队列中
     addfd(epollfd, listenfd, EPOLLIN);
+    /*
+    选择事件循环：io_uring把读写本身提交给内核，一轮io_uring_enter同时完成提交和收割；
+    内核太旧(需要5.19+)或被禁用时构造失败，退回epoll
+    */
+    epoll_loop *epoll_backend = NULL;
+#ifdef WEBSERVER_IO_URING
+    uring_loop *ring = NULL;
+    if (use_uring)
+    {
+        try
+        {
+            ring = new uring_loop(MAX_FD, URING_ENTRIES, URING_BUF_COUNT, URING_BUF_SIZE, URING_SEND_TIMEOUT_MS);
+        }
+        catch (...)
+        {
+            LOG_ERROR("--io_uring不可用，退回epoll");
+            ring = NULL;
+        }
+    }
+    if (ring)
+    {
+        http_conn::m_loop = ring;
+        if (reactor)
+        {
+            // io_uring下读写由内核异步完成，工作线程没有需要分担的套接字读写
+            LOG_WARN("--io_uring事件循环下忽略反应堆模式");
+            reactor = false;
+        }
+    }
+#else
+    if (use_uring)
+    {
+        LOG_ERROR("--编译时没有io_uring支持，使用epoll");
+    }
+#endif
+    if (http_conn::m_loop == NULL)
+    {
+        epoll_backend = new epoll_loop(epollfd);
+        http_conn::m_loop = epoll_backend;
+    }
+    LOG_INFO("--事件循环: %s", http_conn::m_loop->name());
 
     // 再次，将信号传递的管道的出口放入到epoll监听队列中
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
@@ -195,36 +689,151 @@ int main(int argc, char *argv[])
     setNoBlocking(pipefd[1]);
     // 为了效率，管道的读端的监听事件也采用了ET工作模式
     addfd(epollfd, pipefd[0], EPOLLIN | EPOLLET);
+    /*
+    工作线程不能操作定时器链表，需要关闭连接时把fd写进这个管道，由主线程删除定时器后关闭。
+    写端也是非阻塞的：管道写满时放弃这次关闭请求，连接最终由定时器关闭，工作线程不会因此阻塞
+    */
+    ret = pipe(closefd);
+    assert(ret != -1);
+    setNoBlocking(closefd[1]);
+    addfd(epollfd, closefd[0], EPOLLIN | EPOLLET);
+    http_conn::m_close_fd = closefd[1];
+    http_conn::m_reactor = reactor;
+    LOG_INFO("--事件处理模式: %s", reactor ? "reactor" : "proactor(模拟)");
 
     /* 注册带Restart信号 */
     addsig(SIGALRM, sigHandler, true);
     addsig(SIGTERM, sigHandler, true);
     addsig(SIGINT, sigHandler, true);
 
-    http_conn::m_epollfd = epollfd;
     bool stop_server = false;
     bool timeout = false;
-    // 先初发出一个计时信号
-    alarm(TIME_SLOT);
+#ifdef WEBSERVER_IO_URING
+    if (ring)
+    {
+        // 心跳由io_uring的超时请求产生，不再需要SIGALRM
+        ring->accept_multishot(listenfd);
+        ring->watch(pipefd[0], pipefd[0]);
+        ring->watch(closefd[0], closefd[0]);
+        ring->set_tick(TIME_SLOT);
+    }
+#endif
+    if (epoll_backend)
+    {
+        // 先初发出一个计时信号
+        alarm(TIME_SLOT);
+    }
     // printf("--first alarm will to be send after %ds ... \n", TIME_SLOT);
     /*
     最后，对于每个连接到服务器的客户端连接，我们也应该将其放入到监听队列中
     */
 
     /*
-    此处，代码需要将epollfd送入到客户端连接http_conn对象中绑定，因为对于
+    此处，代码需要将事件循环送入到客户端连接http_conn对象中绑定，因为对于
     http_conn即一个服务器接收到的客户端连接实体，其连接的sockfd和addr属于该对
     象的私有成员变量，为了不破坏类的封装性，只能由每个连接对象本身来执行将连接送
-    入到epoll监听队列中的操作。同时，由于每个连接对象理应由同一个epoll管理，所以
-    其epoll值对于所有的对象来说应该是可以共享的，那么就可以将类内设置一个静态变量
-    用于承接传入的epollfd值，而使得每个连接对象都可以在送入监听队列时，进入同一个
-    epoll监听队列。
+    入到事件循环中的操作。同时，由于每个连接对象理应由同一个事件循环管理，所以
+    它对于所有的对象来说应该是可以共享的，那么就可以将类内设置一个静态变量
+    用于承接传入的事件循环，而使得每个连接对象都可以进入同一个事件循环。
     */
     LOG_INFO("--服务器开始运行");
-    while (!stop_server)
+#ifdef WEBSERVER_IO_URING
+    while (!stop_server && ring)
+    {
+        // io_uring：提交积压的请求并等待完成事件，再逐个处理
+        // 空闲时也要按日志刷盘间隔醒来
+        if (!ring->wait(log::get_instance()->flush_timeout_ms()))
+        {
+            std::cout << "--io_uring failure\n";
+            break;
+        }
+        uring_loop::event ev;
+        while (ring->next(ev))
+        {
+            switch (ev.type)
+            {
+            case uring_loop::EV_ACCEPT:
+            {
+                // 多次触发的accept不带对端地址，单独取一次
+                struct sockaddr_in clientAddress;
+                socklen_t clientAddressLen = sizeof(clientAddress);
+                memset(&clientAddress, 0, sizeof(clientAddress));
+                getpeername(ev.fd, (struct sockaddr *)&clientAddress, &clientAddressLen);
+                accept_conn(ev.fd, clientAddress, users, timerList, overload, db_connect_pool);
+                break;
+            }
+            case uring_loop::EV_READ:
+                // 对端关闭、出错或者请求超过读缓存，关闭连接
+                if (ev.res <= 0 || !users[ev.fd].feed(ev.data, ev.res))
+                {
+                    close_user(&users[ev.fd], timerList);
+                    break;
+                }
+                refresh_timer(&users[ev.fd], timerList);
+                dispatch_request(&users[ev.fd], pool, overload, timerList);
+                break;
+            case uring_loop::EV_WRITABLE:
+            {
+                struct iovec iov[2];
+                int count = users[ev.fd].get_send_iov(iov);
+                if (count > 0)
+                {
+                    ring->send(ev.fd, iov, count);
+                }
+                else if (!users[ev.fd].write())
+                {
+                    // 没有要发送的内容，write()只是结束这次响应
+                    close_user(&users[ev.fd], timerList);
+                }
+                break;
+            }
+            case uring_loop::EV_SENT:
+            {
+                bool done = false;
+                if (!users[ev.fd].on_sent(ev.res, &done))
+                {
+                    close_user(&users[ev.fd], timerList);
+                }
+                else if (!done)
+                {
+                    // 被打断等原因没有发完，接着发剩余部分
+                    struct iovec iov[2];
+                    ring->send(ev.fd, iov, users[ev.fd].get_send_iov(iov));
+                }
+                else
+                {
+                    refresh_timer(&users[ev.fd], timerList);
+                }
+                break;
+            }
+            case uring_loop::EV_TICK:
+                timeout = true;
+                break;
+            case uring_loop::EV_AUX:
+                if (ev.fd == pipefd[0])
+                {
+                    handle_signals(ev.data, ev.res, timeout, stop_server);
+                }
+                else
+                {
+                    close_requested((const int *)ev.data, ev.res / (int)sizeof(int), users, timerList);
+                }
+                break;
+            }
+        }
+        log::get_instance()->flush_if_due();
+        if (timeout)
+        {
+            on_tick(timerList, sessions, phase_snapshots);
+            timeout = false;
+        }
+    }
+#endif
+    while (!stop_server && epoll_backend)
     {
-        //-1代表永久阻塞
-        int numOfReadyEvents = epoll_wait(epollfd, epollEvents, MAX_EVENT_NUMBER, -1);
+        // 超时取到下一次日志刷盘的时刻，空闲时也能按间隔补刷；-1代表永久阻塞
+        int numOfReadyEvents =
+            epoll_wait(epollfd, epollEvents, MAX_EVENT_NUMBER, log::get_instance()->flush_timeout_ms());
         // 对于不是由于中断导致的epoll_wait返回值小于0的情况，说明epoll失败，直接退出循环
         if ((numOfReadyEvents < 0 && (errno != EINTR)))
         {
@@ -236,7 +845,7 @@ int main(int argc, char *argv[])
         {
             int sockfd = epollEvents[i].data.fd;
             util_timer *timer = NULL;
-            if (sockfd != listenfd && sockfd != pipefd[0])
+            if (sockfd != listenfd && sockfd != pipefd[0] && sockfd != closefd[0])
             {
                 timer = users[sockfd].m_timer;
             }
@@ -246,30 +855,21 @@ int main(int argc, char *argv[])
                 struct sockaddr_in clientAddress;
                 socklen_t clientAddressLen = sizeof(clientAddress);
                 int cfd = accept(listenfd, (struct sockaddr *)&clientAddress, &clientAddressLen);
-                if (http_conn::m_user_count >= MAX_FD)
+                if (cfd < 0)
                 {
-                    // 目前连接数满了
-                    // TODO:需要给客户端发送一个信息，标识服务器内部正忙
-                    close(cfd);
                     continue;
                 }
-                /*
-                将新的客户连接数据，借由连接对象的初始化方法载入到数组中某一个对象中，
-                此处直接使用客户端文件描述符作为数组索引，理论上浪费了前三个位置。
-                初始化方法会将指定对象的成员变量m_sockfd和地址m_addr赋值为传入的cfd
-                和地址，同时，还会顺便将其放入到epoll监听队列中。
-                */
-                // TODO:疑惑，此处new创建的timer对象会放入到timerList中，由其List管理它的释放，是否不够合理
-                util_timer *timer = new util_timer;
-                timer->data = &users[cfd];
-                timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIME_SLOT;
-                printf("--build 1 timer...\n");
-                users[cfd].init(cfd, clientAddress, timer, db_connect_pool);
-                timerList->add_timer(timer);
-                LOG_INFO("--build 1 timer,1 http_conn,http_conn load db_connect_pool ,now %d http-connect is linking!",
-                         http_conn::m_user_count);
+                accept_conn(cfd, clientAddress, users, timerList, overload, db_connect_pool);
+            }
+            else if (sockfd == closefd[0])
+            {
+                // 工作线程请求关闭的连接，ET模式下一次读完
+                int fds[256];
+                int n;
+                while ((n = read(closefd[0], fds, sizeof(fds))) > 0)
+                {
+                    close_requested(fds, n / (int)sizeof(int), users, timerList);
+                }
             }
             else if ((sockfd == pipefd[0]) && (epollEvents[i].events & EPOLLIN))
             {
@@ -289,22 +889,7 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
-                    for (int i = 0; i < ret; ++i)
-                    {
-                        switch (signals[i])
-                        {
-                        case SIGALRM:
-                        {
-                            timeout = true;
-                            break; // 该break跳出的是for循环
-                        }
-                        case SIGTERM:
-                        case SIGINT:
-                        {
-                            stop_server = true;
-                        }
-                        }
-                    }
+                    handle_signals(signals, ret, timeout, stop_server);
                 }
             }
             else if (epollEvents[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
@@ -316,20 +901,44 @@ int main(int argc, char *argv[])
                 }
                 users[sockfd].close_conn();
             }
-            else if (epollEvents[i].events & EPOLLIN)
+            else if (reactor && (epollEvents[i].events & (EPOLLIN | EPOLLOUT)))
             {
-                if (users[sockfd].read())
+                // 反应堆模式：主线程只调整定时器并分发事件，读写和处理都在工作线程中完成
+                if (timer)
+                {
+                    time_t cur = time(NULL);
+                    timer->expire = cur + 3 * TIME_SLOT;
+                    timerList->adjust_timer(timer);
+                }
+                bool writable = (epollEvents[i].events & EPOLLOUT) != 0;
+                users[sockfd].on_event(writable);
+                // 只对新请求做准入检查，已经生成的响应总是要发出去
+                bool admitted = writable || overload->admit(pool->get_queue_size());
+                if (admitted && !pool->append(&users[sockfd]))
+                {
+                    if (!writable)
+                    {
+                        metrics::add(metrics::SHED_POOL_FULL);
+                    }
+                    admitted = false;
+                }
+                // 没能交给线程池时由主线程自己发送：写事件发送已生成的响应，读事件回复503
+                if (!admitted && !(writable ? users[sockfd].write() : users[sockfd].reply_unavailable()))
                 {
-                    // 已经一次性把所有数据读完了
                     if (timer)
                     {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIME_SLOT;
-                        printf("--adjust timer once\n");
-                        LOG_INFO("--adjust timer once");
-                        timerList->adjust_timer(timer);
+                        timerList->del_timer(timer);
                     }
-                    pool->append(&users[sockfd]);
+                    users[sockfd].close_conn();
+                }
+            }
+            else if (epollEvents[i].events & EPOLLIN)
+            {
+                if (users[sockfd].read())
+                {
+                    // 已经一次性把所有数据读完了
+                    refresh_timer(&users[sockfd], timerList);
+                    dispatch_request(&users[sockfd], pool, overload, timerList);
                 }
                 else
                 {
@@ -362,20 +971,18 @@ int main(int argc, char *argv[])
                     {
                         time_t cur = time(NULL);
                         timer->expire = cur + 3 * TIME_SLOT;
-                        printf("--adjust timer once\n");
-                        LOG_INFO("--adjust timer once");
+                        CONSOLE_TRACE("--adjust timer once\n");
+                        LOG_DEBUG("--adjust timer once");
                         timerList->adjust_timer(timer);
                     }
                 }
             }
         } // for(epollEvent)
+        // 同步/异步日志没有定时醒来的后台线程，由主循环按刷盘间隔补刷
+        log::get_instance()->flush_if_due();
         if (timeout)
         {
-            time_t cur = time(NULL);
-            char timestr[32];
-            strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime(&cur));
-            timerList->tick();
-            printf("--%s: %d http-connet is linking!\n", timestr, http_conn::m_user_count);
+            on_tick(timerList, sessions, phase_snapshots);
             alarm(TIME_SLOT);
             timeout = false;
         }
@@ -384,14 +991,44 @@ int main(int argc, char *argv[])
 
     // epoll监听失败时或者进程终止时，会跳出死循环，在监听失败后，为其收尾
     printf("--正在退出，释放资源确保安全...\n");
+    // 先停止抓取，回调里引用的线程池和会话存储随后会被释放
+    delete metrics_srv;
+    for (int i = 0; i < metrics::PHASE_NUM; i++)
+    {
+        delete phase_snapshots[i];
+    }
+    // 等工作线程执行完手上的任务后结束，之后再释放它们会访问的连接对象
+    delete pool;
+    // 主线程池的线程会向数据库执行器转交请求，所以在它之后释放
+    http_conn::m_db_executor = NULL;
+    delete db_executor;
     close(epollfd);
     close(listenfd);
     close(pipefd[1]);
     close(pipefd[0]);
+    http_conn::m_close_fd = -1;
+    close(closefd[1]);
+    close(closefd[0]);
+    // 关闭io_uring时内核取消所有未完成的请求，它们引用着连接对象的缓存，所以先于连接对象释放
+    http_conn::m_loop = NULL;
+#ifdef WEBSERVER_IO_URING
+    delete ring;
+#endif
+    delete epoll_backend;
     delete[] users;
     delete timerList;
-    delete pool;
+    http_conn::m_register_batcher = NULL;
+    delete registers;
+    http_conn::m_session_store = NULL;
+    delete sessions;
+    http_conn::m_overload = NULL;
+    delete overload;
+    http_conn::m_static_cache = NULL;
+    delete file_cache;
     LOG_INFO("--服务器安全关闭");
+    log::get_instance()->report_flush_stats();
+    // 退出前显式刷盘一次
+    log::get_instance()->file_flush();
     // printf("1\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "hdr_histogram.h"
+#include <math.h>
+
+hdr_histogram::hdr_histogram(int64_t highest_value, int significant_digits)
+    : m_total_count(0), m_min(INT64_MAX), m_max(0), m_sum(0)
+{
+    if (significant_digits < 1)
+    {
+        significant_digits = 1;
+    }
+    else if (significant_digits > 5)
+    {
+        significant_digits = 5;
+    }
+    if (highest_value < 2)
+    {
+        highest_value = 2;
+    }
+    m_highest_value = highest_value;
+    m_significant_digits = significant_digits;
+
+    // 要区分出d位有效数字，一段内至少需要2*10^d个子桶
+    int64_t largest_single_unit = 2 * (int64_t)pow(10, significant_digits);
+    m_sub_bucket_bits = (int)ceil(log2((double)largest_single_unit));
+    m_sub_bucket_count = (int64_t)1 << m_sub_bucket_bits;
+    m_sub_bucket_mask = m_sub_bucket_count - 1;
+
+    // 第0段覆盖[0, sub_bucket_count)，之后每段的范围翻倍，直到覆盖highest_value
+    int bucket_count = 1;
+    int64_t smallest_untrackable = m_sub_bucket_count;
+    while (smallest_untrackable <= highest_value)
+    {
+        if (smallest_untrackable > INT64_MAX / 2)
+        {
+            bucket_count++;
+            break;
+        }
+        smallest_untrackable <<= 1;
+        bucket_count++;
+    }
+    m_counts.assign((size_t)(bucket_count + 1) << (m_sub_bucket_bits - 1), 0);
+}
+
+int hdr_histogram::bucket_index(int64_t value) const
+{
+    // 最高位的位置决定值所在的段，小于一段子桶数的值都在第0段
+    int msb = 63 - __builtin_clzll((uint64_t)(value | m_sub_bucket_mask));
+    return msb - (m_sub_bucket_bits - 1);
+}
+
+int hdr_histogram::counts_index(int64_t value) const
+{
+    int bucket = bucket_index(value);
+    int64_t sub = value >> bucket;
+    int half_bits = m_sub_bucket_bits - 1;
+    // 除第0段外，每段的前一半子桶与上一段重叠，只使用后一半
+    return (int)(((int64_t)(bucket + 1) << half_bits) + (sub - ((int64_t)1 << half_bits)));
+}
+
+int64_t hdr_histogram::value_from_index(int index) const
+{
+    int half_bits = m_sub_bucket_bits - 1;
+    int64_t half_count = (int64_t)1 << half_bits;
+    int bucket = (index >> half_bits) - 1;
+    int64_t sub = (index & (half_count - 1)) + half_count;
+    if (bucket < 0)
+    {
+        sub -= half_count;
+        bucket = 0;
+    }
+    return sub << bucket;
+}
+
+int64_t hdr_histogram::highest_equivalent(int64_t value) const
+{
+    int64_t lowest = value_from_index(counts_index(value));
+    return lowest + ((int64_t)1 << bucket_index(value)) - 1;
+}
+
+void hdr_histogram::record(int64_t value, int64_t count)
+{
+    if (value < 0)
+    {
+        value = 0;
+    }
+    else if (value > m_highest_value)
+    {
+        value = m_highest_value;
+    }
+    m_counts[counts_index(value)] += count;
+    m_total_count += count;
+    m_sum += (double)value * count;
+    if (value < m_min)
+    {
+        m_min = value;
+    }
+    if (value > m_max)
+    {
+        m_max = value;
+    }
+}
+
+bool hdr_histogram::merge(const hdr_histogram &other)
+{
+    if (other.m_sub_bucket_bits != m_sub_bucket_bits || other.m_counts.size() != m_counts.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < m_counts.size(); i++)
+    {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_total_count += other.m_total_count;
+    m_sum += other.m_sum;
+    if (other.m_min < m_min)
+    {
+        m_min = other.m_min;
+    }
+    if (other.m_max > m_max)
+    {
+        m_max = other.m_max;
+    }
+    return true;
+}
+
+bool hdr_histogram::subtract(const hdr_histogram &other)
+{
+    if (other.m_sub_bucket_bits != m_sub_bucket_bits || other.m_counts.size() != m_counts.size())
+    {
+        return false;
+    }
+    // 最小/最大值无法相减得到，按剩下的计数重新求出(精确到桶)
+    m_min = INT64_MAX;
+    m_max = 0;
+    for (size_t i = 0; i < m_counts.size(); i++)
+    {
+        m_counts[i] -= other.m_counts[i];
+        if (m_counts[i] > 0)
+        {
+            int64_t lowest = value_from_index((int)i);
+            if (lowest < m_min)
+            {
+                m_min = lowest;
+            }
+            m_max = highest_equivalent(lowest);
+        }
+    }
+    m_total_count -= other.m_total_count;
+    m_sum -= other.m_sum;
+    return true;
+}
+
+void hdr_histogram::reset()
+{
+    m_counts.assign(m_counts.size(), 0);
+    m_total_count = 0;
+    m_min = INT64_MAX;
+    m_max = 0;
+    m_sum = 0;
+}
+
+int64_t hdr_histogram::min() const
+{
+    return m_total_count == 0 ? 0 : m_min;
+}
+
+int64_t hdr_histogram::max() const
+{
+    return m_max;
+}
+
+double hdr_histogram::mean() const
+{
+    return m_total_count == 0 ? 0 : m_sum / m_total_count;
+}
+
+int64_t hdr_histogram::value_at_percentile(double percentile) const
+{
+    if (m_total_count == 0)
+    {
+        return 0;
+    }
+    if (percentile > 100)
+    {
+        percentile = 100;
+    }
+    // 第target个(从1开始)值所在的桶；先乘后除，99.9/100之类的商不能精确表示，向上取整会多出一个
+    int64_t target = (int64_t)ceil(percentile * m_total_count / 100.0);
+    if (target < 1)
+    {
+        target = 1;
+    }
+    int64_t seen = 0;
+    for (size_t i = 0; i < m_counts.size(); i++)
+    {
+        seen += m_counts[i];
+        if (seen >= target)
+        {
+            int64_t value = highest_equivalent(value_from_index((int)i));
+            return value < m_max ? value : m_max;
+        }
+    }
+    return m_max;
+}
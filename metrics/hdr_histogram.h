@@ -0,0 +1,65 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+#include <stdint.h>
+#include <vector>
+
+/*
+    HDR(High Dynamic Range)直方图，用于记录延迟分布并计算分位数
+
+    值域按2的幂分成若干段，每段再线性细分为同样多的子桶，
+    因此任意量级的值都能保持相同的相对精度(significant_digits位有效数字)，
+    而内存只随量级的对数增长：1us~1小时、3位有效数字只需几十KB。
+    记录一个值只是一次计数自增，不做任何分配。
+
+    不是线程安全的：每个线程各自记录，需要汇总时用merge合并
+*/
+class hdr_histogram
+{
+public:
+    /*
+        param:
+            highest_value: 可记录的最大值，更大的值按它记录
+            significant_digits: 有效数字位数，1~5
+    */
+    hdr_histogram(int64_t highest_value, int significant_digits);
+    // 记录count次值value，负数按0记录
+    void record(int64_t value, int64_t count = 1);
+    // 把另一个参数相同的直方图的计数累加进来，参数不同返回false
+    bool merge(const hdr_histogram &other);
+    /*
+        减去另一个参数相同的直方图的计数，用于由两次累计快照得到这段时间内的分布，
+        other必须是本直方图更早的快照；参数不同返回false
+    */
+    bool subtract(const hdr_histogram &other);
+    void reset();
+
+    int64_t total_count() const { return m_total_count; }
+    int64_t min() const;
+    int64_t max() const;
+    double mean() const;
+    // 返回percentile(0~100)分位上的值，落在同一个桶内的值视为相等，返回桶的上界
+    int64_t value_at_percentile(double percentile) const;
+
+private:
+    int bucket_index(int64_t value) const;
+    int counts_index(int64_t value) const;
+    int64_t value_from_index(int index) const;
+    // 与value落在同一个桶内的最大值
+    int64_t highest_equivalent(int64_t value) const;
+
+private:
+    int64_t m_highest_value;
+    int m_significant_digits;
+    // 每段的子桶数为2^m_sub_bucket_bits，后一半子桶与下一段不重叠
+    int m_sub_bucket_bits;
+    int64_t m_sub_bucket_count;
+    int64_t m_sub_bucket_mask;
+    std::vector<int64_t> m_counts;
+    int64_t m_total_count;
+    int64_t m_min;
+    int64_t m_max;
+    // 按记录的原值累加，用于计算平均值
+    double m_sum;
+};
+
+#endif
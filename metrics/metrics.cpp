@@ -0,0 +1,233 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include "../thread_pool/locker.h"
+
+__thread metrics::shard *metrics::t_shard = NULL;
+__thread metrics::phase_set *metrics::t_phases = NULL;
+
+// 所有线程的分片组成的链表，分片在进程退出前不释放，退出的线程已记录的值仍然计入总和
+static std::atomic<void *> g_shards(NULL);
+
+// 所有线程的阶段直方图组成的链表，同样不释放
+static std::atomic<void *> g_phases(NULL);
+
+// 阶段耗时最大记录到60秒，2位有效数字(1%误差)，每个直方图约20KB
+static const int64_t PHASE_MAX_US = 60LL * 1000000;
+static const int PHASE_DIGITS = 2;
+static const char *phase_names[] = {"read", "queue", "parse", "handle", "write", "total"};
+// 抓取时输出的分位数
+static const double phase_quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+struct value_entry
+{
+    std::string name;
+    std::string help;
+    bool monotonic;
+    metrics::value_fn fn;
+    void *arg;
+};
+static locker g_value_lock;
+static std::vector<value_entry> g_values;
+
+// 与RESPONSES_200..RESPONSES_503一一对应
+static const int status_codes[] = {200, 400, 403, 404, 500, 503};
+static const int STATUS_CODE_NUM = sizeof(status_codes) / sizeof(status_codes[0]);
+
+struct counter_desc
+{
+    const char *name;
+    const char *help;
+};
+static const counter_desc counter_descs[] = {
+    {"webserver_connections_accepted_total", "Accepted client connections."},
+    {"webserver_connections_rejected_total", "Client connections closed at accept because the server was full."},
+    {"webserver_connections_closed_total", "Closed client connections."},
+    {"webserver_bytes_received_total", "Bytes read from client sockets."},
+    {"webserver_bytes_sent_total", "Bytes written to client sockets."},
+    {"webserver_db_pool_acquires_total", "Connections taken from the shared MySQL pool."},
+    {"webserver_db_pool_waits_total", "Shared MySQL pool acquisitions that had to wait for a free connection."},
+    {"webserver_shed_queue_depth_total", "Requests answered with 503 because the thread pool queue was too deep."},
+    {"webserver_shed_queue_delay_total", "Requests answered with 503 because requests were waiting too long in the queue."},
+    {"webserver_shed_pool_full_total", "Requests answered with 503 because the thread pool queue was full."},
+    {"webserver_static_cache_hits_total", "Static files sent from the in-memory cache."},
+    {"webserver_static_cache_misses_total", "Static files sent by mmap because they could not be cached."},
+    {"webserver_inline_responses_total", "Requests answered on the event loop thread without going through the thread pool."},
+};
+
+metrics::shard *metrics::local_shard()
+{
+    void *mem = NULL;
+    if (posix_memalign(&mem, 64, sizeof(shard)) != 0)
+    {
+        abort();
+    }
+    shard *s = new (mem) shard;
+    for (int i = 0; i < COUNTER_NUM; i++)
+    {
+        s->counters[i].store(0, std::memory_order_relaxed);
+    }
+    // 无锁地挂到链表头，抓取线程只会从表头往后读
+    void *head = g_shards.load(std::memory_order_acquire);
+    do
+    {
+        s->next = (shard *)head;
+    } while (!g_shards.compare_exchange_weak(head, s, std::memory_order_release, std::memory_order_acquire));
+    t_shard = s;
+    return s;
+}
+
+metrics::phase_set *metrics::local_phases()
+{
+    phase_set *p = new phase_set;
+    for (int i = 0; i < PHASE_NUM; i++)
+    {
+        p->hist[i] = new_phase_histogram();
+    }
+    void *head = g_phases.load(std::memory_order_acquire);
+    do
+    {
+        p->next = (phase_set *)head;
+    } while (!g_phases.compare_exchange_weak(head, p, std::memory_order_release, std::memory_order_acquire));
+    t_phases = p;
+    return p;
+}
+
+hdr_histogram *metrics::new_phase_histogram()
+{
+    return new hdr_histogram(PHASE_MAX_US, PHASE_DIGITS);
+}
+
+const char *metrics::phase_name(int phase)
+{
+    return phase >= 0 && phase < PHASE_NUM ? phase_names[phase] : "unknown";
+}
+
+void metrics::record_phase(int phase, long long us)
+{
+    phase_set *p = t_phases != NULL ? t_phases : local_phases();
+    // 只有本线程和偶尔的抓取线程会加这把锁
+    p->lock.lock();
+    p->hist[phase]->record(us);
+    p->lock.unlock();
+}
+
+void metrics::merge_phase(int phase, hdr_histogram &out)
+{
+    for (phase_set *p = (phase_set *)g_phases.load(std::memory_order_acquire); p != NULL; p = p->next)
+    {
+        p->lock.lock();
+        out.merge(*p->hist[phase]);
+        p->lock.unlock();
+    }
+}
+
+void metrics::add_response(int status)
+{
+    for (int i = 0; i < STATUS_CODE_NUM; i++)
+    {
+        if (status_codes[i] == status)
+        {
+            add(RESPONSES_200 + i);
+            return;
+        }
+    }
+    add(RESPONSES_OTHER);
+}
+
+void metrics::register_value(const char *name, const char *help, bool monotonic, value_fn fn, void *arg)
+{
+    value_entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.monotonic = monotonic;
+    entry.fn = fn;
+    entry.arg = arg;
+    g_value_lock.lock();
+    g_values.push_back(entry);
+    g_value_lock.unlock();
+}
+
+long long metrics::total(int counter)
+{
+    long long sum = 0;
+    for (shard *s = (shard *)g_shards.load(std::memory_order_acquire); s != NULL; s = s->next)
+    {
+        sum += s->counters[counter].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+// 追加一个不带标签的指标
+static void append_metric(std::string &out, const char *name, const char *help, const char *type, long long value)
+{
+    char line[512];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %lld\n", name, help, name, type, name, value);
+    out += line;
+}
+
+std::string metrics::render()
+{
+    // 先对所有分片一次性求和，各个计数器来自同一轮遍历
+    long long totals[COUNTER_NUM] = {0};
+    for (shard *s = (shard *)g_shards.load(std::memory_order_acquire); s != NULL; s = s->next)
+    {
+        for (int i = 0; i < COUNTER_NUM; i++)
+        {
+            totals[i] += s->counters[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::string out;
+    out.reserve(4096);
+    for (int i = 0; i < RESPONSES_200; i++)
+    {
+        append_metric(out, counter_descs[i].name, counter_descs[i].help, "counter", totals[i]);
+    }
+    out += "# HELP webserver_http_responses_total Completed HTTP responses by status code.\n"
+           "# TYPE webserver_http_responses_total counter\n";
+    char line[256];
+    for (int i = 0; i < STATUS_CODE_NUM; i++)
+    {
+        snprintf(line, sizeof(line), "webserver_http_responses_total{status=\"%d\"} %lld\n",
+                 status_codes[i], totals[RESPONSES_200 + i]);
+        out += line;
+    }
+    snprintf(line, sizeof(line), "webserver_http_responses_total{status=\"other\"} %lld\n", totals[RESPONSES_OTHER]);
+    out += line;
+
+    // 各阶段耗时按summary输出，单位为秒，分位数是进程启动以来的累计分布
+    out += "# HELP webserver_request_phase_seconds Time spent in each phase of a request.\n"
+           "# TYPE webserver_request_phase_seconds summary\n";
+    hdr_histogram *merged = new_phase_histogram();
+    for (int phase = 0; phase < PHASE_NUM; phase++)
+    {
+        merged->reset();
+        merge_phase(phase, *merged);
+        for (size_t q = 0; q < sizeof(phase_quantiles) / sizeof(phase_quantiles[0]); q++)
+        {
+            snprintf(line, sizeof(line), "webserver_request_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.6f\n",
+                     phase_names[phase], phase_quantiles[q],
+                     merged->value_at_percentile(phase_quantiles[q] * 100) / 1e6);
+            out += line;
+        }
+        snprintf(line, sizeof(line), "webserver_request_phase_seconds_sum{phase=\"%s\"} %.6f\n",
+                 phase_names[phase], merged->mean() * merged->total_count() / 1e6);
+        out += line;
+        snprintf(line, sizeof(line), "webserver_request_phase_seconds_count{phase=\"%s\"} %lld\n",
+                 phase_names[phase], (long long)merged->total_count());
+        out += line;
+    }
+    delete merged;
+
+    g_value_lock.lock();
+    for (size_t i = 0; i < g_values.size(); i++)
+    {
+        const value_entry &v = g_values[i];
+        append_metric(out, v.name.c_str(), v.help.c_str(), v.monotonic ? "counter" : "gauge", v.fn(v.arg));
+    }
+    g_value_lock.unlock();
+    return out;
+}
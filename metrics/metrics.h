@@ -0,0 +1,128 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <atomic>
+#include <string>
+#include "hdr_histogram.h"
+#include "../thread_pool/locker.h"
+
+/*
+    运行时指标
+
+    计数器按线程分片：每个线程第一次记录时分配一个独占的、按缓存行对齐的分片，
+    之后只写自己的分片(一次relaxed读+一次relaxed写，没有锁也没有原子读改写指令)，
+    不同线程之间不会争用同一条缓存行。只有抓取时才遍历所有分片求和，
+    因此请求路径上记录指标的开销与线程数无关。
+
+    队列长度、连接数这类瞬时量，以及其他模块自己维护的计数(如日志丢弃的行数)不在这里累加，
+    而是注册一个回调，在抓取时读取当前值。
+    请求各阶段的耗时记录在按线程分配的HDR直方图中，每个线程的直方图由它自己的锁保护，
+    平时只有本线程加锁(无竞争)，只在抓取/汇总时才会与抓取线程短暂竞争。
+
+    render()按Prometheus文本格式(0.0.4)输出全部指标
+*/
+class metrics
+{
+public:
+    enum COUNTER
+    {
+        CONN_ACCEPTED = 0,  // 接受的连接数
+        CONN_REJECTED,      // 连接数已满而被拒绝的连接数
+        CONN_CLOSED,        // 关闭的连接数
+        BYTES_IN,           // 从客户端读到的字节数
+        BYTES_OUT,          // 发给客户端的字节数
+        DB_POOL_ACQUIRES,   // 从共享数据库连接池取连接的次数
+        DB_POOL_WAITS,      // 其中因为没有空闲连接而需要等待的次数
+        SHED_QUEUE_DEPTH,   // 因线程池排队数超过阈值而回复503的请求数
+        SHED_QUEUE_DELAY,   // 因排队时间超过阈值而回复503的请求数
+        SHED_POOL_FULL,     // 因线程池队列已满、无法入队而回复503的请求数
+        STATIC_CACHE_HITS,  // 从静态文件缓存发送的文件数
+        STATIC_CACHE_MISSES,// 没有缓存(文件过大或缓存已满)而mmap发送的文件数
+        INLINE_RESPONSES,   // 在主线程快路径上直接生成响应、不经过线程池的请求数
+        // 按状态码统计的响应数，与status_codes一一对应，最后一个为其他状态码
+        RESPONSES_200,
+        RESPONSES_400,
+        RESPONSES_403,
+        RESPONSES_404,
+        RESPONSES_500,
+        RESPONSES_503,
+        RESPONSES_OTHER,
+        COUNTER_NUM
+    };
+
+    /*
+        一个请求经过的阶段，时间点依次为：
+            开始读请求 -> 读完(交给线程池) -> 工作线程取出 -> 解析完 -> 响应生成完 -> 响应发送完
+        PHASE_READ:   读请求，请求分多次到达时包含等待后续数据的时间
+        PHASE_QUEUE:  在线程池队列中等待
+        PHASE_PARSE:  解析请求
+        PHASE_HANDLE: 执行请求(定位文件/mmap，登录注册访问数据库)并生成响应头
+        PHASE_WRITE:  等待可写并发送响应
+        PHASE_TOTAL:  从开始读到发送完的总耗时
+    */
+    enum PHASE
+    {
+        PHASE_READ = 0,
+        PHASE_QUEUE,
+        PHASE_PARSE,
+        PHASE_HANDLE,
+        PHASE_WRITE,
+        PHASE_TOTAL,
+        PHASE_NUM
+    };
+
+    // 取值回调，在抓取时调用
+    typedef long long (*value_fn)(void *arg);
+
+    static void add(int counter, long long value = 1)
+    {
+        shard *s = t_shard != NULL ? t_shard : local_shard();
+        // 分片只有本线程写，读改写不需要原子指令；抓取线程的relaxed读保证读到完整的值
+        s->counters[counter].store(s->counters[counter].load(std::memory_order_relaxed) + value,
+                                   std::memory_order_relaxed);
+    }
+    // 记录一个已完成响应的状态码
+    static void add_response(int status);
+    /*
+        注册一个回调取值的指标，name需符合Prometheus的命名规则，
+        monotonic为true表示只增不减(按counter输出)，否则按gauge输出；
+        应在启动阶段注册完毕
+    */
+    static void register_value(const char *name, const char *help, bool monotonic, value_fn fn, void *arg);
+    // 某个计数器在所有线程上的总和
+    static long long total(int counter);
+    // 在当前线程的直方图中记录某个阶段的耗时(微秒)
+    static void record_phase(int phase, long long us);
+    // 把所有线程中某个阶段的直方图累加到out中，out需由new_phase_histogram创建
+    static void merge_phase(int phase, hdr_histogram &out);
+    // 创建一个与阶段直方图参数相同的空直方图，由调用者释放
+    static hdr_histogram *new_phase_histogram();
+    static const char *phase_name(int phase);
+    // 按Prometheus文本格式输出全部指标
+    static std::string render();
+
+private:
+    // 每个线程一个分片，对齐到缓存行，与其他线程的分片不共享缓存行
+    struct alignas(64) shard
+    {
+        std::atomic<long long> counters[COUNTER_NUM];
+        shard *next;
+    };
+
+    // 每个线程一组阶段直方图
+    struct phase_set
+    {
+        locker lock;
+        hdr_histogram *hist[PHASE_NUM];
+        phase_set *next;
+    };
+
+    // 为当前线程分配并登记分片
+    static shard *local_shard();
+    static phase_set *local_phases();
+
+private:
+    static __thread shard *t_shard;
+    static __thread phase_set *t_phases;
+};
+
+#endif
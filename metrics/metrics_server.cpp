@@ -0,0 +1,169 @@
+#include "metrics_server.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <string>
+#include "metrics.h"
+
+// 抓取请求的读写超时，慢客户端不会一直占住服务线程
+static const int METRICS_IO_TIMEOUT_MS = 2000;
+
+metrics_server::metrics_server() : m_listenfd(-1), m_thread(0), m_running(false)
+{
+    m_wakeup[0] = m_wakeup[1] = -1;
+}
+
+metrics_server::~metrics_server()
+{
+    stop();
+}
+
+bool metrics_server::start(const char *ip, int port)
+{
+    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (m_listenfd < 0)
+    {
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr.s_addr);
+    address.sin_port = htons(port);
+    if (bind(m_listenfd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(m_listenfd, 16) < 0 ||
+        pipe(m_wakeup) < 0)
+    {
+        close(m_listenfd);
+        m_listenfd = -1;
+        return false;
+    }
+    if (pthread_create(&m_thread, NULL, work, this) != 0)
+    {
+        close(m_listenfd);
+        close(m_wakeup[0]);
+        close(m_wakeup[1]);
+        m_listenfd = m_wakeup[0] = m_wakeup[1] = -1;
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void metrics_server::stop()
+{
+    if (!m_running)
+    {
+        return;
+    }
+    char c = 0;
+    if (::write(m_wakeup[1], &c, 1) < 0)
+    {
+        perror("metrics_server wakeup");
+    }
+    pthread_join(m_thread, NULL);
+    close(m_listenfd);
+    close(m_wakeup[0]);
+    close(m_wakeup[1]);
+    m_listenfd = m_wakeup[0] = m_wakeup[1] = -1;
+    m_running = false;
+}
+
+void *metrics_server::work(void *arg)
+{
+    ((metrics_server *)arg)->run();
+    return NULL;
+}
+
+void metrics_server::run()
+{
+    struct pollfd fds[2];
+    fds[0].fd = m_listenfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wakeup[0];
+    fds[1].events = POLLIN;
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept(m_listenfd, NULL, NULL);
+            if (fd >= 0)
+            {
+                serve(fd);
+                close(fd);
+            }
+        }
+    }
+}
+
+void metrics_server::serve(int fd)
+{
+    struct timeval tv;
+    tv.tv_sec = METRICS_IO_TIMEOUT_MS / 1000;
+    tv.tv_usec = (METRICS_IO_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // 只需要请求行，读到第一个换行即可
+    char request[1024];
+    int len = 0;
+    while (len < (int)sizeof(request) - 1 && memchr(request, '\n', len) == NULL)
+    {
+        int n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n <= 0)
+        {
+            return;
+        }
+        len += n;
+    }
+    request[len] = '\0';
+
+    std::string body;
+    const char *status = "200 OK";
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0)
+    {
+        body = metrics::render();
+    }
+    else
+    {
+        status = "404 Not Found";
+        body = "try GET /metrics\n";
+    }
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 %s\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n",
+                              status, body.size());
+    std::string response(header, header_len);
+    response += body;
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+        ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return;
+        }
+        sent += n;
+    }
+}
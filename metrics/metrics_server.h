@@ -0,0 +1,36 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+#include <pthread.h>
+
+/*
+    指标抓取端口
+
+    在独立的管理端口上用一个专门的线程提供 GET /metrics，返回metrics::render()的内容，
+    其余路径返回404。抓取不经过主线程的epoll和线程池，
+    服务器过载、线程池排满时依然能抓到指标；抓取一次只有这个线程做求和，不影响请求路径
+*/
+class metrics_server
+{
+public:
+    metrics_server();
+    ~metrics_server();
+    // 监听ip:port并启动服务线程，失败返回false
+    bool start(const char *ip, int port);
+    // 关闭监听套接字并等待服务线程退出
+    void stop();
+
+private:
+    static void *work(void *arg);
+    void run();
+    // 处理一个抓取连接：读请求行，写响应后关闭
+    void serve(int fd);
+
+private:
+    int m_listenfd;
+    // 唤醒阻塞在poll上的服务线程，通知其退出
+    int m_wakeup[2];
+    pthread_t m_thread;
+    bool m_running;
+};
+
+#endif
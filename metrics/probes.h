@@ -0,0 +1,49 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+    USDT静态探针
+
+    编译时定义了WEBSERVER_USDT(CMake检测到sys/sdt.h且ENABLE_USDT打开时自动定义)，
+    探针展开为sys/sdt.h的DTRACE_PROBE，在代码中只留下一条nop指令，并在ELF的
+    .note.stapsdt段中记录探针位置和参数的取值方式；没有工具挂载时不执行任何额外操作。
+    未定义时探针展开为空语句，完全不参与编译。
+
+    参数求值的代价仍然由调用方承担，所以探针的参数只使用手边现成的值(fd、返回码、
+    已经算好的长度等)，不要在参数里调用函数或取时间。
+
+    所有探针的provider都是webserver，例如：
+        bpftrace -e 'usdt:./app:webserver:write_done { @[arg1] = count(); }'
+        perf probe -x ./app sdt_webserver:accept
+*/
+#ifdef WEBSERVER_USDT
+#include <sys/sdt.h>
+#define TRACE_PROBE0(name) DTRACE_PROBE(webserver, name)
+#define TRACE_PROBE1(name, a1) DTRACE_PROBE1(webserver, name, a1)
+#define TRACE_PROBE2(name, a1, a2) DTRACE_PROBE2(webserver, name, a1, a2)
+#define TRACE_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(webserver, name, a1, a2, a3)
+#else
+#define TRACE_PROBE0(name) \
+    do                     \
+    {                      \
+    } while (0)
+#define TRACE_PROBE1(name, a1) TRACE_PROBE0(name)
+#define TRACE_PROBE2(name, a1, a2) TRACE_PROBE0(name)
+#define TRACE_PROBE3(name, a1, a2, a3) TRACE_PROBE0(name)
+#endif
+
+/*
+    探针一览(参数按顺序)：
+    accept(fd, 对端IPv4地址(网络字节序), 对端端口(网络字节序))   main 接受连接后
+    read_done(fd, 本次读到的字节数, 读缓存中的总字节数)           http_conn::read 读完
+    enqueue(任务指针, 入队后的队列长度)                           threadPool::append 入队后
+    dequeue(任务指针, 出队后的队列长度)                           threadPool::run 取出任务后
+    parse_done(fd, HTTP_CODE)                                     http_conn::process 解析完
+    do_request_done(fd, HTTP_CODE)                                http_conn::process 执行请求并生成响应后
+    write_done(fd, 状态码, 本次响应发送的字节数)                  http_conn::write 响应发送完
+    timer_expire(fd)                                              定时器到期关闭非活动连接时
+    close(fd)                                                     http_conn::close_conn 关闭连接时
+    任务指针即http_conn对象的地址，可以与其他探针的fd对应起来
+*/
+
+#endif
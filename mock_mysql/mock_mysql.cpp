@@ -0,0 +1,843 @@
+#include "mock_mysql.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// 协议常量，取值见MySQL源码 include/mysql_com.h
+static const uint32_t CLIENT_LONG_PASSWORD = 0x00000001;
+static const uint32_t CLIENT_FOUND_ROWS = 0x00000002;
+static const uint32_t CLIENT_LONG_FLAG = 0x00000004;
+static const uint32_t CLIENT_CONNECT_WITH_DB = 0x00000008;
+static const uint32_t CLIENT_PROTOCOL_41 = 0x00000200;
+static const uint32_t CLIENT_TRANSACTIONS = 0x00002000;
+static const uint32_t CLIENT_SECURE_CONNECTION = 0x00008000;
+static const uint32_t CLIENT_MULTI_STATEMENTS = 0x00010000;
+static const uint32_t CLIENT_MULTI_RESULTS = 0x00020000;
+static const uint32_t CLIENT_PLUGIN_AUTH = 0x00080000;
+static const uint32_t CLIENT_PLUGIN_AUTH_LENENC_DATA = 0x00200000;
+
+static const uint32_t SERVER_CAPABILITIES =
+    CLIENT_LONG_PASSWORD | CLIENT_FOUND_ROWS | CLIENT_LONG_FLAG |
+    CLIENT_CONNECT_WITH_DB | CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS |
+    CLIENT_SECURE_CONNECTION | CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS |
+    CLIENT_PLUGIN_AUTH | CLIENT_PLUGIN_AUTH_LENENC_DATA;
+
+static const uint16_t SERVER_STATUS_AUTOCOMMIT = 0x0002;
+static const uint8_t CHARSET_UTF8_GENERAL_CI = 0x21;
+static const uint8_t MYSQL_TYPE_VAR_STRING = 0xfd;
+
+static const uint8_t COM_QUIT = 0x01;
+static const uint8_t COM_INIT_DB = 0x02;
+static const uint8_t COM_QUERY = 0x03;
+static const uint8_t COM_PING = 0x0e;
+
+static const char *NATIVE_PASSWORD_PLUGIN = "mysql_native_password";
+
+/*
+    协议编码的小工具
+*/
+static void put_int(std::string &buf, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        buf.push_back((char)((v >> (8 * i)) & 0xff));
+    }
+}
+
+// length-encoded integer
+static void put_lenenc_int(std::string &buf, uint64_t v)
+{
+    if (v < 251)
+    {
+        put_int(buf, v, 1);
+    }
+    else if (v < (1 << 16))
+    {
+        buf.push_back((char)0xfc);
+        put_int(buf, v, 2);
+    }
+    else if (v < (1 << 24))
+    {
+        buf.push_back((char)0xfd);
+        put_int(buf, v, 3);
+    }
+    else
+    {
+        buf.push_back((char)0xfe);
+        put_int(buf, v, 8);
+    }
+}
+
+// length-encoded string
+static void put_lenenc_str(std::string &buf, const std::string &s)
+{
+    put_lenenc_int(buf, s.size());
+    buf += s;
+}
+
+static bool read_full(int fd, char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n == 0)
+        {
+            return false;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+    一个只够用的SQL词法分析：标识符/关键字、单引号字符串、单字符标点
+*/
+struct sql_token
+{
+    enum TYPE
+    {
+        WORD = 0,
+        STRING,
+        PUNCT,
+        END
+    };
+    TYPE type;
+    std::string text;
+};
+
+static bool tokenize(const std::string &sql, std::vector<sql_token> &tokens)
+{
+    size_t i = 0;
+    tokens.clear();
+    while (i < sql.size())
+    {
+        char c = sql[i];
+        if (isspace((unsigned char)c) || c == ';')
+        {
+            i++;
+        }
+        else if (isalnum((unsigned char)c) || c == '_' || c == '`')
+        {
+            sql_token tk;
+            tk.type = sql_token::WORD;
+            while (i < sql.size() && (isalnum((unsigned char)sql[i]) || sql[i] == '_' ||
+                                      sql[i] == '.' || sql[i] == '`'))
+            {
+                if (sql[i] != '`')
+                    tk.text.push_back(sql[i]);
+                i++;
+            }
+            tokens.push_back(tk);
+        }
+        else if (c == '\'' || c == '"')
+        {
+            // 字符串字面量，支持反斜杠转义和''连写
+            char quote = c;
+            sql_token tk;
+            tk.type = sql_token::STRING;
+            i++;
+            while (true)
+            {
+                if (i >= sql.size())
+                {
+                    return false;
+                }
+                if (sql[i] == '\\' && i + 1 < sql.size())
+                {
+                    char e = sql[i + 1];
+                    tk.text.push_back(e == 'n' ? '\n' : (e == '0' ? '\0' : e));
+                    i += 2;
+                }
+                else if (sql[i] == quote && i + 1 < sql.size() && sql[i + 1] == quote)
+                {
+                    tk.text.push_back(quote);
+                    i += 2;
+                }
+                else if (sql[i] == quote)
+                {
+                    i++;
+                    break;
+                }
+                else
+                {
+                    tk.text.push_back(sql[i++]);
+                }
+            }
+            tokens.push_back(tk);
+        }
+        else
+        {
+            sql_token tk;
+            tk.type = sql_token::PUNCT;
+            tk.text.push_back(c);
+            tokens.push_back(tk);
+            i++;
+        }
+    }
+    sql_token end;
+    end.type = sql_token::END;
+    tokens.push_back(end);
+    return true;
+}
+
+static bool is_word(const sql_token &tk, const char *word)
+{
+    return tk.type == sql_token::WORD && strcasecmp(tk.text.c_str(), word) == 0;
+}
+
+static bool is_punct(const sql_token &tk, char c)
+{
+    return tk.type == sql_token::PUNCT && tk.text[0] == c;
+}
+
+// user表只有两列，返回列下标，未知列返回-1
+static int column_index(const std::string &name)
+{
+    const char *p = strrchr(name.c_str(), '.');
+    const char *col = p ? p + 1 : name.c_str();
+    if (strcasecmp(col, "username") == 0)
+        return 0;
+    if (strcasecmp(col, "password") == 0)
+        return 1;
+    return -1;
+}
+
+mock_mysql_server::mock_mysql_server(const config &conf)
+    : m_conf(conf), m_listenfd(-1), m_next_conn_id(1),
+      m_stat_conns(0), m_stat_queries(0), m_stat_failed(0)
+{
+    char name[32];
+    for (int i = 0; i < m_conf.preload_users; i++)
+    {
+        snprintf(name, sizeof(name), "user%d", i);
+        add_user(name, "passwd");
+    }
+}
+
+mock_mysql_server::~mock_mysql_server()
+{
+    if (m_listenfd != -1)
+    {
+        close(m_listenfd);
+    }
+}
+
+void mock_mysql_server::add_user(const std::string &name, const std::string &pwd)
+{
+    m_table_lock.lock();
+    m_users.push_back(std::make_pair(name, pwd));
+    m_table_lock.unlock();
+}
+
+bool mock_mysql_server::run()
+{
+    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (m_listenfd == -1)
+    {
+        perror("socket");
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(m_conf.port);
+    if (bind(m_listenfd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(m_listenfd, 128) < 0)
+    {
+        perror("bind/listen");
+        return false;
+    }
+    printf("--mock mysql listening on port %d, latency %dms(+%dms), fail rate %.3f, %zu users\n",
+           m_conf.port, m_conf.latency_ms, m_conf.jitter_ms, m_conf.fail_rate, m_users.size());
+    while (true)
+    {
+        int cfd = accept(m_listenfd, NULL, NULL);
+        if (cfd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            return false;
+        }
+        int nodelay = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        session *s = new session;
+        s->server = this;
+        s->fd = cfd;
+        s->conn_id = m_next_conn_id++;
+        // 种子只和连接序号有关，保证相同的参数下每个连接的随机序列可复现
+        s->rand_state = m_conf.seed * 2654435761u + s->conn_id;
+        s->seq = 0;
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, serve, s) != 0)
+        {
+            close(cfd);
+            delete s;
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
+
+void mock_mysql_server::dump_stats()
+{
+    m_stat_lock.lock();
+    printf("--mock mysql: %lld connections, %lld queries, %lld injected failures\n",
+           m_stat_conns, m_stat_queries, m_stat_failed);
+    m_stat_lock.unlock();
+}
+
+void *mock_mysql_server::serve(void *arg)
+{
+    session *s = (session *)arg;
+    s->server->serve_session(s);
+    close(s->fd);
+    delete s;
+    return NULL;
+}
+
+void mock_mysql_server::serve_session(session *s)
+{
+    m_stat_lock.lock();
+    m_stat_conns++;
+    m_stat_lock.unlock();
+    if (!handshake(s))
+    {
+        return;
+    }
+    std::string payload;
+    while (true)
+    {
+        // 每条命令的序号都从0开始，read_packet会据此设置回复的序号
+        if (!read_packet(s, payload) || payload.empty())
+        {
+            return;
+        }
+        uint8_t cmd = (uint8_t)payload[0];
+        bool ok = true;
+        switch (cmd)
+        {
+        case COM_QUIT:
+            return;
+        case COM_INIT_DB:
+        case COM_PING:
+            ok = send_ok(s, 0);
+            break;
+        case COM_QUERY:
+            ok = handle_query(s, payload.substr(1));
+            break;
+        default:
+            ok = send_err(s, 1047, "08S01", "Unknown command");
+            break;
+        }
+        if (!ok)
+        {
+            return;
+        }
+    }
+}
+
+bool mock_mysql_server::handshake(session *s)
+{
+    // 20字节的挑战随机数，由于不校验密码，内容无所谓，但不能含0
+    char scramble[21];
+    for (int i = 0; i < 20; i++)
+    {
+        scramble[i] = (char)('a' + rand_r(&s->rand_state) % 26);
+    }
+    scramble[20] = '\0';
+
+    // Protocol::HandshakeV10
+    std::string hs;
+    put_int(hs, 10, 1);
+    hs += "5.7.29-mock";
+    hs.push_back('\0');
+    put_int(hs, s->conn_id, 4);
+    hs.append(scramble, 8);
+    hs.push_back('\0');
+    put_int(hs, SERVER_CAPABILITIES & 0xffff, 2);
+    put_int(hs, CHARSET_UTF8_GENERAL_CI, 1);
+    put_int(hs, SERVER_STATUS_AUTOCOMMIT, 2);
+    put_int(hs, SERVER_CAPABILITIES >> 16, 2);
+    put_int(hs, 21, 1);
+    hs.append(10, '\0');
+    hs.append(scramble + 8, 12);
+    hs.push_back('\0');
+    hs += NATIVE_PASSWORD_PLUGIN;
+    hs.push_back('\0');
+    if (!write_packet(s, hs))
+    {
+        return false;
+    }
+
+    // Protocol::HandshakeResponse41，只关心客户端要求的认证插件
+    std::string resp;
+    if (!read_packet(s, resp) || resp.size() < 32)
+    {
+        return false;
+    }
+    uint32_t client_flags = (uint8_t)resp[0] | ((uint8_t)resp[1] << 8) |
+                            ((uint8_t)resp[2] << 16) | ((uint32_t)(uint8_t)resp[3] << 24);
+    size_t pos = 32;
+    // 用户名
+    size_t end = resp.find('\0', pos);
+    if (end == std::string::npos)
+    {
+        return false;
+    }
+    pos = end + 1;
+    // 认证数据
+    if (pos < resp.size())
+    {
+        size_t auth_len = (uint8_t)resp[pos];
+        pos += 1 + auth_len;
+    }
+    // 库名
+    if ((client_flags & CLIENT_CONNECT_WITH_DB) && pos < resp.size())
+    {
+        end = resp.find('\0', pos);
+        pos = (end == std::string::npos) ? resp.size() : end + 1;
+    }
+    std::string plugin;
+    if ((client_flags & CLIENT_PLUGIN_AUTH) && pos < resp.size())
+    {
+        end = resp.find('\0', pos);
+        plugin = resp.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    }
+    if (!plugin.empty() && plugin != NATIVE_PASSWORD_PLUGIN)
+    {
+        // 客户端默认用了别的插件(如8.0的caching_sha2_password)，要求其切换
+        std::string sw;
+        sw.push_back((char)0xfe);
+        sw += NATIVE_PASSWORD_PLUGIN;
+        sw.push_back('\0');
+        sw.append(scramble, 20);
+        sw.push_back('\0');
+        if (!write_packet(s, sw) || !read_packet(s, resp))
+        {
+            return false;
+        }
+    }
+    return send_ok(s, 0);
+}
+
+void mock_mysql_server::inject_latency(session *s)
+{
+    int delay_ms = m_conf.latency_ms;
+    if (m_conf.jitter_ms > 0)
+    {
+        delay_ms += rand_r(&s->rand_state) % (m_conf.jitter_ms + 1);
+    }
+    if (delay_ms > 0)
+    {
+        usleep(delay_ms * 1000);
+    }
+}
+
+bool mock_mysql_server::should_fail(session *s)
+{
+    if (m_conf.fail_rate <= 0)
+    {
+        return false;
+    }
+    return (rand_r(&s->rand_state) / (RAND_MAX + 1.0)) < m_conf.fail_rate;
+}
+
+bool mock_mysql_server::handle_query(session *s, const std::string &sql)
+{
+    m_stat_lock.lock();
+    m_stat_queries++;
+    m_stat_lock.unlock();
+    inject_latency(s);
+    if (should_fail(s))
+    {
+        m_stat_lock.lock();
+        m_stat_failed++;
+        m_stat_lock.unlock();
+        return send_err(s, 1205, "HY000", "Lock wait timeout exceeded (injected by mock)");
+    }
+
+    size_t start = 0;
+    while (start < sql.size() && isspace((unsigned char)sql[start]))
+    {
+        start++;
+    }
+    if (strncasecmp(sql.c_str() + start, "SELECT", 6) == 0)
+    {
+        return exec_select(s, sql);
+    }
+    if (strncasecmp(sql.c_str() + start, "INSERT", 6) == 0)
+    {
+        return exec_insert(s, sql);
+    }
+    // SET NAMES / BEGIN / COMMIT 之类的语句都当作成功
+    return send_ok(s, 0);
+}
+
+bool mock_mysql_server::exec_select(session *s, const std::string &sql)
+{
+    std::vector<sql_token> tk;
+    if (!tokenize(sql, tk))
+    {
+        return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+    }
+    size_t i = 1;
+    // 选择的列
+    std::vector<int> cols;
+    std::vector<std::string> col_names;
+    while (tk[i].type != sql_token::END && !is_word(tk[i], "FROM"))
+    {
+        if (is_punct(tk[i], '*'))
+        {
+            cols.push_back(0);
+            cols.push_back(1);
+            col_names.push_back("username");
+            col_names.push_back("password");
+        }
+        else if (tk[i].type == sql_token::WORD)
+        {
+            int idx = column_index(tk[i].text);
+            if (idx < 0)
+            {
+                return send_err(s, 1054, "42S22", "Unknown column in 'field list'");
+            }
+            cols.push_back(idx);
+            col_names.push_back(idx == 0 ? "username" : "password");
+        }
+        i++;
+    }
+    if (!is_word(tk[i], "FROM") || tk[i + 1].type != sql_token::WORD)
+    {
+        return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+    }
+    i += 2;
+
+    // WHERE条件：col = 'v' 或 col IN ('a','b',...)，以AND连接
+    std::vector<std::pair<int, std::vector<std::string> > > conds;
+    if (is_word(tk[i], "WHERE"))
+    {
+        i++;
+        while (true)
+        {
+            if (tk[i].type != sql_token::WORD || column_index(tk[i].text) < 0)
+            {
+                return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+            }
+            std::pair<int, std::vector<std::string> > cond;
+            cond.first = column_index(tk[i].text);
+            i++;
+            if (is_punct(tk[i], '=') && tk[i + 1].type == sql_token::STRING)
+            {
+                cond.second.push_back(tk[i + 1].text);
+                i += 2;
+            }
+            else if (is_word(tk[i], "IN") && is_punct(tk[i + 1], '('))
+            {
+                i += 2;
+                while (tk[i].type == sql_token::STRING)
+                {
+                    cond.second.push_back(tk[i].text);
+                    i++;
+                    if (is_punct(tk[i], ','))
+                        i++;
+                }
+                if (!is_punct(tk[i], ')'))
+                {
+                    return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+                }
+                i++;
+            }
+            else
+            {
+                return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+            }
+            conds.push_back(cond);
+            if (!is_word(tk[i], "AND"))
+                break;
+            i++;
+        }
+    }
+
+    std::vector<row_t> rows;
+    m_table_lock.lock();
+    for (size_t r = 0; r < m_users.size(); r++)
+    {
+        const std::string *fields[2] = {&m_users[r].first, &m_users[r].second};
+        bool match = true;
+        for (size_t c = 0; c < conds.size() && match; c++)
+        {
+            bool any = false;
+            for (size_t v = 0; v < conds[c].second.size(); v++)
+            {
+                if (*fields[conds[c].first] == conds[c].second[v])
+                {
+                    any = true;
+                    break;
+                }
+            }
+            match = any;
+        }
+        if (!match)
+            continue;
+        row_t row;
+        for (size_t c = 0; c < cols.size(); c++)
+        {
+            row.push_back(*fields[cols[c]]);
+        }
+        rows.push_back(row);
+    }
+    m_table_lock.unlock();
+    return send_result_set(s, col_names, rows);
+}
+
+bool mock_mysql_server::exec_insert(session *s, const std::string &sql)
+{
+    std::vector<sql_token> tk;
+    if (!tokenize(sql, tk))
+    {
+        return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+    }
+    size_t i = 1;
+    bool ignore = false;
+    if (is_word(tk[i], "IGNORE"))
+    {
+        ignore = true;
+        i++;
+    }
+    if (!is_word(tk[i], "INTO") || tk[i + 1].type != sql_token::WORD)
+    {
+        return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+    }
+    i += 2;
+    // 列清单，缺省为(username,password)
+    std::vector<int> cols;
+    if (is_punct(tk[i], '('))
+    {
+        i++;
+        while (tk[i].type == sql_token::WORD)
+        {
+            int idx = column_index(tk[i].text);
+            if (idx < 0)
+            {
+                return send_err(s, 1054, "42S22", "Unknown column in 'field list'");
+            }
+            cols.push_back(idx);
+            i++;
+            if (is_punct(tk[i], ','))
+                i++;
+        }
+        if (!is_punct(tk[i], ')'))
+        {
+            return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+        }
+        i++;
+    }
+    else
+    {
+        cols.push_back(0);
+        cols.push_back(1);
+    }
+    if (!is_word(tk[i], "VALUES"))
+    {
+        return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+    }
+    i++;
+    std::vector<std::pair<std::string, std::string> > new_rows;
+    while (is_punct(tk[i], '('))
+    {
+        i++;
+        std::string fields[2];
+        size_t n = 0;
+        while (tk[i].type == sql_token::STRING && n < cols.size())
+        {
+            fields[cols[n++]] = tk[i].text;
+            i++;
+            if (is_punct(tk[i], ','))
+                i++;
+        }
+        if (n != cols.size() || !is_punct(tk[i], ')'))
+        {
+            return send_err(s, 1136, "21S01", "Column count doesn't match value count");
+        }
+        i++;
+        new_rows.push_back(std::make_pair(fields[0], fields[1]));
+        if (is_punct(tk[i], ','))
+            i++;
+    }
+    if (new_rows.empty())
+    {
+        return send_err(s, 1064, "42000", "You have an error in your SQL syntax");
+    }
+
+    /*
+        README中的建表语句没有唯一键，普通INSERT总是成功；
+        INSERT IGNORE则按username唯一处理，已存在的行被跳过且不计入影响行数
+    */
+    uint64_t affected = 0;
+    m_table_lock.lock();
+    for (size_t r = 0; r < new_rows.size(); r++)
+    {
+        bool exists = false;
+        if (ignore)
+        {
+            for (size_t u = 0; u < m_users.size(); u++)
+            {
+                if (m_users[u].first == new_rows[r].first)
+                {
+                    exists = true;
+                    break;
+                }
+            }
+        }
+        if (!exists)
+        {
+            m_users.push_back(new_rows[r]);
+            affected++;
+        }
+    }
+    m_table_lock.unlock();
+    return send_ok(s, affected);
+}
+
+bool mock_mysql_server::read_packet(session *s, std::string &payload)
+{
+    unsigned char header[4];
+    if (!read_full(s->fd, (char *)header, 4))
+    {
+        return false;
+    }
+    size_t len = header[0] | (header[1] << 8) | (header[2] << 16);
+    s->seq = header[3] + 1;
+    payload.resize(len);
+    if (len == 0)
+    {
+        return true;
+    }
+    return read_full(s->fd, &payload[0], len);
+}
+
+bool mock_mysql_server::write_packet(session *s, const std::string &payload)
+{
+    std::string buf;
+    put_int(buf, payload.size(), 3);
+    put_int(buf, s->seq++, 1);
+    buf += payload;
+    return write_full(s->fd, buf.data(), buf.size());
+}
+
+bool mock_mysql_server::send_ok(session *s, uint64_t affected_rows)
+{
+    std::string ok;
+    ok.push_back('\0');
+    put_lenenc_int(ok, affected_rows);
+    put_lenenc_int(ok, 0); // last insert id
+    put_int(ok, SERVER_STATUS_AUTOCOMMIT, 2);
+    put_int(ok, 0, 2); // warnings
+    return write_packet(s, ok);
+}
+
+bool mock_mysql_server::send_err(session *s, uint16_t code, const char *state, const char *msg)
+{
+    std::string err;
+    err.push_back((char)0xff);
+    put_int(err, code, 2);
+    err.push_back('#');
+    err.append(state, 5);
+    err += msg;
+    return write_packet(s, err);
+}
+
+bool mock_mysql_server::send_eof(session *s)
+{
+    std::string eof;
+    eof.push_back((char)0xfe);
+    put_int(eof, 0, 2); // warnings
+    put_int(eof, SERVER_STATUS_AUTOCOMMIT, 2);
+    return write_packet(s, eof);
+}
+
+bool mock_mysql_server::send_result_set(session *s, const std::vector<std::string> &columns,
+                                        const std::vector<row_t> &rows)
+{
+    std::string pkt;
+    put_lenenc_int(pkt, columns.size());
+    if (!write_packet(s, pkt))
+    {
+        return false;
+    }
+    // Protocol::ColumnDefinition41
+    for (size_t c = 0; c < columns.size(); c++)
+    {
+        pkt.clear();
+        put_lenenc_str(pkt, "def");
+        put_lenenc_str(pkt, "webserver");
+        put_lenenc_str(pkt, "user");
+        put_lenenc_str(pkt, "user");
+        put_lenenc_str(pkt, columns[c]);
+        put_lenenc_str(pkt, columns[c]);
+        put_lenenc_int(pkt, 0x0c);
+        put_int(pkt, CHARSET_UTF8_GENERAL_CI, 2);
+        put_int(pkt, 150, 4); // char(50) * 3字节
+        put_int(pkt, MYSQL_TYPE_VAR_STRING, 1);
+        put_int(pkt, 0, 2); // flags
+        put_int(pkt, 0, 1); // decimals
+        put_int(pkt, 0, 2); // filler
+        if (!write_packet(s, pkt))
+        {
+            return false;
+        }
+    }
+    if (!send_eof(s))
+    {
+        return false;
+    }
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        pkt.clear();
+        for (size_t c = 0; c < rows[r].size(); c++)
+        {
+            put_lenenc_str(pkt, rows[r][c]);
+        }
+        if (!write_packet(s, pkt))
+        {
+            return false;
+        }
+    }
+    return send_eof(s);
+}
@@ -0,0 +1,90 @@
+#ifndef MOCK_MYSQL_H
+#define MOCK_MYSQL_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "../thread_pool/locker.h"
+
+/*
+    本地MySQL替身服务器
+
+    只实现了MySQL客户端/服务器协议(Protocol 4.1)中压测所需的最小子集：
+    握手(mysql_native_password，不校验密码)、COM_QUERY、COM_PING、COM_INIT_DB、COM_QUIT，
+    以及文本协议的结果集。SQL方面只认识对user(username,password)表的
+    SELECT ... [WHERE col = 'x' [AND col IN ('a','b')]] 和 INSERT [IGNORE] INTO ... VALUES (...),(...)，
+    其余语句(SET/BEGIN/COMMIT等)一律回复OK。
+
+    每条查询在回复前可注入固定延迟+随机抖动，并按失败率回复ERR包，
+    随机数由种子+连接号决定，使同样的压测参数可以复现同样的结果。
+*/
+class mock_mysql_server
+{
+public:
+    struct config
+    {
+        int port;            // 监听端口
+        int latency_ms;      // 每条查询注入的固定延迟
+        int jitter_ms;       // 在固定延迟之上叠加的[0,jitter_ms]均匀抖动
+        double fail_rate;    // 查询失败(回复ERR)的概率，[0,1]
+        unsigned int seed;   // 随机种子
+        int preload_users;   // 预置user0..userN-1，密码均为passwd
+    };
+
+    mock_mysql_server(const config &conf);
+    ~mock_mysql_server();
+    // 预置一个用户
+    void add_user(const std::string &name, const std::string &pwd);
+    // 监听并循环接收连接，每个连接由一个脱离线程服务；失败返回false
+    bool run();
+    // 打印统计信息
+    void dump_stats();
+
+private:
+    struct session
+    {
+        mock_mysql_server *server;
+        int fd;
+        uint32_t conn_id;
+        unsigned int rand_state;
+        uint8_t seq;
+    };
+    typedef std::vector<std::string> row_t;
+
+    static void *serve(void *arg);
+    void serve_session(session *s);
+
+    bool handshake(session *s);
+    bool handle_query(session *s, const std::string &sql);
+    void inject_latency(session *s);
+    bool should_fail(session *s);
+
+    bool exec_select(session *s, const std::string &sql);
+    bool exec_insert(session *s, const std::string &sql);
+
+    // 协议包的收发
+    bool read_packet(session *s, std::string &payload);
+    bool write_packet(session *s, const std::string &payload);
+    bool send_ok(session *s, uint64_t affected_rows);
+    bool send_err(session *s, uint16_t code, const char *state, const char *msg);
+    bool send_eof(session *s);
+    bool send_result_set(session *s, const std::vector<std::string> &columns,
+                         const std::vector<row_t> &rows);
+
+private:
+    config m_conf;
+    int m_listenfd;
+    uint32_t m_next_conn_id;
+
+    // 内存中的user表，按插入顺序保存，保护它的互斥锁
+    std::vector<std::pair<std::string, std::string> > m_users;
+    locker m_table_lock;
+
+    // 统计量
+    locker m_stat_lock;
+    long long m_stat_conns;
+    long long m_stat_queries;
+    long long m_stat_failed;
+};
+
+#endif
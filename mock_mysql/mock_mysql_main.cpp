@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
+
+#include "mock_mysql.h"
+
+static void usage(const char *prog)
+{
+    printf("按照如下格式运行：%s [-p port] [-l latency_ms] [-j jitter_ms] [-f fail_rate]\n"
+           "                 [-s seed] [-n preload_users] [-u name:password]...\n",
+           prog);
+}
+
+static void *run_server(void *arg)
+{
+    mock_mysql_server *server = (mock_mysql_server *)arg;
+    server->run();
+    // run只会在监听失败时返回
+    kill(getpid(), SIGTERM);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    mock_mysql_server::config conf;
+    conf.port = 3307;
+    conf.latency_ms = 0;
+    conf.jitter_ms = 0;
+    conf.fail_rate = 0;
+    conf.seed = 1;
+    conf.preload_users = 0;
+
+    std::vector<std::pair<std::string, std::string> > users;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:j:f:s:n:u:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            conf.port = atoi(optarg);
+            break;
+        case 'l':
+            conf.latency_ms = atoi(optarg);
+            break;
+        case 'j':
+            conf.jitter_ms = atoi(optarg);
+            break;
+        case 'f':
+            conf.fail_rate = atof(optarg);
+            break;
+        case 's':
+            conf.seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            conf.preload_users = atoi(optarg);
+            break;
+        case 'u':
+        {
+            const char *sep = strchr(optarg, ':');
+            if (sep == NULL)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            users.push_back(std::make_pair(std::string(optarg, sep - optarg), std::string(sep + 1)));
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    mock_mysql_server server(conf);
+    for (size_t i = 0; i < users.size(); i++)
+    {
+        server.add_user(users[i].first, users[i].second);
+    }
+
+    // 在创建任何线程前屏蔽退出信号，由主线程同步地等待它们，退出前打印统计
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, run_server, &server) != 0)
+    {
+        return -1;
+    }
+    int sig = 0;
+    sigwait(&set, &sig);
+    server.dump_stats();
+    return 0;
+}
@@ -1,4 +1,14 @@
 #include "mysql_conn_pool.h"
+#include "../metrics/metrics.h"
+
+/*
+    线程亲和模式下当前线程的专属连接，以及它属于哪个连接池。
+    专属连接从建立起就只被这一个线程使用，所以访问它无需任何同步
+*/
+static __thread connection_pool *t_affine_owner = NULL;
+static __thread MYSQL *t_affine_conn = NULL;
+// 当前线程是否是登记过的工作线程，只有它们才会分到专属连接
+static __thread bool t_affine_worker = false;
 
 connection_pool::~connection_pool()
 {
@@ -52,12 +62,148 @@ void connection_pool::init(unsigned int max_size, string url, int port, string u
     }
 }
 
+void connection_pool::enable_thread_affinity(unsigned int max_affine)
+{
+    m_lock.lock();
+    if (!m_affine_state && max_affine > 0)
+    {
+        m_affine_state = std::make_shared<affine_state>();
+        m_affine_state->alive = true;
+        pthread_key_create(&m_affine_key, on_thread_exit);
+    }
+    m_max_affine = max_affine;
+    m_thread_affine.store(max_affine > 0);
+    m_lock.unlock();
+    LOG_INFO("--mysql connection pool thread affinity %s, up to %u dedicated connection(s)",
+             max_affine > 0 ? "on" : "off", max_affine);
+}
+
+void connection_pool::register_worker()
+{
+    t_affine_worker = true;
+}
+
+MYSQL *connection_pool::create_connection()
+{
+    MYSQL *conn = mysql_init(NULL);
+    if (conn == NULL)
+    {
+        return NULL;
+    }
+    if (mysql_real_connect(conn, m_url.c_str(), m_user_name.c_str(),
+                           m_pass_word.c_str(), m_database_name.c_str(), m_port, NULL, 0) == NULL)
+    {
+        LOG_ERROR("--mysql connection pool failed to connect:%s", mysql_error(conn));
+        mysql_close(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+MYSQL *connection_pool::bind_thread_connection()
+{
+    // 只在线程第一次取连接时执行，先占名额再在锁外建立连接，避免连接耗时阻塞其他线程
+    m_lock.lock();
+    MYSQL *conn = NULL;
+    if (!m_affine_spare.empty())
+    {
+        // 优先接手已退出线程留下的专属连接
+        conn = m_affine_spare.front();
+        m_affine_spare.pop_front();
+        m_lock.unlock();
+        bind_to_thread(conn);
+        return conn;
+    }
+    if (m_affine_reserved >= m_max_affine)
+    {
+        unsigned int max_affine = m_max_affine;
+        m_lock.unlock();
+        // 每个线程只会走到这里一次，名额不够时提示调大专属连接数
+        LOG_WARN("--mysql connection pool's %u dedicated connection(s) are all taken, thread %ld uses the shared pool",
+                 max_affine, pthread_self());
+        return NULL;
+    }
+    m_affine_reserved++;
+    m_lock.unlock();
+
+    conn = create_connection();
+    m_lock.lock();
+    if (conn == NULL)
+    {
+        m_affine_reserved--;
+    }
+    else
+    {
+        m_affine_conns.push_back(conn);
+    }
+    m_lock.unlock();
+    if (conn != NULL)
+    {
+        bind_to_thread(conn);
+    }
+    return conn;
+}
+
+void connection_pool::bind_to_thread(MYSQL *conn)
+{
+    t_affine_owner = this;
+    t_affine_conn = conn;
+    affine_binding *binding = new affine_binding;
+    binding->state = m_affine_state;
+    binding->pool = this;
+    binding->conn = conn;
+    pthread_setspecific(m_affine_key, binding);
+    LOG_INFO("--mysql connection pool bind a dedicated connection to thread %ld", pthread_self());
+}
+
+void connection_pool::on_thread_exit(void *arg)
+{
+    affine_binding *binding = (affine_binding *)arg;
+    affine_state *state = binding->state.get();
+    state->lock.lock();
+    // 连接池已经销毁时连接也已关闭，连接池本身也可能已被释放，不能再访问
+    if (state->alive)
+    {
+        connection_pool *pool = binding->pool;
+        pool->m_lock.lock();
+        pool->m_affine_spare.push_back(binding->conn);
+        pool->m_lock.unlock();
+    }
+    state->lock.unlock();
+    delete binding;
+}
+
 MYSQL *connection_pool::get_connection()
 {
     MYSQL *conn = NULL;
+    if (t_affine_worker && m_thread_affine.load(std::memory_order_relaxed))
+    {
+        // 快路径：当前线程已有专属连接，直接使用
+        if (t_affine_owner == this && t_affine_conn != NULL)
+        {
+            return t_affine_conn;
+        }
+        if (t_affine_owner != this)
+        {
+            // 每个线程只尝试绑定一次，失败后一直走共享池
+            t_affine_owner = this;
+            t_affine_conn = NULL;
+            conn = bind_thread_connection();
+            if (conn != NULL)
+            {
+                return conn;
+            }
+        }
+    }
     if (0 == m_conn_pool.size())
         return NULL;
-    m_resourse.wait();
+    metrics::add(metrics::DB_POOL_ACQUIRES);
+    // 先不阻塞地试一次，取不到才计一次等待再阻塞，由此可以看出连接池是否过小
+    if (!m_resourse.try_wait())
+    {
+        metrics::add(metrics::DB_POOL_WAITS);
+        m_resourse.wait();
+    }
     m_lock.lock();
     conn = m_conn_pool.front();
     m_conn_pool.pop_front();
@@ -69,6 +215,9 @@ bool connection_pool::release_connection(MYSQL *conn)
 {
     if (NULL == conn)
         return false;
+    // 专属连接一直留在线程中，不归还
+    if (t_affine_owner == this && t_affine_conn == conn)
+        return true;
     m_lock.lock();
     m_conn_pool.push_back(conn);
     m_lock.unlock();
@@ -78,6 +227,16 @@ bool connection_pool::release_connection(MYSQL *conn)
 
 void connection_pool::destroy()
 {
+    if (m_affine_state)
+    {
+        // 先标记连接池失效：正在退出的线程要么已经放回专属连接，要么看到失效后不再访问连接池
+        m_affine_state->lock.lock();
+        m_affine_state->alive = false;
+        m_affine_state->lock.unlock();
+        // 此后退出的线程不再调用on_thread_exit，它们的绑定信息随进程退出释放
+        pthread_key_delete(m_affine_key);
+        m_affine_state.reset();
+    }
     m_lock.lock();
     if (m_conn_pool.size() > 0)
     {
@@ -87,6 +246,13 @@ void connection_pool::destroy()
         }
         m_conn_pool.clear();
     }
+    for (auto it : m_affine_conns)
+    {
+        mysql_close(it);
+    }
+    m_affine_conns.clear();
+    m_affine_spare.clear();
+    m_thread_affine.store(false);
     m_lock.unlock();
 }
 
@@ -104,3 +270,74 @@ MYSQL *connection_pool_wrapper::get_raw_connection()
 {
     return m_connection;
 }
+
+sql_result::sql_result() : m_res(NULL)
+{
+}
+
+sql_result::sql_result(MYSQL_RES *res) : m_res(res)
+{
+}
+
+sql_result::sql_result(sql_result &&other) : m_res(other.m_res)
+{
+    other.m_res = NULL;
+}
+
+sql_result &sql_result::operator=(sql_result &&other)
+{
+    if (this != &other)
+    {
+        reset();
+        m_res = other.m_res;
+        other.m_res = NULL;
+    }
+    return *this;
+}
+
+sql_result::~sql_result()
+{
+    reset();
+}
+
+sql_result sql_result::store(MYSQL *conn)
+{
+    return sql_result(mysql_store_result(conn));
+}
+
+sql_result sql_result::use(MYSQL *conn)
+{
+    return sql_result(mysql_use_result(conn));
+}
+
+MYSQL_ROW sql_result::fetch_row()
+{
+    if (m_res == NULL)
+    {
+        return NULL;
+    }
+    return mysql_fetch_row(m_res);
+}
+
+bool sql_result::valid() const
+{
+    return m_res != NULL;
+}
+
+MYSQL_RES *sql_result::get()
+{
+    return m_res;
+}
+
+void sql_result::reset()
+{
+    if (m_res != NULL)
+    {
+        /*
+            对于use()得到的结果集，mysql_free_result会先把服务器上没读完的行读掉，
+            从而使连接可以继续执行下一条查询
+        */
+        mysql_free_result(m_res);
+        m_res = NULL;
+    }
+}
@@ -3,6 +3,8 @@
 #include <mysql/mysql.h>
 #include <string>
 #include <list>
+#include <atomic>
+#include <memory>
 
 #include "../thread_pool/locker.h"
 #include "../log/log.h"
@@ -11,10 +13,23 @@ using std::string;
 class connection_pool
 {
 public:
-    connection_pool(){};
+    connection_pool() : m_max_size(0), m_thread_affine(false), m_max_affine(0), m_affine_reserved(0){};
     ~connection_pool();
     void init(unsigned int max_size, string url, int port,
               string user, string pwd, string database_name);
+    /*
+        开启线程亲和模式：每个调用线程第一次取连接时，为其单独建立一条专属连接并
+        记在线程局部变量里，此后该线程取/还连接都不经过信号量和互斥锁。
+        专属连接最多建立max_affine条，超出的线程(或专属连接建立失败的线程)
+        仍然使用init建立的共享连接，共享部分即作为溢出池。
+        一般将max_affine设为线程池的线程数。
+        只有调用过register_worker()的线程才会分到专属连接，注册批处理器这类
+        辅助线程即使访问数据库也只用共享连接，不占用为工作线程预留的名额。
+        线程退出时(如线程池收缩)，它的专属连接留给之后第一次取连接的线程，名额不会流失。
+    */
+    void enable_thread_affinity(unsigned int max_affine);
+    // 把调用线程登记为可以分到专属连接的工作线程，作为线程池的线程初始化函数使用
+    static void register_worker();
     // 从数据库连接池中请求一个可用连接
     MYSQL *get_connection();
     // 释放一个可用连接，归还到池中
@@ -22,6 +37,33 @@ public:
     // 与init相对，销毁数据库连接池
     void destroy();
 
+private:
+    // 按保存的服务器信息建立一条连接，失败返回NULL
+    MYSQL *create_connection();
+    // 为当前线程建立专属连接，名额用完或建立失败返回NULL
+    MYSQL *bind_thread_connection();
+    // 线程退出时由线程局部存储的析构函数调用，把专属连接留给后来的线程
+    static void on_thread_exit(void *arg);
+    // 把专属连接记为当前线程所有
+    void bind_to_thread(MYSQL *conn);
+
+    /*
+        专属连接的回收状态，由连接池和每个绑定了专属连接的线程共同持有。
+        线程可能在连接池销毁(甚至释放)之后才退出，退出时先在这里确认连接池还在
+    */
+    struct affine_state
+    {
+        locker lock;
+        bool alive;
+    };
+    // 线程退出时回收专属连接所需的信息
+    struct affine_binding
+    {
+        std::shared_ptr<affine_state> state;
+        connection_pool *pool;
+        MYSQL *conn;
+    };
+
 private:
     locker m_lock;                  // 保护连接池的互斥访问量
     sem m_resourse;                 // 连接池资源信号量
@@ -29,6 +71,14 @@ private:
 
     unsigned int m_max_size; // 最大连接数
 
+    std::atomic<bool> m_thread_affine;   // 是否开启线程亲和模式，取/还连接时在锁外读取
+    unsigned int m_max_affine;           // 专属连接的最大条数
+    unsigned int m_affine_reserved;      // 已占用的专属连接名额，受m_lock保护
+    std::list<MYSQL *> m_affine_conns;   // 所有专属连接，仅用于销毁时关闭
+    std::list<MYSQL *> m_affine_spare;   // 所属线程已退出、等待交给新线程的专属连接
+    pthread_key_t m_affine_key;          // 用于在线程退出时回收专属连接
+    std::shared_ptr<affine_state> m_affine_state; // 开启线程亲和模式时建立，同时建立m_affine_key
+
     string m_url;           // mysql服务器地址
     int m_port;             // mysql服务器端口
     string m_user_name;     // 连接用户
@@ -52,4 +102,40 @@ private:
     connection_pool &m_pool;
     MYSQL *m_connection;
 };
+
+/*
+    基于RAII管理查询结果集MYSQL_RES，析构时自动mysql_free_result
+    结果集只能移动不能拷贝，避免同一个MYSQL_RES被释放两次
+
+    store(): mysql_store_result，整个结果集一次性缓存到客户端，适合单行/少量行的查询
+    use():   mysql_use_result，fetch_row时才逐行从服务器拉取，适合全表扫描，
+             客户端内存只占一行；但在结果集释放(或读完)之前，该连接不能执行别的查询
+*/
+class sql_result
+{
+public:
+    sql_result();
+    explicit sql_result(MYSQL_RES *res);
+    sql_result(sql_result &&other);
+    sql_result &operator=(sql_result &&other);
+    ~sql_result();
+
+    static sql_result store(MYSQL *conn);
+    static sql_result use(MYSQL *conn);
+
+    // 取下一行，结果集为空或已取完时返回NULL
+    MYSQL_ROW fetch_row();
+    // 是否持有结果集(查询失败或语句没有结果集时为false)
+    bool valid() const;
+    MYSQL_RES *get();
+    // 提前释放结果集
+    void reset();
+
+private:
+    sql_result(const sql_result &) = delete;
+    sql_result &operator=(const sql_result &) = delete;
+
+private:
+    MYSQL_RES *m_res;
+};
 #endif
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include "register_batcher.h"
+#include <time.h>
+#include <set>
+
+// 把字符串转义后以'xxx'的形式追加到sql中
+static void append_quoted(MYSQL *conn, std::string &sql, const std::string &value)
+{
+    std::vector<char> buf(value.size() * 2 + 1);
+    unsigned long len = mysql_real_escape_string(conn, &buf[0], value.c_str(), value.size());
+    sql.push_back('\'');
+    sql.append(&buf[0], len);
+    sql.push_back('\'');
+}
+
+register_batcher::register_batcher(connection_pool *pool, int max_batch, int window_ms)
+    : m_pool(pool), m_max_batch(max_batch), m_window_ms(window_ms), m_submitters(NULL), m_submitters_arg(NULL),
+      m_thread(0), m_stop(false)
+{
+    if (pool == NULL || max_batch <= 0 || window_ms < 0)
+    {
+        throw std::exception();
+    }
+    if (pthread_create(&m_thread, NULL, work, this) != 0)
+    {
+        throw std::exception();
+    }
+    LOG_INFO("--register batcher started, batch size %d, window %dms", m_max_batch, m_window_ms);
+}
+
+register_batcher::~register_batcher()
+{
+    m_lock.lock();
+    m_stop = true;
+    m_lock.unlock();
+    m_arrive_cond.broadcast();
+    pthread_join(m_thread, NULL);
+}
+
+void register_batcher::set_submitters(int (*count)(void *), void *arg)
+{
+    m_lock.lock();
+    m_submitters = count;
+    m_submitters_arg = arg;
+    m_lock.unlock();
+}
+
+bool register_batcher::batch_ready()
+{
+    int waiting = (int)m_queue.size();
+    if (waiting >= m_max_batch)
+    {
+        return true;
+    }
+    // 能提交请求的线程都在这里等着了，再等下去也不会有新请求
+    int submitters = m_submitters ? m_submitters(m_submitters_arg) : 0;
+    return submitters > 0 && waiting >= submitters;
+}
+
+int register_batcher::submit(const char *username, const char *password)
+{
+    pending req;
+    req.username = username;
+    req.password = password;
+    req.result = REGISTER_DB_ERROR;
+    req.done = false;
+
+    m_lock.lock();
+    if (m_stop)
+    {
+        m_lock.unlock();
+        return REGISTER_DB_ERROR;
+    }
+    m_queue.push_back(&req);
+    // 第一个请求唤醒批处理线程开始计时，攒满一批或者提交线程都在等待时提前唤醒
+    if (m_queue.size() == 1 || batch_ready())
+    {
+        m_arrive_cond.signal();
+    }
+    while (!req.done)
+    {
+        m_done_cond.wait(m_lock.get_mutex());
+    }
+    m_lock.unlock();
+    return req.result;
+}
+
+void *register_batcher::work(void *args)
+{
+    ((register_batcher *)args)->run();
+    return NULL;
+}
+
+void register_batcher::run()
+{
+    std::vector<pending *> batch;
+    m_lock.lock();
+    while (true)
+    {
+        while (m_queue.empty() && !m_stop)
+        {
+            m_arrive_cond.wait(m_lock.get_mutex());
+        }
+        if (m_queue.empty() && m_stop)
+        {
+            break;
+        }
+        // 收到第一个请求后最多再等window_ms，让同一时间窗内的请求攒成一批
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)m_window_ms * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while (!batch_ready() && !m_stop)
+        {
+            if (!m_arrive_cond.timewait(m_lock.get_mutex(), &deadline))
+            {
+                // 超时(或出错)，不再等待，有多少处理多少
+                break;
+            }
+        }
+        int n = (int)m_queue.size() < m_max_batch ? (int)m_queue.size() : m_max_batch;
+        batch.assign(m_queue.begin(), m_queue.begin() + n);
+        m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+        m_lock.unlock();
+
+        commit_batch(batch);
+
+        m_lock.lock();
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            batch[i]->done = true;
+        }
+        m_done_cond.broadcast();
+    }
+    m_lock.unlock();
+}
+
+void register_batcher::commit_batch(std::vector<pending *> &batch)
+{
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        batch[i]->result = REGISTER_DB_ERROR;
+    }
+    connection_pool_wrapper safe_connect(*m_pool);
+    MYSQL *conn = safe_connect.get_raw_connection();
+    if (conn == NULL)
+    {
+        LOG_INFO("--注册批次(%d个)失败，失败原因:当前数据库连接池中连接用完", (int)batch.size());
+        return;
+    }
+
+    // 一条SELECT对整批查重
+    std::string sql = "SELECT username FROM user WHERE username IN (";
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        if (i > 0)
+            sql.push_back(',');
+        append_quoted(conn, sql, batch[i]->username);
+    }
+    sql.push_back(')');
+    if (mysql_real_query(conn, sql.c_str(), sql.size()))
+    {
+        LOG_ERROR("--注册批次查重失败:%s", mysql_error(conn));
+        return;
+    }
+    std::set<std::string> taken;
+    {
+        sql_result result = sql_result::store(conn);
+        MYSQL_ROW row;
+        while ((row = result.fetch_row()))
+        {
+            taken.insert(row[0]);
+        }
+    }
+
+    // 已存在的、以及同一批内重名的后来者都判为已存在，其余的一条多行INSERT写入
+    std::vector<pending *> inserts;
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        if (taken.count(batch[i]->username))
+        {
+            batch[i]->result = REGISTER_EXISTS;
+            continue;
+        }
+        taken.insert(batch[i]->username);
+        inserts.push_back(batch[i]);
+    }
+    if (inserts.empty())
+    {
+        return;
+    }
+    sql = "INSERT INTO user(username,password) VALUES";
+    for (size_t i = 0; i < inserts.size(); i++)
+    {
+        sql += (i > 0) ? ",(" : "(";
+        append_quoted(conn, sql, inserts[i]->username);
+        sql.push_back(',');
+        append_quoted(conn, sql, inserts[i]->password);
+        sql.push_back(')');
+    }
+    if (mysql_real_query(conn, sql.c_str(), sql.size()))
+    {
+        LOG_ERROR("--注册批次写入失败:%s", mysql_error(conn));
+        return;
+    }
+    for (size_t i = 0; i < inserts.size(); i++)
+    {
+        inserts[i]->result = REGISTER_OK;
+    }
+    LOG_INFO("--注册批次完成: %d个请求, 写入%d个用户", (int)batch.size(), (int)inserts.size());
+}
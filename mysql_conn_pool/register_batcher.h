@@ -0,0 +1,81 @@
+#ifndef REGISTER_BATCHER_H
+#define REGISTER_BATCHER_H
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "mysql_conn_pool.h"
+
+/*
+    注册请求的批量提交(group commit)
+
+    原来每个注册请求都要独占一条连接做一次SELECT查重和一次单行INSERT，
+    注册高峰时8条连接和MySQL的提交路径都会被打满。
+
+    现在工作线程调用submit()把注册请求交给后台的批处理线程后阻塞等待；
+    批处理线程攒够max_batch个请求或者等满window_ms毫秒后，用一条
+    SELECT ... IN (...)对整批查重，再用一条多行INSERT写入剩下的用户，
+    然后分别唤醒每个等待的工作线程，告知各自的结果。
+    用几毫秒的延迟换取注册吞吐量。
+    提交请求的线程有限(数据库执行器中正在执行任务的线程)，它们全都在等待时不会再有新请求，
+    这时不再等满时间窗，立即提交，否则每个注册都要白白占住一个线程window_ms毫秒。
+
+    由于所有注册都经过这一个线程写入，批内和批间的查重都是准确的，
+    不依赖user表上的唯一键。
+*/
+class register_batcher
+{
+public:
+    enum E_REGISTER_RESULT
+    {
+        REGISTER_OK = 0,    // 注册成功
+        REGISTER_EXISTS,    // 用户名已存在
+        REGISTER_DB_ERROR   // 数据库出错或没有可用连接
+    };
+
+    register_batcher(connection_pool *pool, int max_batch = 32, int window_ms = 5);
+    // 处理完已提交的请求后结束批处理线程
+    ~register_batcher();
+    // 提交一个注册请求并阻塞到该请求所在的批次完成，返回E_REGISTER_RESULT
+    int submit(const char *username, const char *password);
+    /*
+        设置当前可能提交请求的线程数，由count(arg)在需要时读取，应在提交请求前调用；
+        等待中的请求数达到该值时立即提交这一批。不设置时总是等满时间窗
+    */
+    void set_submitters(int (*count)(void *), void *arg);
+
+private:
+    struct pending
+    {
+        std::string username;
+        std::string password;
+        int result;
+        bool done;
+    };
+
+    static void *work(void *args);
+    void run();
+    // 执行一批注册，并填好每个请求的result
+    void commit_batch(std::vector<pending *> &batch);
+    // 在锁内调用，等待中的请求是否已经可以提交，不必再等时间窗
+    bool batch_ready();
+
+private:
+    connection_pool *m_pool;
+    int m_max_batch;
+    int m_window_ms;
+    int (*m_submitters)(void *);
+    void *m_submitters_arg;
+    pthread_t m_thread;
+    bool m_stop;
+
+    // 保护m_queue、m_stop以及各请求的done标记
+    locker m_lock;
+    // 有新请求到达
+    cond m_arrive_cond;
+    // 有批次完成
+    cond m_done_cond;
+    std::vector<pending *> m_queue;
+};
+
+#endif
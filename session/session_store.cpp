@@ -0,0 +1,169 @@
+#include "session_store.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <functional>
+
+session_store::session_store(int ttl, int shard_count)
+    : m_shards(NULL), m_shard_mask(0), m_ttl(ttl), m_random_fd(-1)
+{
+    if (ttl <= 0 || shard_count <= 0)
+    {
+        throw std::exception();
+    }
+    int n = 1;
+    while (n < shard_count)
+    {
+        n <<= 1;
+    }
+    m_shard_mask = n - 1;
+    m_shards = new shard[n];
+    m_random_fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (m_random_fd == -1)
+    {
+        delete[] m_shards;
+        throw std::exception();
+    }
+}
+
+session_store::~session_store()
+{
+    delete[] m_shards;
+    if (m_random_fd != -1)
+    {
+        close(m_random_fd);
+    }
+}
+
+session_store::shard &session_store::shard_of(const std::string &sid)
+{
+    return m_shards[std::hash<std::string>()(sid) & m_shard_mask];
+}
+
+bool session_store::random_id(char *sid)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char bytes[SESSION_ID_LEN / 2];
+    size_t got = 0;
+    while (got < sizeof(bytes))
+    {
+        ssize_t n = read(m_random_fd, bytes + got, sizeof(bytes) - got);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        got += n;
+    }
+    for (size_t i = 0; i < sizeof(bytes); i++)
+    {
+        sid[2 * i] = hex[bytes[i] >> 4];
+        sid[2 * i + 1] = hex[bytes[i] & 0x0f];
+    }
+    sid[SESSION_ID_LEN] = '\0';
+    return true;
+}
+
+bool session_store::create(const char *username, char *sid)
+{
+    if (!random_id(sid))
+    {
+        return false;
+    }
+    std::string key(sid);
+    session_entry entry;
+    entry.username = username;
+    entry.expire = time(NULL) + m_ttl;
+    shard &s = shard_of(key);
+    s.lock.lock();
+    s.sessions[key] = entry;
+    s.lock.unlock();
+    return true;
+}
+
+bool session_store::validate(const char *sid, std::string *username)
+{
+    if (sid == NULL || strlen(sid) != SESSION_ID_LEN)
+    {
+        return false;
+    }
+    std::string key(sid);
+    time_t now = time(NULL);
+    bool ok = false;
+    shard &s = shard_of(key);
+    s.lock.lock();
+    std::unordered_map<std::string, session_entry>::iterator it = s.sessions.find(key);
+    if (it != s.sessions.end())
+    {
+        if (it->second.expire > now)
+        {
+            // 滑动过期：每次使用都续期
+            it->second.expire = now + m_ttl;
+            if (username)
+            {
+                *username = it->second.username;
+            }
+            ok = true;
+        }
+        else
+        {
+            s.sessions.erase(it);
+        }
+    }
+    s.lock.unlock();
+    return ok;
+}
+
+void session_store::remove(const char *sid)
+{
+    std::string key(sid);
+    shard &s = shard_of(key);
+    s.lock.lock();
+    s.sessions.erase(key);
+    s.lock.unlock();
+}
+
+int session_store::expire(time_t now)
+{
+    int removed = 0;
+    // 逐个分片清理，每次只持有一把分片锁，不会让所有工作线程同时等待
+    for (int i = 0; i <= m_shard_mask; i++)
+    {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        std::unordered_map<std::string, session_entry>::iterator it = s.sessions.begin();
+        while (it != s.sessions.end())
+        {
+            if (it->second.expire <= now)
+            {
+                it = s.sessions.erase(it);
+                removed++;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        s.lock.unlock();
+    }
+    return removed;
+}
+
+int session_store::size()
+{
+    int total = 0;
+    for (int i = 0; i <= m_shard_mask; i++)
+    {
+        m_shards[i].lock.lock();
+        total += m_shards[i].sessions.size();
+        m_shards[i].lock.unlock();
+    }
+    return total;
+}
+
+int session_store::get_ttl()
+{
+    return m_ttl;
+}
@@ -0,0 +1,67 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+#include <time.h>
+#include <string>
+#include <unordered_map>
+
+#include "../thread_pool/locker.h"
+
+/*
+    登录会话存储
+
+    登录成功后为客户端生成一个随机会话ID，通过Set-Cookie下发，之后的请求带着
+    Cookie回来时只需要在这里查一次哈希表即可确认身份，不用再查询数据库。
+
+    会话表按会话ID的哈希分成若干分片，每个分片一把锁(锁分段)，工作线程之间
+    只有落到同一分片时才会竞争。过期清理由主线程的定时器心跳(SIGALRM)驱动。
+*/
+class session_store
+{
+public:
+    // 会话ID为16字节随机数的十六进制串
+    static const int SESSION_ID_LEN = 32;
+
+    /*
+        param:
+            ttl: 会话空闲多少秒后过期，每次校验成功都会续期
+            shard_count: 分片数，向上取整为2的幂
+    */
+    session_store(int ttl = 1800, int shard_count = 16);
+    ~session_store();
+    // 为用户新建会话，会话ID写入sid(至少SESSION_ID_LEN+1字节)，失败返回false
+    bool create(const char *username, char *sid);
+    // 校验会话，有效则续期并可选地取出用户名
+    bool validate(const char *sid, std::string *username = NULL);
+    // 注销会话
+    void remove(const char *sid);
+    // 清理所有在now之前过期的会话，返回清理的个数
+    int expire(time_t now);
+    // 当前会话总数
+    int size();
+    int get_ttl();
+
+private:
+    struct session_entry
+    {
+        std::string username;
+        time_t expire;
+    };
+    // 每个分片独占一条缓存行，避免相邻分片的锁互相伪共享
+    struct alignas(64) shard
+    {
+        locker lock;
+        std::unordered_map<std::string, session_entry> sessions;
+    };
+
+    shard &shard_of(const std::string &sid);
+    bool random_id(char *sid);
+
+private:
+    shard *m_shards;
+    int m_shard_mask;
+    int m_ttl;
+    // /dev/urandom，用于生成会话ID
+    int m_random_fd;
+};
+
+#endif
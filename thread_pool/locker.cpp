@@ -87,6 +87,11 @@ bool sem::wait()
     return sem_wait(&m_sem) == 0;
 }
 
+bool sem::try_wait()
+{
+    return sem_trywait(&m_sem) == 0;
+}
+
 bool sem::post()
 {
     return sem_post(&m_sem) == 0;
@@ -43,6 +43,8 @@ public:
     sem(int sem_val, int pshared = 0);
     ~sem();
     bool wait();
+    // 不阻塞地尝试取一个信号量，信号量为0时返回false
+    bool try_wait();
     bool post();
 
 private:
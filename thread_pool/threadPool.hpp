@@ -4,19 +4,59 @@
 #include <list>
 #include <exception>
 #include <iostream>
+#include <atomic>
+#include <math.h>
+#include <time.h>
 #include "../log/log.h"
+#include "../metrics/probes.h"
 #include "locker.h"
 
 /*
     线程池类
+
+    T需要提供process()执行任务，以及expire()处理在队列中等待过久、不再执行的任务。
+
+    线程数在[min_threads, max_threads]之间伸缩(max_threads为0时固定为min_threads)：
+    - 添加任务时，如果排队的任务多于空闲线程，并且最近任务的排队时间偏高，或者工作线程
+      执行任务的时间里被阻塞(等待数据库等)的比例偏高，就新建一个线程；
+      阻塞比例由任务前后的挂钟时间与线程CPU时间之差得到，不需要任务配合；
+    - 线程空闲超过idle_timeout_ms且线程数多于min_threads时自行退出。
+    线程都是可join的，析构时通知所有线程退出并等待它们结束，正在执行的任务会执行完，
+    队列中还没执行的任务被丢弃。
+    thread_init不为NULL时，每个工作线程开始取任务前先调用它，用于登记线程局部的资源。
+
+    可以通过set_queue_deadline()限制任务的排队时间，工作线程取出任务时检查它的排队时间：
+    - 超过max_delay_ms的任务直接expire()，客户端多半已经放弃，不必再花时间解析、执行；
+    - 另外可以打开CoDel式的自适应丢弃：排队时间持续超过target_ms达一个interval_ms后进入丢弃状态，
+      丢弃一个任务，之后按interval/sqrt(丢弃次数)的间隔继续丢弃超过target的任务，直到排队时间回落。
+      这样持续过载时队列维持在较短的排队时间上，而短暂的突发不会触发丢弃。
  */
 template <typename T>
 class threadPool
 {
 public:
-    threadPool(int thread_number = 8, int max_request = 10000);
+    threadPool(int min_threads = 8, int max_request = 10000, int max_threads = 0, void (*thread_init)() = NULL);
     ~threadPool();
     bool append(T *request);
+    // 当前排队等待处理的任务数，不加锁，主线程每个请求入队前都会读取
+    int get_queue_size();
+    // 设置排队时间的上限和CoDel的目标/间隔(毫秒)，为0则不启用对应的检查，应在添加任务前调用
+    void set_queue_deadline(int max_delay_ms, int codel_target_ms = 0, int codel_interval_ms = 100);
+    // 因超过排队时间上限、因CoDel而被expire()的任务数
+    long long get_expired_deadline();
+    long long get_expired_codel();
+    /*
+        设置伸缩参数：线程空闲多久后退出，以及新建线程的两个条件：
+        平滑后的排队时间超过grow_wait_us，或者阻塞时间占比超过grow_blocked_percent
+    */
+    void set_elastic(int idle_timeout_ms, int grow_wait_us, int grow_blocked_percent);
+    // 当前线程数
+    int get_thread_count();
+    // 正在执行任务的线程数，不加锁
+    int get_busy_count();
+    // 平滑后的排队时间(微秒)和工作线程的阻塞时间占比(千分比)，用于监控
+    long long get_queue_wait();
+    long long get_blocked_permille();
 
 private:
     /*
@@ -25,82 +65,131 @@ private:
     */
     static void *worker(void *arg);
     void run();
+    static long long now_us();
+    static long long thread_cpu_us();
+    // 在锁内调用，新建一个工作线程
+    bool spawn_worker();
+    // 在锁内调用，按需新建工作线程
+    void maybe_grow();
+    // 等待已退出的线程结束，不能在锁内调用
+    void reap_exited();
+    // 在锁内调用，判断排队了sojourn_us的任务是否应被丢弃
+    bool should_expire(long long sojourn_us, long long now);
 
 private:
-    // 线程池中线程的个数
-    int m_thread_number;
+    // 线程池中线程个数的上下限
+    int m_min_threads;
+    int m_max_threads;
+    // 工作线程启动时调用的初始化函数
+    void (*m_thread_init)();
 
-    // 线程池数组
-    pthread_t *m_threads;
+    // 存活的线程，以及空闲退出后等待join的线程，都在队列锁内访问
+    std::list<pthread_t> m_threads;
+    std::list<pthread_t> m_exited;
+    // 正在等待任务的线程数，已创建但还没开始等待任务的线程数
+    int m_idle;
+    int m_starting;
+    std::atomic<int> m_thread_count;
+    std::atomic<int> m_busy;
 
     // 请求队列中允许的最大请求数
     int m_max_request;
 
     // 请求队列,请求的实体类等待模板T进行实例化
     /* 为什么使用list作为队列的实现？难道需要大量的中途插入操作吗? */
-    std::list<T *> m_workQueue;
+    // 队列中的任务及其入队时刻(微秒)，没有启用排队时间检查时入队时刻为0
+    struct task
+    {
+        T *request;
+        long long enqueue_us;
+    };
+    std::list<task> m_workQueue;
+    // 队列长度，在锁内与m_workQueue一起更新，读取时不需要加锁
+    std::atomic<int> m_queue_size;
 
     // 线程池的互斥锁
     /* 使用互斥锁来使得对线程池的访问是安全的 */
     locker m_queueLocker;
 
-    // 信号量
-    /* 用来判定是否有任务需要处理 */
-    sem m_queueStat;
+    // 条件变量
+    /* 用来通知空闲线程有任务需要处理，配合m_queueLocker使用；等待可以超时，以便空闲线程退出 */
+    cond m_queueStat;
 
     // 是否结束线程
     bool m_stop;
+
+    // 排队时间检查的参数(微秒)，以及CoDel的状态，都在队列锁内访问
+    long long m_max_delay_us;
+    long long m_codel_target_us;
+    long long m_codel_interval_us;
+    long long m_first_above_us;
+    long long m_drop_next_us;
+    int m_drop_count;
+    bool m_dropping;
+    std::atomic<long long> m_expired_deadline;
+    std::atomic<long long> m_expired_codel;
+
+    // 伸缩参数和平滑后的统计值，都在队列锁内访问
+    long long m_idle_timeout_ms;
+    long long m_grow_wait_us;
+    long long m_grow_blocked_permille;
+    long long m_wait_ewma_us;
+    long long m_blocked_ewma_permille;
 };
 
 template <typename T>
-threadPool<T>::threadPool(int thread_number, int max_request)
-    : m_thread_number(thread_number), m_max_request(max_request),
-      m_stop(false), m_threads(NULL)
+threadPool<T>::threadPool(int min_threads, int max_request, int max_threads, void (*thread_init)())
+    : m_min_threads(min_threads), m_max_threads(max_threads > min_threads ? max_threads : min_threads),
+      m_thread_init(thread_init),
+      m_idle(0), m_starting(0), m_thread_count(0), m_busy(0), m_max_request(max_request), m_queue_size(0), m_stop(false),
+      m_max_delay_us(0), m_codel_target_us(0), m_codel_interval_us(0), m_first_above_us(0),
+      m_drop_next_us(0), m_drop_count(0), m_dropping(false), m_expired_deadline(0), m_expired_codel(0),
+      m_idle_timeout_ms(30000), m_grow_wait_us(1000), m_grow_blocked_permille(500),
+      m_wait_ewma_us(0), m_blocked_ewma_permille(0)
 {
-    if (thread_number <= 0 || max_request <= 0)
+    if (min_threads <= 0 || max_request <= 0)
     {
         throw std::exception();
     }
-    // 创建线程池队列
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads)
-    {
-        throw std::exception();
-    }
-    // 创建若干个线程，并将它们设置为线程脱离
-    for (int i = 0; i < thread_number; ++i)
+    // 先创建下限个数的线程
+    m_queueLocker.lock();
+    for (int i = 0; i < m_min_threads; ++i)
     {
-        // 创建线程，并将得到的线程tid存到线程池内
-        if (pthread_create(&m_threads[i], NULL, worker, this) != 0)
+        if (!spawn_worker())
         {
             /*
-                如果数组内指向的多个线程还未在脱离之前，出现线程创建失败，则
-                当前进程有责任释放之前创建好的线程
+                创建失败时，当前进程有责任结束之前创建好的线程
             */
-            delete[] m_threads;
-            throw std::exception();
-        }
-        // 设置为脱离线程
-        if (pthread_detach(m_threads[i]))
-        {
-            /*
-                如果数组内指向的多个线程还未全部脱离之前，出现线程脱离失败，则
-                当前进程有责任释放之前创建好的线程
-            */
-            delete[] m_threads;
+            m_stop = true;
+            m_queueStat.broadcast();
+            m_queueLocker.unlock();
+            for (std::list<pthread_t>::iterator it = m_threads.begin(); it != m_threads.end(); ++it)
+            {
+                pthread_join(*it, NULL);
+            }
             throw std::exception();
         }
-        LOG_DEBUG("--thread pool create the %dth thread,pid:%ld", i, m_threads[i]);
     }
-    printf("--thread pool has created %d threads...\n", m_thread_number);
-    LOG_INFO("--thread pool has created %d threads...", m_thread_number);
+    m_queueLocker.unlock();
+    printf("--thread pool has created %d threads(max %d)...\n", m_min_threads, m_max_threads);
+    LOG_INFO("--thread pool has created %d threads(max %d)...", m_min_threads, m_max_threads);
 }
 
 template <typename T>
 threadPool<T>::~threadPool()
 {
-    delete[] m_threads;
+    // 通知所有线程退出，等它们执行完手上的任务
+    m_queueLocker.lock();
     m_stop = true;
+    m_queueStat.broadcast();
+    std::list<pthread_t> threads;
+    threads.swap(m_threads);
+    threads.splice(threads.end(), m_exited);
+    m_queueLocker.unlock();
+    for (std::list<pthread_t>::iterator it = threads.begin(); it != threads.end(); ++it)
+    {
+        pthread_join(*it, NULL);
+    }
 }
 
 template <typename T>
@@ -115,10 +204,209 @@ bool threadPool<T>::append(T *request)
         return false;
     }
     // 正常情况下，给任务队列中添加一个任务，同时解锁线程池
-    m_workQueue.push_back(request);
+    task t;
+    t.request = request;
+    t.enqueue_us = m_max_delay_us > 0 || m_codel_target_us > 0 || m_max_threads > m_min_threads ? now_us() : 0;
+    m_workQueue.push_back(t);
+    m_queue_size.store(m_workQueue.size(), std::memory_order_relaxed);
+    TRACE_PROBE2(enqueue, request, m_workQueue.size());
+    maybe_grow();
+    bool has_exited = !m_exited.empty();
+    m_queueLocker.unlock();
+    // 任务队列中添加了一个任务，唤醒一个空闲线程
+    m_queueStat.signal();
+    if (has_exited)
+    {
+        reap_exited();
+    }
+    return true;
+}
+
+template <typename T>
+int threadPool<T>::get_queue_size()
+{
+    return m_queue_size.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+void threadPool<T>::set_queue_deadline(int max_delay_ms, int codel_target_ms, int codel_interval_ms)
+{
+    m_queueLocker.lock();
+    m_max_delay_us = max_delay_ms * 1000LL;
+    m_codel_target_us = codel_target_ms * 1000LL;
+    m_codel_interval_us = codel_interval_ms * 1000LL;
+    m_queueLocker.unlock();
+}
+
+template <typename T>
+long long threadPool<T>::get_expired_deadline()
+{
+    return m_expired_deadline.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+long long threadPool<T>::get_expired_codel()
+{
+    return m_expired_codel.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+void threadPool<T>::set_elastic(int idle_timeout_ms, int grow_wait_us, int grow_blocked_percent)
+{
+    m_queueLocker.lock();
+    m_idle_timeout_ms = idle_timeout_ms;
+    m_grow_wait_us = grow_wait_us;
+    m_grow_blocked_permille = grow_blocked_percent * 10LL;
+    m_queueLocker.unlock();
+}
+
+template <typename T>
+int threadPool<T>::get_thread_count()
+{
+    return m_thread_count.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+int threadPool<T>::get_busy_count()
+{
+    return m_busy.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+long long threadPool<T>::get_queue_wait()
+{
+    m_queueLocker.lock();
+    long long wait = m_wait_ewma_us;
+    m_queueLocker.unlock();
+    return wait;
+}
+
+template <typename T>
+long long threadPool<T>::get_blocked_permille()
+{
+    m_queueLocker.lock();
+    long long blocked = m_blocked_ewma_permille;
+    m_queueLocker.unlock();
+    return blocked;
+}
+
+template <typename T>
+bool threadPool<T>::spawn_worker()
+{
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, worker, this) != 0)
+    {
+        LOG_ERROR("--thread pool failed to create a thread");
+        return false;
+    }
+    m_threads.push_back(tid);
+    m_starting++;
+    m_thread_count.store(m_threads.size(), std::memory_order_relaxed);
+    LOG_DEBUG("--thread pool create a thread,pid:%ld, now %d threads", tid, (int)m_threads.size());
+    return true;
+}
+
+template <typename T>
+void threadPool<T>::maybe_grow()
+{
+    if (m_stop || (int)m_threads.size() >= m_max_threads)
+    {
+        return;
+    }
+    // 空闲的和正在启动的线程足够接下排队的任务时不新建
+    if ((int)m_workQueue.size() <= m_idle + m_starting)
+    {
+        return;
+    }
+    if (m_wait_ewma_us > m_grow_wait_us || m_blocked_ewma_permille > m_grow_blocked_permille)
+    {
+        spawn_worker();
+    }
+}
+
+template <typename T>
+void threadPool<T>::reap_exited()
+{
+    m_queueLocker.lock();
+    std::list<pthread_t> exited;
+    exited.swap(m_exited);
     m_queueLocker.unlock();
-    // 任务队列中添加了一个任务，则给任务队列信号量添加一个信号
-    m_queueStat.post();
+    // 这些线程已经离开了工作循环，join只是等它们走完最后几条指令
+    for (std::list<pthread_t>::iterator it = exited.begin(); it != exited.end(); ++it)
+    {
+        pthread_join(*it, NULL);
+    }
+}
+
+template <typename T>
+long long threadPool<T>::thread_cpu_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+template <typename T>
+long long threadPool<T>::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+template <typename T>
+bool threadPool<T>::should_expire(long long sojourn_us, long long now)
+{
+    if (m_max_delay_us > 0 && sojourn_us > m_max_delay_us)
+    {
+        m_expired_deadline.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if (m_codel_target_us <= 0 || m_codel_interval_us <= 0)
+    {
+        return false;
+    }
+    // 排队时间超过target且持续了一个interval才允许丢弃，队列已空说明积压已经消化
+    bool ok_to_drop = false;
+    if (sojourn_us < m_codel_target_us || m_workQueue.empty())
+    {
+        m_first_above_us = 0;
+    }
+    else if (m_first_above_us == 0)
+    {
+        m_first_above_us = now + m_codel_interval_us;
+    }
+    else if (now >= m_first_above_us)
+    {
+        ok_to_drop = true;
+    }
+
+    if (m_dropping)
+    {
+        if (!ok_to_drop)
+        {
+            m_dropping = false;
+            return false;
+        }
+        if (now < m_drop_next_us)
+        {
+            return false;
+        }
+        m_drop_count++;
+        m_drop_next_us += m_codel_interval_us / sqrt((double)m_drop_count);
+    }
+    else
+    {
+        if (!ok_to_drop)
+        {
+            return false;
+        }
+        m_dropping = true;
+        // 刚退出丢弃状态不久又进入时，从接近上次的丢弃频率开始
+        m_drop_count = m_drop_count > 2 && now - m_drop_next_us < 8 * m_codel_interval_us ? m_drop_count - 2 : 1;
+        m_drop_next_us = now + m_codel_interval_us / sqrt((double)m_drop_count);
+    }
+    m_expired_codel.fetch_add(1, std::memory_order_relaxed);
     return true;
 }
 
@@ -126,6 +414,10 @@ template <typename T>
 void *threadPool<T>::worker(void *arg)
 {
     threadPool *obj = (threadPool *)arg;
+    if (obj->m_thread_init)
+    {
+        obj->m_thread_init();
+    }
     obj->run();
     return obj;
 }
@@ -133,43 +425,125 @@ void *threadPool<T>::worker(void *arg)
 template <typename T>
 void threadPool<T>::run()
 {
+    // 上一个任务的执行时间和其中被阻塞的时间，在下一次加锁取任务时计入统计，不为此单独加锁
+    long long busy_us = 0;
+    long long blocked_us = 0;
+    m_queueLocker.lock();
+    m_starting--;
     /*
-    线程一直循环，直到m_stop参数被置为非0。线程池对象中的m_stop具有终止
+    线程一直循环，直到m_stop参数被置为true。线程池对象中的m_stop具有终止
     所有自身维护的线程的能力
     */
-    while (!m_stop)
+    while (true)
     {
-        // 取一个任务信号量，只有能取到任务信号量才可以做任务
-        /*
-        体现出了线程池中的线程睡眠在请求队列上，只有请求队列中有任务，进而
-        新增一个队列信号量，才会使得线程池中的一个线程醒来
-        */
-        m_queueStat.wait();
-        m_queueLocker.lock();
+        if (busy_us > 0)
+        {
+            long long permille = blocked_us * 1000 / busy_us;
+            m_blocked_ewma_permille += (permille - m_blocked_ewma_permille) / 8;
+            busy_us = 0;
+        }
         /*
-         此处迷惑：任务队列和队列信号量不是同步的吗，按理说得到了队列信号
-         就说明此时队列中有任务可做，那么此处判空的意义在于什么呢。
+        体现出了线程池中的线程睡眠在请求队列上，只有请求队列中有任务，
+        才会使得线程池中的一个线程醒来
         */
+        bool timed_out = false;
+        while (m_workQueue.empty() && !m_stop && !timed_out)
+        {
+            m_idle++;
+            if (m_max_threads > m_min_threads && m_idle_timeout_ms > 0)
+            {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += m_idle_timeout_ms / 1000;
+                deadline.tv_nsec += (m_idle_timeout_ms % 1000) * 1000000;
+                if (deadline.tv_nsec >= 1000000000)
+                {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                timed_out = !m_queueStat.timewait(m_queueLocker.get_mutex(), &deadline);
+            }
+            else
+            {
+                m_queueStat.wait(m_queueLocker.get_mutex());
+            }
+            m_idle--;
+        }
+        if (m_stop)
+        {
+            break;
+        }
         if (m_workQueue.empty())
         {
-            m_queueLocker.unlock();
+            // 空闲超时，线程数多于下限时退出，由之后的append或析构函数join
+            if ((int)m_threads.size() > m_min_threads)
+            {
+                pthread_t self = pthread_self();
+                for (std::list<pthread_t>::iterator it = m_threads.begin(); it != m_threads.end(); ++it)
+                {
+                    if (pthread_equal(*it, self))
+                    {
+                        m_threads.erase(it);
+                        break;
+                    }
+                }
+                m_exited.push_back(self);
+                m_thread_count.store(m_threads.size(), std::memory_order_relaxed);
+                LOG_DEBUG("--thread pool pid=%ld exit after idle, now %d threads", self, (int)m_threads.size());
+                break;
+            }
             continue;
         }
         // -- 线程池临界区 --
         // 任务队列出队一个任务
-        T *request = m_workQueue.front();
+        task t = m_workQueue.front();
+        T *request = t.request;
         m_workQueue.pop_front();
+        m_queue_size.store(m_workQueue.size(), std::memory_order_relaxed);
+        TRACE_PROBE2(dequeue, request, m_workQueue.size());
+        bool expired = false;
+        if (t.enqueue_us > 0)
+        {
+            long long now = now_us();
+            m_wait_ewma_us += (now - t.enqueue_us - m_wait_ewma_us) / 8;
+            expired = should_expire(now - t.enqueue_us, now);
+        }
+        bool measure = m_max_threads > m_min_threads;
+        m_busy.fetch_add(1, std::memory_order_relaxed);
         m_queueLocker.unlock();
-        /* 这一步和上面疑惑的一样，感觉有些多余 */
-        if (!request)
+        /* 这一步感觉有些多余 */
+        if (request)
         {
-            continue;
+            if (expired)
+            {
+                // 排队过久的任务不再执行，交给任务自己做廉价的收尾
+                request->expire();
+            }
+            else if (measure)
+            {
+                // 挂钟时间减去线程CPU时间，就是任务执行期间被阻塞(等待锁、数据库、磁盘)的时间
+                long long wall_begin = now_us();
+                long long cpu_begin = thread_cpu_us();
+                request->process();
+                busy_us = now_us() - wall_begin;
+                blocked_us = busy_us - (thread_cpu_us() - cpu_begin);
+                if (blocked_us < 0)
+                {
+                    blocked_us = 0;
+                }
+            }
+            else
+            {
+                // 当前线程 执行 任务对象的 任务代码
+                LOG_DEBUG("--[线程池]pid=%ld 线程开始一次作业", pthread_self());
+                request->process();
+                LOG_DEBUG("--[线程池]pid=%ld 线程结束一次作业", pthread_self());
+            }
         }
-        // 当前线程 执行 任务对象的 任务代码
-        LOG_DEBUG("--[线程池]pid=%ld 线程开始一次作业", pthread_self());
-        request->process();
-        LOG_DEBUG("--[线程池]pid=%ld 线程结束一次作业", pthread_self());
+        m_busy.fetch_sub(1, std::memory_order_relaxed);
+        m_queueLocker.lock();
     }
+    m_queueLocker.unlock();
 }
 
-#endif
\ No newline at end of file
+#endif